@@ -0,0 +1,989 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+/*
+ * svnfs-bench, run by "make bench" (see bench.sh):
+ *
+ *   svnfs-bench gen [-d depth] [-f fanout] [-n files] [-s max_size]
+ *           [-l large_size] [-p prop_percent] [-S seed] > dumpfile
+ *       writes a single revision dumpfile of a generated tree, for
+ *       svnadmin load.
+ *   svnfs-bench run [-i [-R]] [-r repeat] [-c cache_size]
+ *           [-m meta_size] [-b block_cache_size] [-v] TARGET
+ *       runs the standard workloads against TARGET, which is either a
+ *       mounted svnfs or, with -i, a repository URL read in-process
+ *       through svnclient_*, so no FUSE (or root) is needed. In-process
+ *       runs are pinned to HEAD and don't prefetch. -R reads a file://
+ *       URL through RA, as -o ra_local does, rather than directly.
+ *   svnfs-bench dircache NODES
+ *       builds a synthetic tree of NODES metadata nodes, then looks them
+ *       up and lists directories, both in the dircache and in a flat list
+ *       scanned the way the cache used to be.
+ *
+ * Every workload reports one line of "name value" pairs: operations,
+ * seconds, operations and MB per second, and p50/p99/max latency in
+ * microseconds.
+ */
+
+#include "svnfs.h"
+#include "svnclient.h"
+#include "contentcache.h"
+#include "blockcache.h"
+#include "idcache.h"
+#include "negcache.h"
+#include "origin.h"
+#include "flight.h"
+#include "prefetch.h"
+#include <sys/time.h>
+#include <strings.h>
+#include <time.h>
+
+/* Files read whole by the small file workload are no bigger than this */
+#define BENCH_SMALL_FILE (64 * 1024)
+
+/* ... and at most this many of them */
+#define BENCH_SMALL_FILES 5000
+
+/* Chunk size of the sequential read workload */
+#define BENCH_SEQ_CHUNK (128 * 1024)
+
+/* Size and count of the random read workload */
+#define BENCH_RANDOM_CHUNK 4096
+#define BENCH_RANDOM_READS 2000
+
+/* Size and count of the cold random read workload */
+#define BENCH_COLD_CHUNK (64 * 1024)
+#define BENCH_COLD_READS 64
+
+/* Lookups per node in the dircache workload */
+#define BENCH_DIRCACHE_LOOKUPS 4
+
+/* Lookups and listings of the flat list baseline, each a full scan */
+#define BENCH_FLAT_OPS 200
+
+/* Debug logging, for the svnfs modules linked in */
+void DEBUG(char *fmt, ...) {
+    if( svnfs.debug ) {
+        va_list ap;
+
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+    }
+}
+
+/* Deterministic xorshift generator, so a seed always gives one tree */
+static apr_uint64_t bench_seed = 88172645463325252ULL;
+
+static apr_uint64_t bench_random(void) {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return(bench_seed);
+}
+
+/* Parses a byte count with an optional K, M or G suffix */
+static int bench_parse_size(const char *arg, size_t *size) {
+    unsigned long long val;
+    char *end;
+
+    val = strtoull(arg, &end, 10);
+    if( end == arg )
+        return(1);
+    switch( *end ) {
+        case 'g': case 'G':
+            val <<= 10;
+            /* fall through */
+        case 'm': case 'M':
+            val <<= 10;
+            /* fall through */
+        case 'k': case 'K':
+            val <<= 10;
+            end++;
+            break;
+    }
+    if( *end != '\0' )
+        return(1);
+
+    *size = val;
+    return(0);
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Dumpfile generation
+ */
+
+struct bench_shape {
+    int depth;              /* Levels of directories below the root */
+    int fanout;             /* Subdirectories per directory */
+    int files;              /* Files per directory */
+    size_t max_size;        /* Small files are up to this big */
+    size_t large_size;      /* Size of /large.bin, 0 for none */
+    int prop_percent;       /* Nodes given svnfs:* properties */
+};
+
+/* Returns the properties block for a node, in dumpfile form */
+static size_t bench_props(const struct bench_shape *shape, char *buf,
+        size_t len, int dir) {
+    const char *mode = dir ? "0755" : "0644";
+    size_t n = 0;
+
+    if( (int)(bench_random() % 100) < shape->prop_percent )
+        n = snprintf(buf, len, "K 10\nsvnfs:mode\nV %lu\n%s\n",
+                (unsigned long)strlen(mode), mode);
+    n += snprintf(buf + n, len - n, "PROPS-END\n");
+    return(n);
+}
+
+static void bench_gen_node(const struct bench_shape *shape, const char *path,
+        int dir, size_t size) {
+    char props[128];
+    char data[8192];
+    size_t plen, n, i;
+
+    plen = bench_props(shape, props, sizeof(props), dir);
+    printf("Node-path: %s\nNode-kind: %s\nNode-action: add\n",
+            path, dir ? "dir" : "file");
+    if( dir ) {
+        printf("Prop-content-length: %lu\nContent-length: %lu\n\n%s\n",
+                (unsigned long)plen, (unsigned long)plen, props);
+        return;
+    }
+
+    printf("Prop-content-length: %lu\nText-content-length: %lu\n"
+            "Content-length: %lu\n\n%s", (unsigned long)plen,
+            (unsigned long)size, (unsigned long)(plen + size), props);
+    while( size ) {
+        n = size < sizeof(data) ? size : sizeof(data);
+        for( i = 0; i < n; i += sizeof(apr_uint64_t) ) {
+            apr_uint64_t r = bench_random();
+
+            memcpy(data + i, &r, n - i < sizeof(r) ? n - i : sizeof(r));
+        }
+        fwrite(data, 1, n, stdout);
+        size -= n;
+    }
+    printf("\n\n");
+}
+
+/* Small files get sizes spread evenly over each power of two */
+static size_t bench_file_size(size_t max_size) {
+    int bits = 0;
+
+    while( bits < 40 && ((size_t)1 << bits) < max_size )
+        bits++;
+    bits = bench_random() % (bits + 1);
+    return( bench_random() % (((size_t)1 << bits) < max_size ?
+                ((size_t)1 << bits) + 1 : max_size + 1) );
+}
+
+static void bench_gen_dir(const struct bench_shape *shape, const char *path,
+        int level) {
+    char child[4096];
+    int i;
+
+    for( i = 0; i < shape->files; i++ ) {
+        snprintf(child, sizeof(child), "%s%sf%d.txt", path,
+                *path ? "/" : "", i);
+        bench_gen_node(shape, child, 0, bench_file_size(shape->max_size));
+    }
+    if( level >= shape->depth )
+        return;
+    for( i = 0; i < shape->fanout; i++ ) {
+        snprintf(child, sizeof(child), "%s%sd%d", path, *path ? "/" : "", i);
+        bench_gen_node(shape, child, 1, 0);
+        bench_gen_dir(shape, child, level + 1);
+    }
+}
+
+static int bench_gen(int argc, char *argv[]) {
+    struct bench_shape shape = { 3, 8, 16, 64 * 1024, 64 * 1024 * 1024, 10 };
+    const char *rprops;
+    int c;
+
+    while( (c = getopt(argc, argv, "d:f:n:s:l:p:S:")) != -1 ) {
+        switch( c ) {
+            case 'd': shape.depth = atoi(optarg); break;
+            case 'f': shape.fanout = atoi(optarg); break;
+            case 'n': shape.files = atoi(optarg); break;
+            case 's':
+                if( bench_parse_size(optarg, &shape.max_size) )
+                    return(1);
+                break;
+            case 'l':
+                if( bench_parse_size(optarg, &shape.large_size) )
+                    return(1);
+                break;
+            case 'p': shape.prop_percent = atoi(optarg); break;
+            case 'S': bench_seed = strtoull(optarg, NULL, 10) | 1; break;
+            default: return(1);
+        }
+    }
+
+    rprops = "K 7\nsvn:log\nV 15\nsvnfs benchmark\n"
+        "K 8\nsvn:date\nV 27\n2007-01-01T00:00:00.000000Z\nPROPS-END\n";
+    printf("SVN-fs-dump-format-version: 2\n\n");
+    printf("Revision-number: 1\nProp-content-length: %lu\n"
+            "Content-length: %lu\n\n%s\n", (unsigned long)strlen(rprops),
+            (unsigned long)strlen(rprops), rprops);
+
+    if( shape.large_size )
+        bench_gen_node(&shape, "large.bin", 0, shape.large_size);
+    bench_gen_dir(&shape, "", 0);
+
+    return( fflush(stdout) ? 1 : 0 );
+}
+
+/*
+ * Workloads
+ */
+
+typedef int (*bench_list_func_t)(void *baton, const char *name, int dir);
+
+/* What the workloads are run against: paths are absolute within the
+ * filesystem, and errors are errno values */
+struct bench_backend {
+    int (*stat)(const char *path, struct stat *st);
+    int (*list)(const char *path, bench_list_func_t func, void *baton);
+    int (*open)(const char *path, void **hp);
+    int (*read)(void *h, char *buf, size_t *size, off_t offset);
+    void (*close)(void *h);
+};
+
+/* Through a mounted filesystem */
+
+static const char *bench_mount;
+
+static const char *bench_mount_path(const char *path, char *buf,
+        size_t len) {
+    snprintf(buf, len, "%s%s", bench_mount, strcmp(path, "/") ? path : "");
+    return(buf);
+}
+
+static int bench_mount_stat(const char *path, struct stat *st) {
+    char full[4096];
+
+    return( lstat(bench_mount_path(path, full, sizeof(full)), st) ?
+            errno : 0 );
+}
+
+static int bench_mount_list(const char *path, bench_list_func_t func,
+        void *baton) {
+    char full[4096];
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+    int isdir;
+    int err = 0;
+
+    if( (dir = opendir(bench_mount_path(path, full, sizeof(full)))) == NULL )
+        return(errno);
+    while( err == 0 && (de = readdir(dir)) != NULL ) {
+        if( !strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") )
+            continue;
+#ifdef DT_DIR
+        if( de->d_type != DT_UNKNOWN ) {
+            isdir = (de->d_type == DT_DIR);
+        } else
+#endif
+        {
+            snprintf(full, sizeof(full), "%s%s/%s", bench_mount,
+                    strcmp(path, "/") ? path : "", de->d_name);
+            isdir = (lstat(full, &st) == 0 && S_ISDIR(st.st_mode));
+        }
+        err = func(baton, de->d_name, isdir);
+    }
+    closedir(dir);
+    return(err);
+}
+
+static int bench_mount_open(const char *path, void **hp) {
+    char full[4096];
+    int fd;
+
+    if( (fd = open(bench_mount_path(path, full, sizeof(full)),
+                    O_RDONLY)) < 0 )
+        return(errno);
+    *hp = (void *)(intptr_t)fd;
+    return(0);
+}
+
+static int bench_mount_read(void *h, char *buf, size_t *size, off_t offset) {
+    ssize_t n;
+
+    if( (n = pread((int)(intptr_t)h, buf, *size, offset)) < 0 )
+        return(errno);
+    *size = n;
+    return(0);
+}
+
+static void bench_mount_close(void *h) {
+    close((int)(intptr_t)h);
+}
+
+static struct bench_backend bench_mount_backend = {
+    bench_mount_stat,
+    bench_mount_list,
+    bench_mount_open,
+    bench_mount_read,
+    bench_mount_close
+};
+
+/* In-process, through svnclient_* the way svnfs.c calls it */
+
+static int bench_svn_stat(const char *path, struct stat *st) {
+    struct dirbuf *dp;
+
+    memset(st, 0, sizeof(struct stat));
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL )
+        dircache_stat(dp, st);
+    dircache_unlock();
+
+    return( dp ? 0 : svnclient_list(path, st) );
+}
+
+struct bench_svn_list_baton {
+    bench_list_func_t func;
+    void *baton;
+};
+
+static int bench_svn_list_func(void *baton, struct dirbuf *child) {
+    struct bench_svn_list_baton *lb = baton;
+
+    return(lb->func(lb->baton, child->name, S_ISDIR(child->mode)));
+}
+
+static int bench_svn_list(const char *path, bench_list_func_t func,
+        void *baton) {
+    struct bench_svn_list_baton lb;
+    struct dirbuf *dp;
+    int listed, err;
+
+    dircache_rdlock();
+    listed = ((dp = dircache_lookup(path)) != NULL && dp->listed);
+    dircache_unlock();
+    if( !listed && (err = svnclient_list(path, NULL)) )
+        return(err);
+
+    lb.func = func;
+    lb.baton = baton;
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) == NULL )
+        err = ENOENT;
+    else
+        err = dircache_foreach(dp, bench_svn_list_func, &lb);
+    dircache_unlock();
+    return(err);
+}
+
+static int bench_svn_open(const char *path, void **hp) {
+    struct svnclient_handle *h;
+    struct dirbuf *dp;
+    svn_revnum_t rev = SVN_INVALID_REVNUM;
+    svn_filesize_t size = 0;
+    int err;
+
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL ) {
+        rev = dp->rev;
+        size = dp->size;
+    }
+    dircache_unlock();
+    if( dp == NULL )
+        return(ENOENT);
+
+    if( (err = svnclient_open(path, rev, size, &h)) )
+        return(err);
+    *hp = h;
+    return(0);
+}
+
+static int bench_svn_read(void *hp, char *buf, size_t *size, off_t offset) {
+    struct svnclient_handle *h = hp;
+
+    if( offset >= h->size ) {
+        *size = 0;
+        return(0);
+    }
+    if( offset + *size > h->size )
+        *size = h->size - offset;
+    return(svnclient_read(h, buf, size, offset));
+}
+
+static void bench_svn_close(void *h) {
+    svnclient_close(h);
+}
+
+static struct bench_backend bench_svn_backend = {
+    bench_svn_stat,
+    bench_svn_list,
+    bench_svn_open,
+    bench_svn_read,
+    bench_svn_close
+};
+
+/* Latencies of one workload */
+struct bench_timer {
+    const char *name;
+    double *lat;
+    size_t n;
+    size_t alloc;
+    apr_uint64_t bytes;
+    apr_uint64_t errors;
+    double start;           /* Of the workload */
+    double op;              /* Of the current operation */
+};
+
+static void bench_timer_init(struct bench_timer *t, const char *name) {
+    memset(t, 0, sizeof(struct bench_timer));
+    t->name = name;
+    t->start = bench_now();
+}
+
+static void bench_begin(struct bench_timer *t) {
+    t->op = bench_now();
+}
+
+static void bench_end(struct bench_timer *t, int err) {
+    double now = bench_now();
+    double *lat;
+
+    if( err )
+        t->errors++;
+    if( t->n == t->alloc ) {
+        t->alloc = t->alloc ? t->alloc * 2 : 1024;
+        if( (lat = realloc(t->lat, t->alloc * sizeof(double))) == NULL ) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        t->lat = lat;
+    }
+    t->lat[t->n++] = now - t->op;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return( (x > y) - (x < y) );
+}
+
+/* Latency at 'percent' in microseconds; the latencies must be sorted */
+static double bench_percentile(const struct bench_timer *t, int percent) {
+    size_t i;
+
+    if( t->n == 0 )
+        return(0);
+    i = (t->n * percent + 99) / 100;
+    return( t->lat[i ? i - 1 : 0] * 1e6 );
+}
+
+static void bench_report(struct bench_timer *t) {
+    double secs = bench_now() - t->start;
+
+    qsort(t->lat, t->n, sizeof(double), bench_cmp_double);
+    printf("%-10s ops %lu errors %llu secs %.3f ops_per_sec %.0f "
+            "mb_per_sec %.2f p50_us %.0f p99_us %.0f max_us %.0f\n",
+            t->name, (unsigned long)t->n, (unsigned long long)t->errors,
+            secs, secs > 0 ? t->n / secs : 0,
+            secs > 0 ? t->bytes / secs / (1024 * 1024) : 0,
+            bench_percentile(t, 50), bench_percentile(t, 99),
+            bench_percentile(t, 100));
+    fflush(stdout);
+    free(t->lat);
+}
+
+/* Every node found by the recursive readdir */
+struct bench_node {
+    char *path;
+    int dir;
+    off_t size;             /* Filled in by the stat workload */
+};
+
+struct bench_tree {
+    struct bench_node *nodes;
+    size_t n;
+    size_t alloc;
+    const char *parent;     /* Directory being listed */
+};
+
+static int bench_tree_add(void *baton, const char *name, int dir) {
+    struct bench_tree *tree = baton;
+    struct bench_node *nodes;
+    char *path;
+
+    if( tree->n == tree->alloc ) {
+        tree->alloc = tree->alloc ? tree->alloc * 2 : 1024;
+        nodes = realloc(tree->nodes, tree->alloc * sizeof(struct bench_node));
+        if( nodes == NULL )
+            return(ENOMEM);
+        tree->nodes = nodes;
+    }
+    if( (path = malloc(strlen(tree->parent) + strlen(name) + 2)) == NULL )
+        return(ENOMEM);
+    sprintf(path, "%s/%s", strcmp(tree->parent, "/") ? tree->parent : "",
+            name);
+    tree->nodes[tree->n].path = path;
+    tree->nodes[tree->n].dir = dir;
+    tree->nodes[tree->n].size = 0;
+    tree->n++;
+    return(0);
+}
+
+/* Lists every directory, breadth first, collecting the nodes in 'tree' */
+static void bench_readdir(const struct bench_backend *be,
+        struct bench_tree *tree) {
+    struct bench_timer t;
+    size_t next = 0;
+
+    bench_timer_init(&t, "readdir");
+    tree->parent = "/";
+    bench_begin(&t);
+    bench_end(&t, be->list("/", bench_tree_add, tree));
+    for( next = 0; next < tree->n; next++ ) {
+        if( !tree->nodes[next].dir )
+            continue;
+        tree->parent = tree->nodes[next].path;
+        bench_begin(&t);
+        bench_end(&t, be->list(tree->parent, bench_tree_add, tree));
+    }
+    bench_report(&t);
+}
+
+/* Stats every node 'repeat' times in a random order */
+static void bench_stat(const struct bench_backend *be,
+        struct bench_tree *tree, int repeat) {
+    struct bench_timer t;
+    struct stat st;
+    size_t i, n = tree->n * repeat;
+    size_t j;
+    int err;
+
+    bench_timer_init(&t, "stat");
+    for( i = 0; i < tree->n; i++ ) {
+        bench_begin(&t);
+        err = be->stat(tree->nodes[i].path, &st);
+        bench_end(&t, err);
+        if( err == 0 )
+            tree->nodes[i].size = st.st_size;
+    }
+    for( i = tree->n; i < n; i++ ) {
+        j = bench_random() % tree->n;
+        bench_begin(&t);
+        bench_end(&t, be->stat(tree->nodes[j].path, &st));
+    }
+    bench_report(&t);
+}
+
+static struct bench_node *bench_largest(struct bench_tree *tree) {
+    struct bench_node *largest = NULL;
+    size_t i;
+
+    for( i = 0; i < tree->n; i++ ) {
+        if( !tree->nodes[i].dir &&
+                (largest == NULL || tree->nodes[i].size > largest->size) )
+            largest = &tree->nodes[i];
+    }
+    return(largest);
+}
+
+/* Reads the largest file from start to end */
+static void bench_seqread(const struct bench_backend *be,
+        struct bench_node *node) {
+    struct bench_timer t;
+    char *buf;
+    size_t size;
+    off_t offset = 0;
+    void *h;
+    int err;
+
+    bench_timer_init(&t, "seqread");
+    if( (buf = malloc(BENCH_SEQ_CHUNK)) == NULL ||
+            (err = be->open(node->path, &h)) ) {
+        free(buf);
+        t.errors++;
+        bench_report(&t);
+        return;
+    }
+    do {
+        size = BENCH_SEQ_CHUNK;
+        bench_begin(&t);
+        err = be->read(h, buf, &size, offset);
+        bench_end(&t, err);
+        offset += size;
+        t.bytes += size;
+    } while( err == 0 && size > 0 );
+    be->close(h);
+    free(buf);
+    bench_report(&t);
+}
+
+/*
+ * Reads at random offsets in the largest file before anything else has
+ * read it, each through a fresh open, as a program seeking about an
+ * archive or database file would
+ */
+static void bench_coldread(const struct bench_backend *be,
+        struct bench_node *node) {
+    char buf[BENCH_COLD_CHUNK];
+    struct bench_timer t;
+    size_t size;
+    off_t offset;
+    void *h;
+    int i, err;
+
+    bench_timer_init(&t, "coldread");
+    for( i = 0; i < BENCH_COLD_READS; i++ ) {
+        size = sizeof(buf);
+        offset = node->size > (off_t)sizeof(buf) ?
+            bench_random() % (node->size - sizeof(buf)) : 0;
+        bench_begin(&t);
+        if( (err = be->open(node->path, &h)) == 0 ) {
+            err = be->read(h, buf, &size, offset);
+            be->close(h);
+            t.bytes += size;
+        }
+        bench_end(&t, err);
+    }
+    bench_report(&t);
+}
+
+/* 4K reads at random offsets in the largest file */
+static void bench_randread(const struct bench_backend *be,
+        struct bench_node *node) {
+    char buf[BENCH_RANDOM_CHUNK];
+    struct bench_timer t;
+    size_t size;
+    off_t offset;
+    void *h;
+    int i;
+
+    bench_timer_init(&t, "randread");
+    if( be->open(node->path, &h) ) {
+        t.errors++;
+        bench_report(&t);
+        return;
+    }
+    for( i = 0; i < BENCH_RANDOM_READS; i++ ) {
+        size = sizeof(buf);
+        offset = node->size > (off_t)sizeof(buf) ?
+            bench_random() % (node->size - sizeof(buf)) : 0;
+        bench_begin(&t);
+        bench_end(&t, be->read(h, buf, &size, offset));
+        t.bytes += size;
+    }
+    be->close(h);
+    bench_report(&t);
+}
+
+/* Opens, reads and closes each small file */
+static void bench_smallfiles(const struct bench_backend *be,
+        struct bench_tree *tree) {
+    char buf[BENCH_SMALL_FILE];
+    struct bench_timer t;
+    size_t i, size;
+    off_t offset;
+    void *h;
+    int files = 0;
+    int err;
+
+    bench_timer_init(&t, "smallfiles");
+    for( i = 0; i < tree->n && files < BENCH_SMALL_FILES; i++ ) {
+        if( tree->nodes[i].dir || tree->nodes[i].size > BENCH_SMALL_FILE )
+            continue;
+        files++;
+        bench_begin(&t);
+        if( (err = be->open(tree->nodes[i].path, &h)) == 0 ) {
+            offset = 0;
+            do {
+                size = sizeof(buf);
+                err = be->read(h, buf, &size, offset);
+                offset += size;
+            } while( err == 0 && size > 0 );
+            be->close(h);
+            t.bytes += offset;
+        }
+        bench_end(&t, err);
+    }
+    bench_report(&t);
+}
+
+/* Sets up the svnfs modules for in-process runs, pinned to HEAD */
+static int bench_svn_init(const char *url, size_t cache_size,
+        size_t meta_size, size_t block_cache_size) {
+    const char *tmpdir = getenv("TMPDIR");
+    svn_revnum_t head;
+
+    svnfs.svnpath = strdup(url);
+    while( strlen(svnfs.svnpath) > 1 &&
+            svnfs.svnpath[strlen(svnfs.svnpath) - 1] == '/' )
+        svnfs.svnpath[strlen(svnfs.svnpath) - 1] = '\0';
+    svnfs.rev = -1;
+    svnfs.unknown_uid = -1;
+    svnfs.unknown_gid = -1;
+    svnfs.cache_size = cache_size;
+    svnfs.meta_size = meta_size;
+    svnfs.block_cache_size = block_cache_size;
+    gettimeofday(&svnfs.mnttime, NULL);
+
+    if( svnclient_setup_ctx() )
+        return(1);
+    if( dircache_init(pool, svnfs.meta_size) ||
+            contentcache_init(svnfs.cache_size, svnfs.cache_compress) ||
+            idcache_init() ||
+            negcache_init(0) || origin_init() || flight_init() ||
+            prefetch_init(0, 0) ||
+            blockcache_init(tmpdir && *tmpdir ? tmpdir : "/tmp",
+                svnfs.block_cache_size) ) {
+        fprintf(stderr, "Error allocating memory - %s\n", strerror(errno));
+        return(1);
+    }
+    if( svnclient_youngest(&head) )
+        return(1);
+    svnfs.rev = head;
+    return(0);
+}
+
+static int bench_run(int argc, char *argv[]) {
+    const struct bench_backend *be = &bench_mount_backend;
+    size_t cache_size = SVNFS_DEFAULT_CACHE_SIZE;
+    size_t meta_size = SVNFS_DEFAULT_META_SIZE;
+    size_t block_cache_size = SVNFS_DEFAULT_BLOCK_CACHE_SIZE;
+    struct bench_tree tree;
+    struct bench_node *large;
+    int inprocess = 0;
+    int repeat = 4;
+    int c;
+
+    while( (c = getopt(argc, argv, "iRr:c:zm:b:v")) != -1 ) {
+        switch( c ) {
+            case 'i': inprocess = 1; break;
+            case 'R': svnfs.ra_local = 1; break;
+            case 'r': repeat = atoi(optarg); break;
+            case 'c':
+                if( bench_parse_size(optarg, &cache_size) )
+                    return(1);
+                break;
+            case 'z': svnfs.cache_compress = 1; break;
+            case 'm':
+                if( bench_parse_size(optarg, &meta_size) )
+                    return(1);
+                break;
+            case 'b':
+                if( bench_parse_size(optarg, &block_cache_size) )
+                    return(1);
+                break;
+            case 'v': svnfs.debug = 1; break;
+            default: return(1);
+        }
+    }
+    if( optind != argc - 1 || repeat < 1 )
+        return(1);
+
+    if( inprocess ) {
+        if( bench_svn_init(argv[optind], cache_size, meta_size,
+                    block_cache_size) )
+            exit(1);
+        be = &bench_svn_backend;
+    } else {
+        bench_mount = argv[optind];
+    }
+
+    memset(&tree, 0, sizeof(tree));
+    bench_readdir(be, &tree);
+    bench_stat(be, &tree, repeat);
+    if( (large = bench_largest(&tree)) != NULL ) {
+        bench_coldread(be, large);
+        bench_seqread(be, large);
+        bench_randread(be, large);
+    }
+    bench_smallfiles(be, &tree);
+    return(0);
+}
+
+/* The metadata cache as it was before the dircache: one list of paths */
+struct bench_flat {
+    const char *name;
+    struct bench_flat *next;
+};
+
+/* Finds 'path' as the old getattr did, by the first prefix match */
+static struct bench_flat *bench_flat_lookup(struct bench_flat *first,
+        const char *path) {
+    struct bench_flat *fp;
+
+    for( fp = first; fp; fp = fp->next )
+        if( !strncmp(path, fp->name, strlen(path)) )
+            return(fp);
+    return(NULL);
+}
+
+/* Counts the children of 'path' as the old readdir did, scanning it all */
+static size_t bench_flat_list(struct bench_flat *first, const char *path) {
+    struct bench_flat *fp;
+    size_t n = 0;
+
+    for( fp = first; fp; fp = fp->next ) {
+        if( *path == '\0' ) {
+            if( strstr(fp->name + 1, "/") == NULL )
+                n++;
+        } else if( !strncmp(fp->name, path, strlen(path)) &&
+                strlen(fp->name) > strlen(path) &&
+                strlen(path) == strlen(fp->name) -
+                    strlen(rindex(fp->name, '/')) ) {
+            n++;
+        }
+    }
+    return(n);
+}
+
+static int bench_dircache_count(void *baton, struct dirbuf *child) {
+    (*(size_t *)baton)++;
+    return(0);
+}
+
+/* A directory at random, the root if it's the only one */
+static const char *bench_dircache_dir(char **paths, size_t nodes) {
+    size_t dirs = (nodes - 1) / 32;
+
+    return( dirs ? paths[1 + bench_random() % dirs] : paths[0] );
+}
+
+/*
+ * Builds a tree of 'nodes' metadata nodes, 32 to a directory, then looks
+ * them up at random by path and lists directories at random. The same is
+ * then done with a flat list of the paths, as a baseline for the cost
+ * of a lookup and listing growing with the tree, rather than with its
+ * depth and the children listed. Only the dircache is involved.
+ */
+static int bench_dircache(int argc, char *argv[]) {
+    struct bench_timer t;
+    struct dircache_stats ms;
+    struct bench_flat *flat;
+    struct dirbuf *dp;
+    apr_pool_t *p;
+    char **paths;
+    size_t nodes, i, parent, n;
+
+    if( argc != 2 || (nodes = strtoul(argv[1], NULL, 10)) < 1 )
+        return(1);
+
+    apr_initialize();
+    if( apr_pool_create(&p, NULL) != APR_SUCCESS || dircache_init(p, 0) ||
+            (paths = calloc(nodes + 1, sizeof(char *))) == NULL ||
+            (flat = calloc(nodes, sizeof(struct bench_flat))) == NULL ) {
+        fprintf(stderr, "Error allocating memory - %s\n", strerror(errno));
+        return(1);
+    }
+
+    /* Node i's parent is node (i - 1) / 32, node 0 being the root */
+    paths[0] = "";
+    for( i = 1; i <= nodes; i++ ) {
+        parent = (i - 1) / 32;
+        if( (paths[i] = malloc(strlen(paths[parent]) + 16)) == NULL ) {
+            fprintf(stderr, "Out of memory\n");
+            return(1);
+        }
+        sprintf(paths[i], "%s/n%lu", paths[parent], (unsigned long)i);
+        flat[i - 1].name = paths[i];
+        flat[i - 1].next = i < nodes ? &flat[i] : NULL;
+    }
+
+    bench_timer_init(&t, "dc_add");
+    dircache_wrlock();
+    for( i = 1; i <= nodes; i++ ) {
+        bench_begin(&t);
+        bench_end(&t, dircache_add(paths[i]) == NULL);
+    }
+    dircache_unlock();
+    bench_report(&t);
+
+    bench_timer_init(&t, "dc_lookup");
+    dircache_rdlock();
+    for( i = 0; i < nodes * BENCH_DIRCACHE_LOOKUPS; i++ ) {
+        bench_begin(&t);
+        bench_end(&t, dircache_lookup(paths[1 + bench_random() % nodes]) ==
+                NULL);
+    }
+    dircache_unlock();
+    bench_report(&t);
+
+    bench_timer_init(&t, "dc_list");
+    dircache_rdlock();
+    for( i = 0; i < nodes; i++ ) {
+        n = 0;
+        bench_begin(&t);
+        if( (dp = dircache_lookup(bench_dircache_dir(paths, nodes))) )
+            dircache_foreach(dp, bench_dircache_count, &n);
+        bench_end(&t, n == 0);
+    }
+    dircache_unlock();
+    bench_report(&t);
+
+    dircache_get_stats(&ms);
+    printf("dc_memory  nodes %lu bytes %lu bytes_per_node %.1f\n",
+            (unsigned long)ms.nodes, (unsigned long)ms.bytes,
+            (double)ms.bytes / ms.nodes);
+
+    bench_timer_init(&t, "flat_lookup");
+    for( i = 0; i < BENCH_FLAT_OPS; i++ ) {
+        bench_begin(&t);
+        bench_end(&t, bench_flat_lookup(flat,
+                    paths[1 + bench_random() % nodes]) == NULL);
+    }
+    bench_report(&t);
+
+    bench_timer_init(&t, "flat_list");
+    for( i = 0; i < BENCH_FLAT_OPS; i++ ) {
+        bench_begin(&t);
+        bench_end(&t, bench_flat_list(flat,
+                    bench_dircache_dir(paths, nodes)) == 0);
+    }
+    bench_report(&t);
+    return(0);
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "usage: svnfs-bench gen [-d depth] [-f fanout] [-n files] "
+            "[-s max_size]\n"
+            "           [-l large_size] [-p prop_percent] [-S seed] "
+            "> dumpfile\n"
+            "       svnfs-bench run [-i [-R]] [-r repeat] [-c cache_size] "
+            "[-z]\n"
+            "           [-m meta_size] [-b block_cache_size] [-v] "
+            "MOUNTPOINT|URL\n"
+            "       svnfs-bench dircache NODES\n");
+}
+
+int main(int argc, char *argv[]) {
+    int ret = 1;
+
+    if( argc >= 2 && !strcmp(argv[1], "gen") )
+        ret = bench_gen(argc - 1, argv + 1);
+    else if( argc >= 2 && !strcmp(argv[1], "run") )
+        ret = bench_run(argc - 1, argv + 1);
+    else if( argc >= 2 && !strcmp(argv[1], "dircache") )
+        ret = bench_dircache(argc - 1, argv + 1);
+
+    if( ret )
+        bench_usage();
+    return(ret);
+}
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# $Id$
+#
+# Runs the svnfs benchmarks; see "make bench" and bench.c. Settings come
+# from the environment:
+#
+#   BENCH_DIR       where the repository and mount point go (./bench-data)
+#   BENCH_SHAPE     svnfs-bench gen options for the repository's shape
+#                   ("-d 3 -f 8 -n 16 -s 64K -l 64M -p 10")
+#   BENCH_RUN       svnfs-bench run options ("-r 4", add -z to compress
+#                   the content cache)
+#   BENCH_DIRCACHE  node counts for the dircache benchmark
+#                   ("10000 100000 1000000")
+#   BENCH_BIG       size of the single file in a second repository, for
+#                   the large file read workloads ("1G", empty to skip)
+#   BENCH_MOUNT     if set, also run through a real FUSE mount, passing
+#                   these svnfs -o options (eg. BENCH_MOUNT=poll_interval=0)
+#
+# The repositories are generated once per shape and reused.
+
+BENCH_DIR=${BENCH_DIR:-./bench-data}
+BENCH_SHAPE=${BENCH_SHAPE:--d 3 -f 8 -n 16 -s 64K -l 64M -p 10}
+BENCH_RUN=${BENCH_RUN:--r 4}
+BENCH_DIRCACHE=${BENCH_DIRCACHE:-10000 100000 1000000}
+BENCH_BIG=${BENCH_BIG-1G}
+
+BIN=`pwd`
+mkdir -p "$BENCH_DIR" || exit 1
+BENCH_DIR=`cd "$BENCH_DIR" && pwd`
+REPO="$BENCH_DIR/repo"
+URL="file://$REPO"
+
+if test "`cat "$BENCH_DIR/shape" 2>/dev/null`" != "$BENCH_SHAPE"; then
+    echo "Generating $REPO ($BENCH_SHAPE)"
+    rm -rf "$REPO" "$BENCH_DIR/shape"
+    svnadmin create "$REPO" || exit 1
+    "$BIN/svnfs-bench" gen $BENCH_SHAPE | svnadmin load -q "$REPO" || exit 1
+    echo "$BENCH_SHAPE" > "$BENCH_DIR/shape"
+fi
+
+echo "== in-process, $URL"
+"$BIN/svnfs-bench" run -i $BENCH_RUN "$URL" || exit 1
+echo "== in-process, $URL through RA"
+"$BIN/svnfs-bench" run -i -R $BENCH_RUN "$URL" || exit 1
+
+if test -n "$BENCH_BIG"; then
+    BIG="$BENCH_DIR/big"
+    if test "`cat "$BENCH_DIR/big-shape" 2>/dev/null`" != "$BENCH_BIG"; then
+        echo "Generating $BIG ($BENCH_BIG file)"
+        rm -rf "$BIG" "$BENCH_DIR/big-shape"
+        svnadmin create "$BIG" || exit 1
+        "$BIN/svnfs-bench" gen -d 0 -n 0 -l "$BENCH_BIG" |
+            svnadmin load -q "$BIG" || exit 1
+        echo "$BENCH_BIG" > "$BENCH_DIR/big-shape"
+    fi
+    echo "== in-process, file://$BIG"
+    "$BIN/svnfs-bench" run -i $BENCH_RUN "file://$BIG" || exit 1
+fi
+
+for nodes in $BENCH_DIRCACHE; do
+    echo "== dircache, $nodes nodes"
+    "$BIN/svnfs-bench" dircache $nodes || exit 1
+done
+
+if test -n "$BENCH_MOUNT"; then
+    MNT="$BENCH_DIR/mnt"
+    mkdir -p "$MNT" || exit 1
+    echo "== FUSE mount, $URL -o $BENCH_MOUNT"
+    "$BIN/svnfs" -o "$BENCH_MOUNT" "$URL" "$MNT" || exit 1
+    tries=0
+    while ! test -e "$MNT/.svnfs/stats"; do
+        tries=`expr $tries + 1`
+        if test $tries -gt 10; then
+            echo "$MNT didn't mount" >&2
+            exit 1
+        fi
+        sleep 1
+    done
+    "$BIN/svnfs-bench" run $BENCH_RUN "$MNT"
+    ret=$?
+    grep '^op\.' "$MNT/.svnfs/stats"
+    fusermount -u "$MNT"
+    exit $ret
+fi
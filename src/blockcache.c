@@ -0,0 +1,342 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "blockcache.h"
+#include <sys/stat.h>
+#include <apr_hash.h>
+#include <pthread.h>
+
+/*
+ * Cache of large files in fixed size blocks, for random access. The
+ * repository can only send a file from the start, so reading at a high
+ * offset costs the whole prefix; every block that goes past on the way is
+ * kept, so each part of the file is only ever fetched once, and later
+ * reads anywhere in what has been seen are served locally.
+ *
+ * Blocks are spilled to a sparse file per (path, last changed revision)
+ * rather than kept in memory, so files far bigger than the content cache
+ * can be held; the page cache keeps the hot blocks in memory. Spill files
+ * are unlinked as soon as they're made, so they never outlive the mount.
+ * The blocks held are capped in total by evicting whole files, least
+ * recently used first, but never one which is open.
+ *
+ * The index, LRU list and block maps are under blockcache_lock. Blocks
+ * are read and written without it: a file can't be evicted while it's
+ * open, and a block is only marked present once it's written.
+ */
+
+#define BLOCKCACHE_TEMPLATE "svnfs-blocks.XXXXXX"
+
+struct blockcache_file {
+    char *key;                  /* "rev:path" */
+    svn_filesize_t size;
+    apr_uint32_t blocks;
+    unsigned char *map;         /* Bit per block, set once it's written */
+    int fd;                     /* Spill file, or -1 until the first block */
+    apr_uint32_t refs;          /* Open handles */
+    apr_uint64_t bytes;         /* Held in the spill file */
+    struct blockcache_file *prev;
+    struct blockcache_file *next;
+};
+
+static pthread_mutex_t blockcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *blockcache_dir;
+static apr_pool_t *blockcache_pool;
+static apr_hash_t *blockcache_index;    /* key -> struct blockcache_file */
+static struct blockcache_file *blockcache_head;
+static struct blockcache_file *blockcache_tail;
+static struct blockcache_stats blockcache_stats;
+
+static void blockcache_unlink(struct blockcache_file *bf) {
+    if( bf->prev )
+        bf->prev->next = bf->next;
+    else
+        blockcache_head = bf->next;
+    if( bf->next )
+        bf->next->prev = bf->prev;
+    else
+        blockcache_tail = bf->prev;
+    bf->prev = bf->next = NULL;
+}
+
+static void blockcache_push(struct blockcache_file *bf) {
+    bf->prev = NULL;
+    bf->next = blockcache_head;
+    if( blockcache_head )
+        blockcache_head->prev = bf;
+    blockcache_head = bf;
+    if( blockcache_tail == NULL )
+        blockcache_tail = bf;
+}
+
+static void blockcache_drop(struct blockcache_file *bf) {
+    blockcache_unlink(bf);
+    apr_hash_set(blockcache_index, bf->key, APR_HASH_KEY_STRING, NULL);
+    blockcache_stats.bytes -= bf->bytes;
+    blockcache_stats.entries--;
+
+    if( bf->fd >= 0 )
+        close(bf->fd);
+    free(bf->map);
+    free(bf->key);
+    free(bf);
+}
+
+/* Makes room for 'needed' more bytes, evicting files nobody has open */
+static void blockcache_evict(apr_uint64_t needed) {
+    struct blockcache_file *bf, *prev;
+
+    for( bf = blockcache_tail; bf &&
+            blockcache_stats.bytes + needed > blockcache_stats.limit;
+            bf = prev ) {
+        prev = bf->prev;
+        if( bf->refs || bf->bytes == 0 )
+            continue;
+        DEBUG("blockcache_evict(): evicting %s", bf->key);
+        blockcache_drop(bf);
+        blockcache_stats.evictions++;
+    }
+}
+
+/*
+ * Spill files go in 'dir'; a 'limit' of 0 disables the cache.
+ */
+int blockcache_init(const char *dir, apr_uint64_t limit) {
+    blockcache_stats.limit = limit;
+    if( limit == 0 )
+        return(0);
+
+    if( (blockcache_dir = strdup(dir)) == NULL )
+        return(1);
+    if( apr_pool_create(&blockcache_pool, NULL) != APR_SUCCESS )
+        return(1);
+    blockcache_index = apr_hash_make(blockcache_pool);
+    return(0);
+}
+
+/*
+ * Returns the cached blocks of 'path' at last changed revision 'rev',
+ * which is 'size' bytes long, or NULL if the cache is disabled or out of
+ * memory. The file stays cached at least until blockcache_close().
+ */
+struct blockcache_file *blockcache_open(const char *path, svn_revnum_t rev,
+        svn_filesize_t size) {
+    struct blockcache_file *bf;
+    char *key;
+
+    if( blockcache_stats.limit == 0 || size <= 0 )
+        return(NULL);
+    if( (key = malloc(strlen(path) + 32)) == NULL )
+        return(NULL);
+    sprintf(key, "%ld:%s", (long)rev, path);
+
+    pthread_mutex_lock(&blockcache_lock);
+    if( (bf = apr_hash_get(blockcache_index, key, APR_HASH_KEY_STRING)) ) {
+        free(key);
+        blockcache_unlink(bf);
+    } else {
+        if( (bf = calloc(1, sizeof(struct blockcache_file))) == NULL ) {
+            pthread_mutex_unlock(&blockcache_lock);
+            free(key);
+            return(NULL);
+        }
+        bf->key = key;
+        bf->size = size;
+        bf->blocks = (size + BLOCKCACHE_BLOCK_SIZE - 1) /
+            BLOCKCACHE_BLOCK_SIZE;
+        bf->fd = -1;
+        if( (bf->map = calloc((bf->blocks + 7) / 8, 1)) == NULL ) {
+            pthread_mutex_unlock(&blockcache_lock);
+            free(bf->key);
+            free(bf);
+            return(NULL);
+        }
+        apr_hash_set(blockcache_index, bf->key, APR_HASH_KEY_STRING, bf);
+        blockcache_stats.entries++;
+    }
+    blockcache_push(bf);
+    bf->refs++;
+    pthread_mutex_unlock(&blockcache_lock);
+    return(bf);
+}
+
+void blockcache_close(struct blockcache_file *bf) {
+    pthread_mutex_lock(&blockcache_lock);
+    /* Nothing worth keeping */
+    if( --bf->refs == 0 && bf->bytes == 0 )
+        blockcache_drop(bf);
+    pthread_mutex_unlock(&blockcache_lock);
+}
+
+/* The lock must be held */
+static int blockcache_present(struct blockcache_file *bf,
+        apr_uint32_t block) {
+    return( (bf->map[block / 8] >> (block % 8)) & 1 );
+}
+
+/* Returns 1 if 'block' is cached */
+int blockcache_has(struct blockcache_file *bf, apr_uint32_t block) {
+    int ret;
+
+    pthread_mutex_lock(&blockcache_lock);
+    ret = (block < bf->blocks && blockcache_present(bf, block));
+    pthread_mutex_unlock(&blockcache_lock);
+    return(ret);
+}
+
+/* Returns how many blocks from the start of the file are all cached */
+apr_uint32_t blockcache_prefix(struct blockcache_file *bf) {
+    apr_uint32_t block;
+
+    pthread_mutex_lock(&blockcache_lock);
+    for( block = 0; block < bf->blocks && blockcache_present(bf, block);
+            block++ )
+        ;
+    pthread_mutex_unlock(&blockcache_lock);
+    return(block);
+}
+
+/*
+ * Returns the spill file if every block of the *size bytes from 'offset'
+ * is cached, else -1. They're at the same offset in the spill file as in
+ * the file, and *size is cut short at its end, which 'offset' must be
+ * before. The descriptor stays open until the file is closed. Only hits
+ * are counted; a miss falls back to blockcache_read().
+ */
+int blockcache_fd(struct blockcache_file *bf, size_t *size, off_t offset) {
+    apr_uint32_t block, last;
+    int fd = -1;
+
+    if( offset >= bf->size || *size == 0 )
+        return(-1);
+    if( *size > bf->size - offset )
+        *size = bf->size - offset;
+
+    last = (offset + *size - 1) / BLOCKCACHE_BLOCK_SIZE;
+    pthread_mutex_lock(&blockcache_lock);
+    for( block = offset / BLOCKCACHE_BLOCK_SIZE;
+            block <= last && blockcache_present(bf, block); block++ )
+        ;
+    if( block > last && (fd = bf->fd) >= 0 ) {
+        blockcache_stats.hits++;
+        blockcache_unlink(bf);
+        blockcache_push(bf);
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+    return(fd);
+}
+
+/*
+ * Copies up to *size bytes from 'offset' into 'buf' if every block they
+ * fall in is cached. Returns 1 if so, with *size set to the number of
+ * bytes copied, and 0 otherwise.
+ */
+int blockcache_read(struct blockcache_file *bf, char *buf, size_t *size,
+        off_t offset) {
+    ssize_t n;
+    size_t done;
+    int fd;
+
+    if( offset >= bf->size ) {
+        *size = 0;
+        return(1);
+    }
+    if( *size == 0 )
+        return(1);
+    if( (fd = blockcache_fd(bf, size, offset)) < 0 ) {
+        pthread_mutex_lock(&blockcache_lock);
+        blockcache_stats.misses++;
+        pthread_mutex_unlock(&blockcache_lock);
+        return(0);
+    }
+
+    for( done = 0; done < *size; done += n ) {
+        if( (n = pread(fd, buf + done, *size - done, offset + done)) <= 0 ) {
+            DEBUG("blockcache_read(): %s: %s", bf->key,
+                    n ? strerror(errno) : "short read");
+            return(0);
+        }
+    }
+    return(1);
+}
+
+/* Creates the spill file. The lock must be held */
+static int blockcache_spill(struct blockcache_file *bf) {
+    char *name;
+
+    if( (name = malloc(strlen(blockcache_dir) +
+                    sizeof(BLOCKCACHE_TEMPLATE) + 1)) == NULL )
+        return(1);
+    sprintf(name, "%s/%s", blockcache_dir, BLOCKCACHE_TEMPLATE);
+    if( (bf->fd = mkstemp(name)) < 0 ) {
+        DEBUG("blockcache_spill(): %s: %s", name, strerror(errno));
+        free(name);
+        return(1);
+    }
+    unlink(name);
+    free(name);
+
+    /* Sparse, so only the blocks written take any space */
+    if( ftruncate(bf->fd, bf->size) ) {
+        close(bf->fd);
+        bf->fd = -1;
+        return(1);
+    }
+    return(0);
+}
+
+/*
+ * Stores 'block', 'len' bytes of 'data', which is all of it. The file must
+ * be open. Blocks which don't fit, or can't be written, are just left out.
+ */
+void blockcache_write(struct blockcache_file *bf, apr_uint32_t block,
+        const char *data, apr_size_t len) {
+    off_t offset = (off_t)block * BLOCKCACHE_BLOCK_SIZE;
+    ssize_t n;
+    apr_size_t done;
+
+    pthread_mutex_lock(&blockcache_lock);
+    if( block >= bf->blocks || blockcache_present(bf, block) ) {
+        pthread_mutex_unlock(&blockcache_lock);
+        return;
+    }
+    blockcache_evict(len);
+    if( blockcache_stats.bytes + len > blockcache_stats.limit ||
+            (bf->fd < 0 && blockcache_spill(bf)) ) {
+        pthread_mutex_unlock(&blockcache_lock);
+        return;
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+
+    for( done = 0; done < len; done += n ) {
+        if( (n = pwrite(bf->fd, data + done, len - done,
+                        offset + done)) <= 0 ) {
+            DEBUG("blockcache_write(): %s: %s", bf->key, strerror(errno));
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&blockcache_lock);
+    if( !blockcache_present(bf, block) ) {
+        bf->map[block / 8] |= 1 << (block % 8);
+        bf->bytes += len;
+        blockcache_stats.bytes += len;
+    }
+    pthread_mutex_unlock(&blockcache_lock);
+}
+
+void blockcache_get_stats(struct blockcache_stats *stats) {
+    pthread_mutex_lock(&blockcache_lock);
+    *stats = blockcache_stats;
+    pthread_mutex_unlock(&blockcache_lock);
+}
@@ -0,0 +1,54 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_BLOCKCACHE_H
+#define _HAVE_BLOCKCACHE_H 1
+
+#include <sys/types.h>
+
+#include <apr.h>
+#include <svn_types.h>
+
+#define BLOCKCACHE_BLOCK_SIZE (1024 * 1024)
+
+struct blockcache_stats {
+    apr_uint64_t hits;
+    apr_uint64_t misses;
+    apr_uint64_t evictions;
+    apr_size_t entries;
+    apr_uint64_t bytes;
+    apr_uint64_t limit;
+};
+
+struct blockcache_file;
+
+int blockcache_init(const char *dir, apr_uint64_t limit);
+
+struct blockcache_file *blockcache_open(const char *path, svn_revnum_t rev,
+        svn_filesize_t size);
+
+void blockcache_close(struct blockcache_file *bf);
+
+int blockcache_fd(struct blockcache_file *bf, size_t *size, off_t offset);
+
+int blockcache_read(struct blockcache_file *bf, char *buf, size_t *size,
+        off_t offset);
+
+int blockcache_has(struct blockcache_file *bf, apr_uint32_t block);
+
+apr_uint32_t blockcache_prefix(struct blockcache_file *bf);
+
+void blockcache_write(struct blockcache_file *bf, apr_uint32_t block,
+        const char *data, apr_size_t len);
+
+void blockcache_get_stats(struct blockcache_stats *stats);
+
+#endif /* ifndef _HAVE_BLOCKCACHE_H */
@@ -0,0 +1,567 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "contentcache.h"
+#include <time.h>
+#include <zlib.h>
+#include <apr_hash.h>
+#include <pthread.h>
+
+/*
+ * In-memory cache of file contents, keyed by (path, revision) and kept
+ * under a byte budget by evicting the least recently used files. The
+ * revision is the one the file was last changed in, so HEAD and any
+ * number of /@rev views share one copy of a file they all see unchanged;
+ * the revisions of a path each have their own entry, chained from the
+ * index. Entries are individually malloc()ed so that eviction really
+ * returns memory.
+ * Every hit reorders the LRU list, so all access is under one mutex; it's
+ * only held for a lookup and a copy of at most one FUSE read.
+ *
+ * With -o cache_compress, files which would be evicted are compressed
+ * instead, in CONTENTCACHE_BLOCK blocks so that a read only inflates the
+ * blocks it covers. Files are kept as they are, on the hot list, until
+ * they're the least recently used of those, and then move to the cold
+ * list, compressed; the cold list is evicted from first. A cold file hit
+ * CONTENTCACHE_PROMOTE times is inflated back onto the hot list, and the
+ * hot list's tail compressed in its place.
+ * Compressing and promoting are left to a background thread, so readers
+ * putting files don't wait on zlib; meanwhile the cache may run over its
+ * budget by 1/CONTENTCACHE_SLACK before anything's evicted. Compressing
+ * and inflating are done outside the lock, with a reference held on the
+ * entry so it isn't freed meanwhile.
+ */
+
+struct contentcache_entry {
+    char *path;
+    svn_revnum_t rev;
+    char *data;             /* Contents, or their blocks compressed */
+    apr_size_t len;         /* Length of the contents */
+    apr_size_t size;        /* Bytes held in data */
+    apr_size_t *blocks;     /* Where each block starts in data, and the
+                               end, once compressed; else NULL */
+    int refs;                           /* Users outside the lock */
+    int hits;                           /* Reads since compressed */
+    unsigned int prefetched : 1;        /* Not yet read since prefetched */
+    unsigned int compressing : 1;       /* Or being inflated back */
+    unsigned int dropped : 1;           /* Freed by the last user */
+    struct contentcache_entry *prev;    /* More recently used */
+    struct contentcache_entry *next;    /* Less recently used */
+    struct contentcache_entry *other;   /* Another revision of path */
+};
+
+struct contentcache_list {
+    struct contentcache_entry *head;
+    struct contentcache_entry *tail;
+    apr_size_t bytes;
+};
+
+static pthread_mutex_t contentcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t contentcache_cond = PTHREAD_COND_INITIALIZER;
+static int contentcache_worker;         /* The thread has been started */
+static int contentcache_work;           /* ... and has something to do */
+static apr_pool_t *contentcache_pool;
+static apr_hash_t *contentcache_index;  /* path -> struct contentcache_entry */
+static struct contentcache_list contentcache_hot;
+static struct contentcache_list contentcache_cold;
+static int contentcache_compress_cold;
+static struct contentcache_stats contentcache_stats;
+
+static struct contentcache_list *contentcache_list(
+        struct contentcache_entry *ce) {
+    return( ce->blocks ? &contentcache_cold : &contentcache_hot );
+}
+
+static void contentcache_unlink(struct contentcache_entry *ce) {
+    struct contentcache_list *cl = contentcache_list(ce);
+
+    if( ce->prev )
+        ce->prev->next = ce->next;
+    else
+        cl->head = ce->next;
+    if( ce->next )
+        ce->next->prev = ce->prev;
+    else
+        cl->tail = ce->prev;
+    ce->prev = ce->next = NULL;
+    cl->bytes -= ce->size;
+}
+
+static void contentcache_push(struct contentcache_entry *ce) {
+    struct contentcache_list *cl = contentcache_list(ce);
+
+    ce->prev = NULL;
+    ce->next = cl->head;
+    if( cl->head )
+        cl->head->prev = ce;
+    cl->head = ce;
+    if( cl->tail == NULL )
+        cl->tail = ce;
+    cl->bytes += ce->size;
+}
+
+/* Returns the entry for 'path' at 'rev', or NULL */
+static struct contentcache_entry *contentcache_find(const char *path,
+        svn_revnum_t rev) {
+    struct contentcache_entry *ce;
+
+    ce = apr_hash_get(contentcache_index, path, APR_HASH_KEY_STRING);
+    while( ce && ce->rev != rev )
+        ce = ce->other;
+    return(ce);
+}
+
+static void contentcache_free(struct contentcache_entry *ce) {
+    free(ce->blocks);
+    free(ce->data);
+    free(ce->path);
+    free(ce);
+}
+
+/* Gives up a reference taken with the lock held, freeing 'ce' if dropped */
+static void contentcache_release(struct contentcache_entry *ce) {
+    if( --ce->refs == 0 && ce->dropped )
+        contentcache_free(ce);
+}
+
+static void contentcache_drop(struct contentcache_entry *ce) {
+    struct contentcache_entry *head, **cep;
+
+    contentcache_unlink(ce);
+
+    head = apr_hash_get(contentcache_index, ce->path, APR_HASH_KEY_STRING);
+    if( head == ce ) {
+        /* The index is keyed by the first entry's own copy of the path */
+        apr_hash_set(contentcache_index, ce->path, APR_HASH_KEY_STRING, NULL);
+        if( ce->other )
+            apr_hash_set(contentcache_index, ce->other->path,
+                    APR_HASH_KEY_STRING, ce->other);
+    } else {
+        for( cep = &head->other; *cep != ce; cep = &(*cep)->other )
+            ;
+        *cep = ce->other;
+    }
+
+    contentcache_stats.bytes -= ce->size;
+    contentcache_stats.entries--;
+    if( ce->prefetched )
+        contentcache_stats.prefetch_unused++;
+    if( ce->blocks ) {
+        contentcache_stats.compressed--;
+        contentcache_stats.compressed_bytes -= ce->size;
+        contentcache_stats.compressed_len -= ce->len;
+    }
+    if( ce->refs )
+        ce->dropped = 1;
+    else
+        contentcache_free(ce);
+}
+
+/*
+ * Compresses the contents of 'ce' and moves it to the cold list. Called
+ * with the lock held, which is dropped meanwhile. Returns 1 if they
+ * couldn't be compressed.
+ */
+static int contentcache_compress(struct contentcache_entry *ce) {
+    apr_size_t nblocks, i, blen, *blocks;
+    uLongf zlen;
+    char *data, *p;
+    int failed;
+
+    ce->refs++;
+    ce->compressing = 1;
+    pthread_mutex_unlock(&contentcache_lock);
+
+    nblocks = (ce->len + CONTENTCACHE_BLOCK - 1) / CONTENTCACHE_BLOCK;
+    blocks = malloc((nblocks + 1) * sizeof(apr_size_t));
+    data = malloc(nblocks ? nblocks * compressBound(CONTENTCACHE_BLOCK) : 1);
+    if( blocks && data ) {
+        blocks[0] = 0;
+        for( i = 0; i < nblocks; i++ ) {
+            blen = ce->len - i * CONTENTCACHE_BLOCK;
+            if( blen > CONTENTCACHE_BLOCK )
+                blen = CONTENTCACHE_BLOCK;
+            zlen = compressBound(blen);
+            /* Blocks which don't shrink are kept as they are */
+            if( compress2((Bytef *)data + blocks[i], &zlen,
+                        (Bytef *)ce->data + i * CONTENTCACHE_BLOCK, blen,
+                        Z_DEFAULT_COMPRESSION) != Z_OK || zlen >= blen ) {
+                memcpy(data + blocks[i], ce->data + i * CONTENTCACHE_BLOCK,
+                        blen);
+                zlen = blen;
+            }
+            blocks[i + 1] = blocks[i] + zlen;
+        }
+        if( (p = realloc(data, blocks[nblocks] ? blocks[nblocks] : 1)) )
+            data = p;
+    }
+
+    pthread_mutex_lock(&contentcache_lock);
+    ce->compressing = 0;
+    if( blocks == NULL || data == NULL || ce->dropped ) {
+        /* Evicted meanwhile is as good */
+        failed = !ce->dropped;
+        free(blocks);
+        free(data);
+        contentcache_release(ce);
+        return(failed);
+    }
+    contentcache_release(ce);
+
+    contentcache_unlink(ce);
+    contentcache_stats.bytes -= ce->size;
+    free(ce->data);
+    ce->data = data;
+    ce->blocks = blocks;
+    ce->size = blocks[nblocks];
+    contentcache_push(ce);
+    contentcache_stats.bytes += ce->size;
+    contentcache_stats.compressions++;
+    contentcache_stats.compressed++;
+    contentcache_stats.compressed_bytes += ce->size;
+    contentcache_stats.compressed_len += ce->len;
+    DEBUG("contentcache_compress(): %s, %lu bytes in %lu", ce->path,
+            (unsigned long)ce->len, (unsigned long)ce->size);
+    return(0);
+}
+
+/*
+ * Inflates what's wanted of compressed 'ce' into 'buf', as
+ * contentcache_get(). Called without the lock, holding a reference.
+ */
+static int contentcache_inflate(struct contentcache_entry *ce, char *buf,
+        size_t size, off_t offset) {
+    apr_size_t i, blen, skip, n;
+    char *block;
+    uLongf zlen;
+    int err = 0;
+
+    if( (block = malloc(CONTENTCACHE_BLOCK)) == NULL )
+        return(ENOMEM);
+    for( i = offset / CONTENTCACHE_BLOCK; size > 0; i++ ) {
+        blen = ce->len - i * CONTENTCACHE_BLOCK;
+        if( blen > CONTENTCACHE_BLOCK )
+            blen = CONTENTCACHE_BLOCK;
+        zlen = blen;
+        if( ce->blocks[i + 1] - ce->blocks[i] == blen )
+            memcpy(block, ce->data + ce->blocks[i], blen);
+        else if( uncompress((Bytef *)block, &zlen,
+                    (Bytef *)ce->data + ce->blocks[i],
+                    ce->blocks[i + 1] - ce->blocks[i]) != Z_OK ||
+                zlen != blen ) {
+            err = EIO;
+            break;
+        }
+        skip = offset - i * CONTENTCACHE_BLOCK;
+        n = (size > blen - skip) ? blen - skip : size;
+        memcpy(buf, block + skip, n);
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+    free(block);
+    return(err);
+}
+
+/*
+ * Inflates the whole of compressed 'ce' and moves it back to the hot list.
+ * Called with the lock held, which is dropped meanwhile. If readers are
+ * still inflating from the compressed blocks once it's done, they're left
+ * be, and the entry is inflated again on its next hit.
+ */
+static void contentcache_expand(struct contentcache_entry *ce) {
+    char *data;
+    int err = ENOMEM;
+
+    ce->refs++;
+    ce->compressing = 1;
+    pthread_mutex_unlock(&contentcache_lock);
+
+    if( (data = malloc(ce->len ? ce->len : 1)) != NULL )
+        err = contentcache_inflate(ce, data, ce->len, 0);
+
+    pthread_mutex_lock(&contentcache_lock);
+    ce->compressing = 0;
+    if( err || ce->dropped || ce->refs > 1 ) {
+        free(data);
+        ce->hits = (err || ce->dropped) ? 0 : CONTENTCACHE_PROMOTE - 1;
+        contentcache_release(ce);
+        return;
+    }
+    contentcache_release(ce);
+
+    contentcache_unlink(ce);
+    contentcache_stats.bytes -= ce->size;
+    contentcache_stats.compressed--;
+    contentcache_stats.compressed_bytes -= ce->size;
+    contentcache_stats.compressed_len -= ce->len;
+    free(ce->blocks);
+    free(ce->data);
+    ce->blocks = NULL;
+    ce->data = data;
+    ce->size = ce->len;
+    ce->hits = 0;
+    contentcache_push(ce);
+    contentcache_stats.bytes += ce->size;
+    contentcache_stats.promotions++;
+    DEBUG("contentcache_expand(): %s back to %lu bytes", ce->path,
+            (unsigned long)ce->len);
+}
+
+int contentcache_init(apr_size_t limit, int compress) {
+    if( apr_pool_create(&contentcache_pool, NULL) != APR_SUCCESS )
+        return(1);
+    contentcache_index = apr_hash_make(contentcache_pool);
+    contentcache_stats.limit = limit;
+    contentcache_compress_cold = compress;
+    return(0);
+}
+
+/*
+ * Copies up to *size bytes from 'offset' of the cached contents of 'path'
+ * into 'buf'. Returns 1 on a hit, with *size set to the number of bytes
+ * copied, and 0 if the file isn't cached at revision 'rev'.
+ */
+int contentcache_get(const char *path, svn_revnum_t rev, char *buf,
+        size_t *size, off_t offset) {
+    struct contentcache_entry *ce;
+    struct timespec start, end;
+    int held = 0, err = 0;
+
+    if( contentcache_stats.limit == 0 )
+        return(0);
+
+    pthread_mutex_lock(&contentcache_lock);
+    if( (ce = contentcache_find(path, rev)) == NULL ) {
+        contentcache_stats.misses++;
+        pthread_mutex_unlock(&contentcache_lock);
+        return(0);
+    }
+
+    contentcache_unlink(ce);
+    contentcache_push(ce);
+    if( offset >= ce->len ) {
+        *size = 0;
+    } else {
+        if( *size > ce->len - offset )
+            *size = ce->len - offset;
+        if( ce->blocks == NULL ) {
+            memcpy(buf, ce->data + offset, *size);
+        } else {
+            /* Hot again, so have it inflated for good */
+            if( ++ce->hits == CONTENTCACHE_PROMOTE && contentcache_worker ) {
+                contentcache_work = 1;
+                pthread_cond_signal(&contentcache_cond);
+            }
+            ce->refs++;
+            held = 1;
+            pthread_mutex_unlock(&contentcache_lock);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            err = contentcache_inflate(ce, buf, *size, offset);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            pthread_mutex_lock(&contentcache_lock);
+            contentcache_stats.inflates++;
+            contentcache_stats.inflate_ns +=
+                (apr_uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+                (end.tv_nsec - start.tv_nsec);
+        }
+    }
+
+    if( err ) {
+        DEBUG("contentcache_get(): can't inflate %s: %s", path,
+                strerror(err));
+        contentcache_stats.misses++;
+    } else {
+        contentcache_stats.hits++;
+        if( ce->prefetched && !ce->dropped ) {
+            contentcache_stats.prefetch_used++;
+            ce->prefetched = 0;
+        }
+    }
+    if( held )
+        contentcache_release(ce);
+    pthread_mutex_unlock(&contentcache_lock);
+    return( err == 0 );
+}
+
+/*
+ * Returns 1 if 'path' is cached at revision 'rev'. Doesn't count as a use.
+ */
+int contentcache_has(const char *path, svn_revnum_t rev) {
+    int ret;
+
+    pthread_mutex_lock(&contentcache_lock);
+    ret = (contentcache_find(path, rev) != NULL);
+    pthread_mutex_unlock(&contentcache_lock);
+    return(ret);
+}
+
+/*
+ * Returns 1 if a file of 'len' bytes would fit without evicting anything.
+ */
+int contentcache_room(apr_size_t len) {
+    int ret;
+
+    pthread_mutex_lock(&contentcache_lock);
+    ret = (contentcache_stats.bytes + len <= contentcache_stats.limit);
+    pthread_mutex_unlock(&contentcache_lock);
+    return(ret);
+}
+
+/*
+ * Returns the least recently used hot entry to compress, or NULL if there
+ * should be no more compressed.
+ */
+static struct contentcache_entry *contentcache_coldest(void) {
+    struct contentcache_entry *ce;
+
+    if( !contentcache_compress_cold || contentcache_hot.bytes <=
+            contentcache_stats.limit / CONTENTCACHE_HOT_SHARE )
+        return(NULL);
+    for( ce = contentcache_hot.tail; ce && ce->compressing; ce = ce->prev )
+        ;
+    return(ce);
+}
+
+/* Returns a cold entry hit often enough to be inflated back, or NULL */
+static struct contentcache_entry *contentcache_hottest(void) {
+    struct contentcache_entry *ce;
+
+    for( ce = contentcache_cold.head; ce; ce = ce->next )
+        if( ce->hits >= CONTENTCACHE_PROMOTE && !ce->compressing &&
+                ce->len <= contentcache_stats.limit /
+                CONTENTCACHE_HOT_SHARE )
+            return(ce);
+    return(NULL);
+}
+
+/*
+ * Evicts the least recently used files, cold ones first, until no more
+ * than 'limit' bytes are held. Called with the lock held.
+ */
+static void contentcache_evict(apr_size_t limit) {
+    struct contentcache_entry *ce;
+
+    while( contentcache_stats.bytes > limit ) {
+        if( (ce = contentcache_cold.tail) == NULL &&
+                (ce = contentcache_hot.tail) == NULL )
+            break;
+        DEBUG("contentcache_evict(): evicting %s", ce->path);
+        contentcache_drop(ce);
+        contentcache_stats.evictions++;
+    }
+}
+
+/*
+ * Brings the cache back within its budget, compressing cold files if
+ * it's to, else evicting. Called with the lock held, which may be dropped
+ * meanwhile.
+ */
+static void contentcache_shrink(void) {
+    struct contentcache_entry *ce;
+
+    while( contentcache_stats.bytes > contentcache_stats.limit &&
+            (ce = contentcache_coldest()) && !contentcache_compress(ce) )
+        ;
+    contentcache_evict(contentcache_stats.limit);
+}
+
+/*
+ * The background thread: inflates the cold files which are hit again, and
+ * compresses what it takes to stay within the budget.
+ */
+static void *contentcache_thread(void *arg) {
+    struct contentcache_entry *ce;
+
+    (void)arg;
+    pthread_mutex_lock(&contentcache_lock);
+    for( ;; ) {
+        while( !contentcache_work )
+            pthread_cond_wait(&contentcache_cond, &contentcache_lock);
+        contentcache_work = 0;
+        while( (ce = contentcache_hottest()) != NULL )
+            contentcache_expand(ce);
+        contentcache_shrink();
+    }
+    return(NULL);
+}
+
+/*
+ * Stores a copy of the full contents of 'path' at revision 'rev', evicting
+ * the least recently used files until it fits within the budget. Files
+ * bigger than the whole budget aren't cached. 'prefetched' marks contents
+ * nobody has asked for yet, so the stats can tell whether they were used.
+ */
+void contentcache_put(const char *path, svn_revnum_t rev, const char *data,
+        apr_size_t len, int prefetched) {
+    struct contentcache_entry *ce, *old;
+
+    if( len > contentcache_stats.limit )
+        return;
+
+    /* Copy outside the lock */
+    if( (ce = calloc(1, sizeof(struct contentcache_entry))) == NULL )
+        return;
+    if( (ce->data = malloc(len ? len : 1)) == NULL ||
+            (ce->path = strdup(path)) == NULL ) {
+        free(ce->data);
+        free(ce);
+        return;
+    }
+    memcpy(ce->data, data, len);
+    ce->len = ce->size = len;
+    ce->rev = rev;
+    ce->prefetched = (prefetched != 0);
+
+    pthread_mutex_lock(&contentcache_lock);
+    if( (old = contentcache_find(path, rev)) )
+        contentcache_drop(old);
+
+    /* In front of any other revisions of the path */
+    if( (old = apr_hash_get(contentcache_index, path, APR_HASH_KEY_STRING)) ) {
+        apr_hash_set(contentcache_index, path, APR_HASH_KEY_STRING, NULL);
+        ce->other = old;
+    }
+    apr_hash_set(contentcache_index, ce->path, APR_HASH_KEY_STRING, ce);
+    contentcache_push(ce);
+    contentcache_stats.bytes += len;
+    contentcache_stats.entries++;
+
+    /* Started here since FUSE forks into the background after init */
+    if( contentcache_compress_cold && !contentcache_worker ) {
+        pthread_t thread;
+
+        if( pthread_create(&thread, NULL, contentcache_thread, NULL) == 0 ) {
+            pthread_detach(thread);
+            contentcache_worker = 1;
+        }
+    }
+    if( contentcache_worker ) {
+        /* Compressing is left to the thread, within reason */
+        if( contentcache_stats.bytes > contentcache_stats.limit ) {
+            contentcache_work = 1;
+            pthread_cond_signal(&contentcache_cond);
+        }
+        contentcache_evict(contentcache_stats.limit +
+                contentcache_stats.limit / CONTENTCACHE_SLACK);
+    } else {
+        contentcache_shrink();
+    }
+    pthread_mutex_unlock(&contentcache_lock);
+}
+
+void contentcache_get_stats(struct contentcache_stats *stats) {
+    pthread_mutex_lock(&contentcache_lock);
+    *stats = contentcache_stats;
+    pthread_mutex_unlock(&contentcache_lock);
+}
@@ -0,0 +1,66 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_CONTENTCACHE_H
+#define _HAVE_CONTENTCACHE_H 1
+
+#include <sys/types.h>
+
+#include <apr.h>
+#include <svn_types.h>
+
+/* Cold files are compressed in blocks this big, each on its own */
+#define CONTENTCACHE_BLOCK (64 * 1024)
+
+/* With compression, files are only compressed while those left as they
+ * are take more than 1/CONTENTCACHE_HOT_SHARE of the budget */
+#define CONTENTCACHE_HOT_SHARE 4
+
+/* Compressed files hit this often are inflated back onto the hot list */
+#define CONTENTCACHE_PROMOTE 4
+
+/* While the background thread compresses, the budget may be overrun by
+ * 1/CONTENTCACHE_SLACK */
+#define CONTENTCACHE_SLACK 8
+
+struct contentcache_stats {
+    apr_uint64_t hits;
+    apr_uint64_t misses;
+    apr_uint64_t evictions;
+    apr_size_t entries;
+    apr_size_t bytes;       /* Bytes of file content currently held */
+    apr_size_t limit;       /* The cache_size budget */
+    apr_uint64_t prefetch_used;     /* Prefetched files later read */
+    apr_uint64_t prefetch_unused;   /* ... and evicted without being read */
+    apr_uint64_t compressions;      /* Files compressed as they went cold */
+    apr_uint64_t promotions;        /* ... and inflated as they got hot */
+    apr_size_t compressed;          /* Files held compressed */
+    apr_size_t compressed_bytes;    /* ... the bytes they take */
+    apr_size_t compressed_len;      /* ... and their length uncompressed */
+    apr_uint64_t inflates;          /* Hits on compressed files */
+    apr_uint64_t inflate_ns;        /* ... and the time spent inflating */
+};
+
+int contentcache_init(apr_size_t limit, int compress);
+
+int contentcache_get(const char *path, svn_revnum_t rev, char *buf,
+        size_t *size, off_t offset);
+
+int contentcache_has(const char *path, svn_revnum_t rev);
+
+int contentcache_room(apr_size_t len);
+
+void contentcache_put(const char *path, svn_revnum_t rev, const char *data,
+        apr_size_t len, int prefetched);
+
+void contentcache_get_stats(struct contentcache_stats *stats);
+
+#endif /* ifndef _HAVE_CONTENTCACHE_H */
@@ -0,0 +1,560 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "dircache.h"
+#include <time.h>
+#include <apr_hash.h>
+#include <apr_atomic.h>
+#include <pthread.h>
+
+/*
+ * The dircache is shared by all FUSE worker threads. Lookups take the
+ * lock shared, so readers never wait for each other; only applying the
+ * result of a listing takes it exclusively. Nodes may be freed whenever
+ * the lock is held exclusively, so neither a node nor its fields may be
+ * used once the lock is released.
+ *
+ * Nodes come from slabs of DIRCACHE_SLAB and go back on a free list when
+ * dropped, and child tables and names are malloc()ed, so evicting a
+ * subtree really does make room. Every lookup stamps the nodes it passes through with
+ * the time, so a directory is never colder than anything below it; when
+ * the meta_size ceiling is exceeded the coldest directories lose their
+ * children.
+ */
+static pthread_rwlock_t dircache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static apr_pool_t *dircache_pool;
+static apr_hash_t *dircache_names;  /* Interned path components */
+static struct dirbuf *dircache_top;
+static struct dirbuf *dircache_free;
+static apr_uint32_t dircache_gen;
+static svn_revnum_t dircache_rev = SVN_INVALID_REVNUM;
+static struct dircache_stats dircache_stats;
+
+/* An interned name, shared by every node with that name */
+struct dircache_name {
+    apr_uint32_t refs;
+    char name[1];
+};
+
+#define DIRCACHE_NAME(s) \
+    ((struct dircache_name *)((s) - offsetof(struct dircache_name, name)))
+
+/*
+ * Returns the single shared copy of the first 'len' bytes of 'name', or
+ * NULL if there's no memory for it. Sibling directories in different
+ * branches/tags repeat the same names over and over, so this keeps one
+ * copy of each, freed by dircache_release() once no node uses it.
+ */
+static const char *dircache_intern(const char *name, apr_size_t len) {
+    struct dircache_name *dn;
+    const char *interned;
+
+    if( (interned = apr_hash_get(dircache_names, name, len)) != NULL ) {
+        DIRCACHE_NAME(interned)->refs++;
+        return(interned);
+    }
+
+    if( (dn = malloc(offsetof(struct dircache_name, name) + len + 1)) == NULL )
+        return(NULL);
+    dn->refs = 1;
+    memcpy(dn->name, name, len);
+    dn->name[len] = '\0';
+    apr_hash_set(dircache_names, dn->name, len, dn->name);
+    dircache_stats.names += len + 1;
+    dircache_stats.bytes += len + 1;
+    return(dn->name);
+}
+
+static void dircache_release(const char *name, apr_size_t len) {
+    struct dircache_name *dn = DIRCACHE_NAME(name);
+
+    if( --dn->refs == 0 ) {
+        apr_hash_set(dircache_names, dn->name, len, NULL);
+        dircache_stats.names -= len + 1;
+        dircache_stats.bytes -= len + 1;
+        free(dn);
+    }
+}
+
+/*
+ * Returns the length of the path component at the start of 'path', which
+ * must not begin with a '/'.
+ */
+static apr_size_t dircache_component(const char *path) {
+    const char *slash = strchr(path, '/');
+
+    return( slash ? (apr_size_t)(slash - path) : strlen(path) );
+}
+
+static apr_uint32_t dircache_now(void) {
+    return( (apr_uint32_t)(time(NULL) - svnfs.mnttime.tv_sec) );
+}
+
+/* Marks 'dp' as used now. Safe with the lock only held shared. */
+static void dircache_touch(struct dirbuf *dp, apr_uint32_t now) {
+    if( apr_atomic_read32(&dp->used) != now )
+        apr_atomic_set32(&dp->used, now);
+}
+
+static struct dirbuf *dircache_alloc(void) {
+    struct dirbuf *dp;
+    int i;
+
+    if( dircache_free == NULL ) {
+        if( (dp = malloc(DIRCACHE_SLAB * sizeof(struct dirbuf))) == NULL )
+            return(NULL);
+        for( i = 0; i < DIRCACHE_SLAB; i++ ) {
+            dp[i].parent = dircache_free;
+            dircache_free = &dp[i];
+        }
+        dircache_stats.slabs += DIRCACHE_SLAB * sizeof(struct dirbuf);
+    }
+
+    dp = dircache_free;
+    dircache_free = dp->parent;
+    memset(dp, 0, sizeof(struct dirbuf));
+    dircache_stats.nodes++;
+    dircache_stats.bytes += sizeof(struct dirbuf);
+    return(dp);
+}
+
+static void dircache_free_tree(struct dirbuf *dp);
+
+/* Frees everything under 'dp', leaving it unlisted */
+static void dircache_free_children(struct dirbuf *dp) {
+    apr_uint32_t i;
+
+    for( i = 0; i < dp->children_size; i++ )
+        if( dp->children[i] )
+            dircache_free_tree(dp->children[i]);
+    free(dp->children);
+    dircache_stats.bytes -= dp->children_size * sizeof(struct dirbuf *);
+    dp->children = NULL;
+    dp->nchildren = dp->children_size = 0;
+    dp->listed = 0;
+}
+
+/* Frees 'dp' and everything under it, without unlinking it */
+static void dircache_free_tree(struct dirbuf *dp) {
+    dircache_free_children(dp);
+    dircache_release(dp->name, dp->namelen);
+    dp->dead = 1;
+    dp->parent = dircache_free;
+    dircache_free = dp;
+    dircache_stats.nodes--;
+    dircache_stats.bytes -= sizeof(struct dirbuf);
+}
+
+/* FNV-1a */
+static apr_uint32_t dircache_hash(const char *name, apr_size_t len) {
+    apr_uint32_t hash = 2166136261U;
+
+    while( len-- ) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619U;
+    }
+    return(hash);
+}
+
+/* Returns the slot of the child of 'dp' named 'name', or of the empty
+ * slot where it would go. The table mustn't be empty. */
+static apr_uint32_t dircache_slot(const struct dirbuf *dp, const char *name,
+        apr_size_t len) {
+    apr_uint32_t mask = dp->children_size - 1;
+    apr_uint32_t i = dircache_hash(name, len) & mask;
+    struct dirbuf *child;
+
+    while( (child = dp->children[i]) != NULL ) {
+        if( child->namelen == len && memcmp(child->name, name, len) == 0 )
+            break;
+        i = (i + 1) & mask;
+    }
+    return(i);
+}
+
+static struct dirbuf *dircache_child(const struct dirbuf *dp, const char *name,
+        apr_size_t len) {
+    if( dp->nchildren == 0 )
+        return(NULL);
+    return(dp->children[dircache_slot(dp, name, len)]);
+}
+
+/* Resizes the child table of 'dp' to 'size' slots. Returns 1 if there's
+ * no memory for it. */
+static int dircache_resize(struct dirbuf *dp, apr_uint32_t size) {
+    struct dirbuf **old = dp->children;
+    apr_uint32_t oldsize = dp->children_size;
+    apr_uint32_t i;
+
+    if( (dp->children = calloc(size, sizeof(struct dirbuf *))) == NULL ) {
+        dp->children = old;
+        return(1);
+    }
+    dp->children_size = size;
+    for( i = 0; i < oldsize; i++ )
+        if( old[i] )
+            dp->children[dircache_slot(dp, old[i]->name, old[i]->namelen)] =
+                old[i];
+    free(old);
+    dircache_stats.bytes += (size - oldsize) * sizeof(struct dirbuf *);
+    return(0);
+}
+
+/* Removes 'child' from its parent's table, shifting back any entries
+ * which probed past its slot */
+static void dircache_unlink(struct dirbuf *child) {
+    struct dirbuf *dp = child->parent;
+    apr_uint32_t mask = dp->children_size - 1;
+    apr_uint32_t i, j, home;
+
+    i = dircache_slot(dp, child->name, child->namelen);
+    for( j = (i + 1) & mask; dp->children[j]; j = (j + 1) & mask ) {
+        home = dircache_hash(dp->children[j]->name,
+                dp->children[j]->namelen) & mask;
+        if( (j > i && (home <= i || home > j)) ||
+                (j < i && home <= i && home > j) ) {
+            dp->children[i] = dp->children[j];
+            i = j;
+        }
+    }
+    dp->children[i] = NULL;
+    dp->nchildren--;
+}
+
+int dircache_init(apr_pool_t *parent, apr_size_t limit) {
+    if( apr_pool_create(&dircache_pool, parent) != APR_SUCCESS )
+        return(1);
+
+    dircache_names = apr_hash_make(dircache_pool);
+    dircache_stats.limit = limit;
+
+    if( (dircache_top = dircache_alloc()) == NULL ||
+            (dircache_top->name = dircache_intern("", 0)) == NULL )
+        return(1);
+    dircache_top->mode = S_IFDIR | 0755;
+    dircache_top->mtime = svnfs.mnttime.tv_sec;
+
+    return(0);
+}
+
+void dircache_rdlock(void) {
+    pthread_rwlock_rdlock(&dircache_lock);
+}
+
+void dircache_wrlock(void) {
+    pthread_rwlock_wrlock(&dircache_lock);
+}
+
+void dircache_unlock(void) {
+    pthread_rwlock_unlock(&dircache_lock);
+}
+
+struct dirbuf *dircache_root(void) {
+    return(dircache_top);
+}
+
+/*
+ * Returns the cached node for an absolute path (eg. "/trunk/README"), or
+ * NULL if it hasn't been seen yet. Costs one table probe per component.
+ */
+struct dirbuf *dircache_lookup(const char *path) {
+    struct dirbuf *dp = dircache_top;
+    apr_uint32_t now = dircache_now();
+    apr_size_t len;
+
+    while( dp ) {
+        dircache_touch(dp, now);
+        while( *path == '/' )
+            path++;
+        if( *path == '\0' )
+            return(dp);
+
+        len = dircache_component(path);
+        dp = dircache_child(dp, path, len);
+        path += len;
+    }
+
+    return(NULL);
+}
+
+/*
+ * Returns the cached node for the parent of 'path', or NULL if that hasn't
+ * been seen yet or 'path' is the root.
+ */
+struct dirbuf *dircache_lookup_parent(const char *path) {
+    struct dirbuf *dp = dircache_top;
+    const char *next;
+    apr_size_t len;
+
+    while( *path == '/' )
+        path++;
+    if( *path == '\0' )
+        return(NULL);
+
+    while( dp ) {
+        len = dircache_component(path);
+        for( next = path + len; *next == '/'; next++ )
+            ;
+        if( *next == '\0' )
+            return(dp);
+        dp = dircache_child(dp, path, len);
+        path = next;
+    }
+
+    return(NULL);
+}
+
+/*
+ * Fills in 'st' from the attributes cached for 'dp'.
+ */
+void dircache_stat(const struct dirbuf *dp, struct stat *st) {
+    st->st_mode = dp->mode;
+    st->st_nlink = S_ISDIR(dp->mode) ? 2 : 1;
+    st->st_size = dp->size;
+    st->st_mtime = dp->mtime;
+    st->st_uid = dp->uid;
+    st->st_gid = dp->gid;
+}
+
+/*
+ * Returns the child of 'dp' named by the first 'len' bytes of 'name',
+ * creating it as a directory which hasn't been listed yet if need be.
+ * Returns NULL if there's no memory for it.
+ */
+struct dirbuf *dircache_add_child(struct dirbuf *dp, const char *name,
+        apr_size_t len) {
+    struct dirbuf *child;
+
+    if( (child = dircache_child(dp, name, len)) != NULL )
+        return(child);
+
+    /* Tables are kept at most three quarters full */
+    if( (dp->nchildren + 1) * 4 > dp->children_size * 3 &&
+            dircache_resize(dp, dp->children_size ?
+                dp->children_size * 2 : 4) )
+        return(NULL);
+    if( (child = dircache_alloc()) == NULL )
+        return(NULL);
+    if( (child->name = dircache_intern(name, len)) == NULL ) {
+        child->parent = dircache_free;
+        dircache_free = child;
+        dircache_stats.nodes--;
+        dircache_stats.bytes -= sizeof(struct dirbuf);
+        return(NULL);
+    }
+    child->namelen = len;
+    child->parent = dp;
+    child->mode = S_IFDIR | 0755;
+    child->gen = dp->gen;
+    child->used = dircache_now();
+    dp->children[dircache_slot(dp, name, len)] = child;
+    dp->nchildren++;
+
+    return(child);
+}
+
+/*
+ * Returns the node for 'path', creating it and any missing parents. New
+ * parents are created as directories which haven't been listed yet.
+ * Returns NULL if there's no memory for them.
+ */
+struct dirbuf *dircache_add(const char *path) {
+    struct dirbuf *dp = dircache_top;
+    apr_uint32_t now = dircache_now();
+    apr_size_t len;
+
+    while( dp ) {
+        dircache_touch(dp, now);
+        while( *path == '/' )
+            path++;
+        if( *path == '\0' )
+            return(dp);
+
+        len = dircache_component(path);
+        dp = dircache_add_child(dp, path, len);
+        path += len;
+    }
+
+    return(NULL);
+}
+
+/*
+ * Forgets 'dp', and everything under it, because it has changed in the
+ * repository. Its parent is marked as needing listing again. The root is
+ * never removed; it just loses its children.
+ */
+void dircache_remove(struct dirbuf *dp) {
+    if( dp->parent == NULL ) {
+        dircache_free_children(dp);
+        return;
+    }
+
+    DEBUG("dircache_remove(): dropping %s", dp->name);
+    dp->parent->listed = 0;
+    dircache_unlink(dp);
+    dircache_free_tree(dp);
+}
+
+/*
+ * Drops the children of 'dp' which weren't seen by the listing with
+ * generation 'gen'. They have been removed from the repository, unless
+ * they're hidden and were never there. The lock
+ * must be held exclusively, as must it for dircache_add().
+ */
+void dircache_prune(struct dirbuf *dp, apr_uint32_t gen) {
+    struct dirbuf *child;
+    apr_uint32_t i = 0;
+
+    /* Unlinking a child may shift a later one back into its slot */
+    while( i < dp->children_size ) {
+        child = dp->children[i];
+        if( child && child->gen != gen && !child->hidden ) {
+            DEBUG("dircache_prune(): dropping %s", child->name);
+            dircache_unlink(child);
+            dircache_free_tree(child);
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * Gives 'dp' a copy of the children of 'from', a listed directory known
+ * to have the same contents, and marks it listed. Their own children
+ * aren't copied. Returns non-zero if there's no memory for them all. The
+ * lock must be held exclusively.
+ */
+int dircache_copy_children(struct dirbuf *dp, const struct dirbuf *from) {
+    struct dirbuf *child;
+    const struct dirbuf *src;
+    apr_uint32_t i;
+
+    for( i = 0; i < from->children_size; i++ ) {
+        if( (src = from->children[i]) == NULL || src->hidden )
+            continue;
+        if( (child = dircache_add_child(dp, src->name, src->namelen)) == NULL )
+            return(1);
+        child->mode = src->mode;
+        child->uid = src->uid;
+        child->gid = src->gid;
+        child->size = src->size;
+        child->mtime = src->mtime;
+        child->rev = src->rev;
+    }
+    dp->listed = 1;
+    return(0);
+}
+
+/*
+ * Calls 'func' for each child of 'dp' until it returns non-zero, which is
+ * then returned. Only needs the lock held shared.
+ */
+int dircache_foreach(struct dirbuf *dp, dircache_func_t func, void *baton) {
+    apr_uint32_t i;
+    int ret = 0;
+
+    for( i = 0; i < dp->children_size && !ret; i++ )
+        if( dp->children[i] )
+            ret = func(baton, dp->children[i]);
+
+    return(ret);
+}
+
+apr_uint32_t dircache_next_gen(void) {
+    return(++dircache_gen);
+}
+
+/*
+ * The revision the dircache is known to be up to date with, which is what
+ * a snapshot of it reflects. The lock must be held to get or set it.
+ */
+svn_revnum_t dircache_get_rev(void) {
+    return(dircache_rev);
+}
+
+void dircache_set_rev(svn_revnum_t rev) {
+    dircache_rev = rev;
+}
+
+struct dircache_cold {
+    apr_uint32_t used;
+    struct dirbuf *dp;
+};
+
+/* Counts, or if 'cold' isn't NULL also collects, the directories with
+ * children at and under 'dp' */
+static apr_size_t dircache_collect(struct dirbuf *dp,
+        struct dircache_cold *cold) {
+    apr_size_t count = 0;
+    apr_uint32_t i;
+
+    if( dp->nchildren == 0 )
+        return(0);
+
+    for( i = 0; i < dp->children_size; i++ )
+        if( dp->children[i] )
+            count += dircache_collect(dp->children[i],
+                    cold ? cold + count : NULL);
+    if( cold ) {
+        cold[count].used = dp->used;
+        cold[count].dp = dp;
+    }
+    return(count + 1);
+}
+
+static int dircache_cmp_cold(const void *a, const void *b) {
+    const struct dircache_cold *ca = a, *cb = b;
+
+    return( (ca->used > cb->used) - (ca->used < cb->used) );
+}
+
+/*
+ * Evicts the children of the least recently used directories until the
+ * dircache is back under DIRCACHE_TRIM_PERCENT of its limit. The lock must
+ * be held exclusively.
+ */
+void dircache_trim(void) {
+    struct dircache_cold *cold;
+    apr_size_t target, count, nodes, i;
+
+    if( dircache_stats.limit == 0 ||
+            dircache_stats.bytes <= dircache_stats.limit )
+        return;
+    target = dircache_stats.limit / 100 * DIRCACHE_TRIM_PERCENT;
+
+    count = dircache_collect(dircache_top, NULL);
+    if( (cold = malloc(count * sizeof(struct dircache_cold))) == NULL )
+        return;
+    dircache_collect(dircache_top, cold);
+    qsort(cold, count, sizeof(struct dircache_cold), dircache_cmp_cold);
+
+    /* Directories under one already evicted have been freed, and are
+     * skipped. Freed nodes aren't reused until the next allocation. */
+    for( i = 0; i < count && dircache_stats.bytes > target; i++ ) {
+        if( cold[i].dp->dead )
+            continue;
+        DEBUG("dircache_trim(): evicting under %s", cold[i].dp->name);
+        nodes = dircache_stats.nodes;
+        dircache_free_children(cold[i].dp);
+        dircache_stats.evictions++;
+        dircache_stats.evicted += nodes - dircache_stats.nodes;
+    }
+
+    free(cold);
+}
+
+void dircache_get_stats(struct dircache_stats *stats) {
+    dircache_rdlock();
+    *stats = dircache_stats;
+    dircache_unlock();
+}
@@ -0,0 +1,104 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_DIRCACHE_H
+#define _HAVE_DIRCACHE_H 1
+
+#include <sys/stat.h>
+
+#include <apr.h>
+#include <apr_pools.h>
+#include <svn_types.h>
+
+/* Nodes are allocated this many at a time */
+#define DIRCACHE_SLAB 1024
+
+/* Eviction stops once usage is down to this percentage of the limit */
+#define DIRCACHE_TRIM_PERCENT 90
+
+/* One node of the metadata cache. Nodes form a tree mirroring the
+ * repository; each directory keeps its children in an open addressed
+ * table keyed by the interned path component, so a lookup costs one
+ * probe per path component and a directory listing only touches its own
+ * children. Only the attributes svnfs reports are kept, rather than a
+ * whole struct stat; see dircache_stat(). */
+struct dirbuf {
+    const char *name;           /* Interned path component, "" for root */
+    struct dirbuf *parent;      /* Next free node, once freed */
+    struct dirbuf **children;   /* Table of children, dirs only */
+    apr_uint32_t nchildren;
+    apr_uint32_t children_size; /* Slots in children, a power of two */
+    apr_uint32_t namelen;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    time_t mtime;
+    svn_revnum_t rev;           /* Last changed revision */
+    apr_uint32_t gen;           /* Listing generation last seen in */
+    apr_uint32_t used;          /* Seconds after mount last looked up */
+    unsigned int listed : 1;    /* children are complete */
+    unsigned int dead : 1;      /* Freed by eviction */
+    unsigned int hidden : 1;    /* Not in the repository, eg. /@rev */
+};
+
+struct dircache_stats {
+    apr_size_t nodes;
+    apr_size_t bytes;           /* Nodes, child tables and names */
+    apr_size_t names;           /* ... of which interned names */
+    apr_size_t slabs;           /* Bytes of node slabs allocated */
+    apr_size_t limit;           /* The meta_size ceiling, or 0 */
+    apr_uint64_t evictions;     /* Subtrees evicted */
+    apr_uint64_t evicted;       /* Nodes in them */
+};
+
+typedef int (*dircache_func_t)(void *baton, struct dirbuf *child);
+
+int dircache_init(apr_pool_t *parent, apr_size_t limit);
+
+void dircache_rdlock(void);
+
+void dircache_wrlock(void);
+
+void dircache_unlock(void);
+
+struct dirbuf *dircache_root(void);
+
+struct dirbuf *dircache_lookup(const char *path);
+
+struct dirbuf *dircache_lookup_parent(const char *path);
+
+void dircache_stat(const struct dirbuf *dp, struct stat *st);
+
+struct dirbuf *dircache_add_child(struct dirbuf *dp, const char *name,
+        apr_size_t len);
+
+struct dirbuf *dircache_add(const char *path);
+
+void dircache_remove(struct dirbuf *dp);
+
+void dircache_prune(struct dirbuf *dp, apr_uint32_t gen);
+
+int dircache_copy_children(struct dirbuf *dp, const struct dirbuf *from);
+
+int dircache_foreach(struct dirbuf *dp, dircache_func_t func, void *baton);
+
+apr_uint32_t dircache_next_gen(void);
+
+svn_revnum_t dircache_get_rev(void);
+
+void dircache_set_rev(svn_revnum_t rev);
+
+void dircache_trim(void);
+
+void dircache_get_stats(struct dircache_stats *stats);
+
+#endif /* ifndef _HAVE_DIRCACHE_H */
@@ -0,0 +1,440 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "diskcache.h"
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <pthread.h>
+
+/*
+ * Persistent cache of file contents in a local directory, so that a
+ * remount doesn't have to fetch everything again. Files are stored as
+ * <cache_dir>/<repository uuid>/<hash of path>.<last changed revision>,
+ * which is immutable for a given name, so a cached file never needs
+ * revalidating. The path hashed is the one in the repository, not below
+ * the mount, so mounts of different parts of it can share a cache_dir.
+ * Files are written to a temporary name and renamed into place, so a
+ * crash never leaves a partial file under a real name.
+ *
+ * The cache is kept under a size cap by evicting the least recently
+ * used files. Recency survives remounts through the file mtimes, which
+ * are bumped the first time a file is used in each mount.
+ *
+ * The index is protected by diskcache_lock. Fetched files are written
+ * out without holding it, and reads open the file under it but read it
+ * without, which an eviction meanwhile doesn't disturb. Files aren't kept
+ * mapped or open between reads, so a cache_dir of any number of them
+ * doesn't run into the limits on either.
+ */
+
+#define DISKCACHE_TMP_PREFIX "tmp."
+
+/* Temporary files untouched for this long were left behind by a crash,
+ * rather than being written by another mount sharing the directory */
+#define DISKCACHE_TMP_AGE 3600
+
+struct diskcache_entry {
+    char *name;                 /* File name within diskcache_dir */
+    apr_uint64_t size;
+    time_t used;
+    unsigned int touched : 1;   /* mtime bumped in this mount */
+    struct diskcache_entry *prev;
+    struct diskcache_entry *next;
+};
+
+static pthread_mutex_t diskcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *diskcache_dir;
+static char *diskcache_prefix;        /* Repository path of the mount */
+static apr_pool_t *diskcache_pool;
+static apr_hash_t *diskcache_index;   /* name -> struct diskcache_entry */
+static struct diskcache_entry *diskcache_head;
+static struct diskcache_entry *diskcache_tail;
+static struct diskcache_stats diskcache_stats;
+
+static void diskcache_unlink(struct diskcache_entry *de) {
+    if( de->prev )
+        de->prev->next = de->next;
+    else
+        diskcache_head = de->next;
+    if( de->next )
+        de->next->prev = de->prev;
+    else
+        diskcache_tail = de->prev;
+    de->prev = de->next = NULL;
+}
+
+static void diskcache_push(struct diskcache_entry *de) {
+    de->prev = NULL;
+    de->next = diskcache_head;
+    if( diskcache_head )
+        diskcache_head->prev = de;
+    diskcache_head = de;
+    if( diskcache_tail == NULL )
+        diskcache_tail = de;
+}
+
+static struct diskcache_entry *diskcache_add(const char *name,
+        apr_uint64_t size, time_t used) {
+    struct diskcache_entry *de;
+
+    if( (de = calloc(1, sizeof(struct diskcache_entry))) == NULL )
+        return(NULL);
+    if( (de->name = strdup(name)) == NULL ) {
+        free(de);
+        return(NULL);
+    }
+    de->size = size;
+    de->used = used;
+
+    apr_hash_set(diskcache_index, de->name, APR_HASH_KEY_STRING, de);
+    diskcache_push(de);
+    diskcache_stats.bytes += size;
+    diskcache_stats.entries++;
+    return(de);
+}
+
+static void diskcache_drop(struct diskcache_entry *de) {
+    char *file;
+
+    diskcache_unlink(de);
+    apr_hash_set(diskcache_index, de->name, APR_HASH_KEY_STRING, NULL);
+    diskcache_stats.bytes -= de->size;
+    diskcache_stats.entries--;
+
+    if( (file = malloc(strlen(diskcache_dir) + strlen(de->name) + 2)) ) {
+        sprintf(file, "%s/%s", diskcache_dir, de->name);
+        unlink(file);
+        free(file);
+    }
+    free(de->name);
+    free(de);
+}
+
+static void diskcache_evict(apr_uint64_t needed) {
+    while( diskcache_tail &&
+            diskcache_stats.bytes + needed > diskcache_stats.limit ) {
+        DEBUG("diskcache_evict(): evicting %s", diskcache_tail->name);
+        diskcache_drop(diskcache_tail);
+        diskcache_stats.evictions++;
+    }
+}
+
+/* FNV-1a, carrying on from 'hash', to make a fixed length file name */
+static apr_uint64_t diskcache_hash(apr_uint64_t hash, const char *s) {
+    while( *s ) {
+        hash ^= (unsigned char)*s++;
+        hash *= 1099511628211ULL;
+    }
+    return(hash);
+}
+
+/* Names the file for 'path', below the mount, at 'rev' */
+static void diskcache_name(char *name, size_t len, const char *path,
+        svn_revnum_t rev) {
+    apr_uint64_t hash;
+
+    hash = diskcache_hash(14695981039346656037ULL, diskcache_prefix);
+    snprintf(name, len, "%016llx.%ld",
+            (unsigned long long)diskcache_hash(hash, path), (long)rev);
+}
+
+static int diskcache_cmp_used(const void *a, const void *b) {
+    const struct diskcache_entry *ea = *(struct diskcache_entry * const *)a;
+    const struct diskcache_entry *eb = *(struct diskcache_entry * const *)b;
+
+    return( (ea->used > eb->used) - (ea->used < eb->used) );
+}
+
+/*
+ * Loads the index of an existing cache directory, removing any temporary
+ * files left behind by a crash. Entries are ordered by their mtime.
+ */
+static int diskcache_scan(void) {
+    DIR *dir;
+    struct dirent *de;
+    struct stat st;
+    struct diskcache_entry **entries = NULL;
+    struct diskcache_entry *entry;
+    size_t count = 0, alloc = 0, i;
+    char *file;
+
+    if( (dir = opendir(diskcache_dir)) == NULL )
+        return(1);
+
+    while( (de = readdir(dir)) != NULL ) {
+        if( de->d_name[0] == '.' )
+            continue;
+        file = apr_psprintf(diskcache_pool, "%s/%s", diskcache_dir,
+                de->d_name);
+        if( stat(file, &st) || !S_ISREG(st.st_mode) )
+            continue;
+        if( !strncmp(de->d_name, DISKCACHE_TMP_PREFIX,
+                    strlen(DISKCACHE_TMP_PREFIX)) ) {
+            if( time(NULL) - st.st_mtime > DISKCACHE_TMP_AGE )
+                unlink(file);
+            continue;
+        }
+
+        if( count == alloc ) {
+            alloc = alloc ? alloc * 2 : 256;
+            entries = realloc(entries, alloc * sizeof(*entries));
+            if( entries == NULL ) {
+                closedir(dir);
+                return(1);
+            }
+        }
+        entries[count] = calloc(1, sizeof(struct diskcache_entry));
+        if( entries[count] == NULL ||
+                (entries[count]->name = strdup(de->d_name)) == NULL ) {
+            free(entries[count]);
+            continue;
+        }
+        entries[count]->size = st.st_size;
+        entries[count]->used = st.st_mtime;
+        count++;
+    }
+    closedir(dir);
+
+    /* Oldest first, so the most recently used ends up at the head */
+    qsort(entries, count, sizeof(*entries), diskcache_cmp_used);
+    for( i = 0; i < count; i++ ) {
+        entry = entries[i];
+        apr_hash_set(diskcache_index, entry->name, APR_HASH_KEY_STRING, entry);
+        diskcache_push(entry);
+        diskcache_stats.bytes += entry->size;
+        diskcache_stats.entries++;
+    }
+    free(entries);
+
+    DEBUG("diskcache_scan(): %lu files, %llu bytes in %s",
+            (unsigned long)diskcache_stats.entries,
+            (unsigned long long)diskcache_stats.bytes, diskcache_dir);
+    return(0);
+}
+
+/*
+ * Opens (creating if need be) the cache for repository 'uuid' under 'dir',
+ * for a mount of its path 'prefix' (eg. "/project", or "").
+ */
+int diskcache_init(const char *dir, const char *uuid, const char *prefix,
+        apr_uint64_t limit) {
+    if( apr_pool_create(&diskcache_pool, NULL) != APR_SUCCESS )
+        return(1);
+    diskcache_index = apr_hash_make(diskcache_pool);
+    diskcache_prefix = apr_pstrdup(diskcache_pool, prefix);
+    diskcache_stats.limit = limit;
+
+    if( mkdir(dir, 0700) && errno != EEXIST )
+        return(1);
+    diskcache_dir = apr_psprintf(diskcache_pool, "%s/%s", dir, uuid);
+    if( mkdir(diskcache_dir, 0700) && errno != EEXIST )
+        return(1);
+
+    if( diskcache_scan() )
+        return(1);
+    diskcache_evict(0);
+    return(0);
+}
+
+/*
+ * Counts a hit on 'de', and makes it the most recently used, on disk too.
+ * The lock must be held.
+ */
+static void diskcache_use(struct diskcache_entry *de) {
+    char *file;
+
+    diskcache_unlink(de);
+    diskcache_push(de);
+    if( !de->touched ) {
+        if( (file = malloc(strlen(diskcache_dir) + strlen(de->name) + 2)) ) {
+            sprintf(file, "%s/%s", diskcache_dir, de->name);
+            utimes(file, NULL);
+            free(file);
+        }
+        de->touched = 1;
+    }
+    diskcache_stats.hits++;
+}
+
+/*
+ * Copies up to *size bytes from 'offset' of the cached contents of 'path'
+ * into 'buf'. Returns 1 on a hit, with *size set to the number of bytes
+ * copied, and 0 if the file isn't cached at revision 'rev'.
+ */
+int diskcache_get(const char *path, svn_revnum_t rev, char *buf,
+        size_t *size, off_t offset) {
+    struct diskcache_entry *de;
+    apr_uint64_t len = 0;
+    char name[64];
+    char *file;
+    size_t done = 0;
+    ssize_t n;
+    int fd = -1;
+
+    if( diskcache_dir == NULL )
+        return(0);
+
+    diskcache_name(name, sizeof(name), path, rev);
+    pthread_mutex_lock(&diskcache_lock);
+    if( (de = apr_hash_get(diskcache_index, name, APR_HASH_KEY_STRING)) &&
+            (file = malloc(strlen(diskcache_dir) + strlen(name) + 2)) ) {
+        sprintf(file, "%s/%s", diskcache_dir, name);
+        if( (fd = open(file, O_RDONLY)) >= 0 ) {
+            diskcache_use(de);
+            len = de->size;
+        }
+        free(file);
+    }
+    if( fd < 0 )
+        diskcache_stats.misses++;
+    pthread_mutex_unlock(&diskcache_lock);
+    if( fd < 0 )
+        return(0);
+
+    /* The read may well go to disk, so not under the lock */
+    if( offset >= len ) {
+        *size = 0;
+    } else {
+        if( *size > len - offset )
+            *size = len - offset;
+        while( done < *size ) {
+            if( (n = pread(fd, buf + done, *size - done, offset + done)) < 0 &&
+                    errno == EINTR )
+                continue;
+            if( n <= 0 )
+                break;
+            done += n;
+        }
+    }
+    close(fd);
+    return( done == *size );
+}
+
+/*
+ * Returns a descriptor open on the cached contents of 'path' at revision
+ * 'rev', or -1 if they aren't cached. It stays good even once the file is
+ * evicted. Only hits are counted; a miss falls back to diskcache_get().
+ */
+int diskcache_open(const char *path, svn_revnum_t rev) {
+    struct diskcache_entry *de;
+    char name[64];
+    char *file;
+    int fd = -1;
+
+    if( diskcache_dir == NULL )
+        return(-1);
+
+    diskcache_name(name, sizeof(name), path, rev);
+    pthread_mutex_lock(&diskcache_lock);
+    if( (de = apr_hash_get(diskcache_index, name, APR_HASH_KEY_STRING)) &&
+            (file = malloc(strlen(diskcache_dir) + strlen(name) + 2)) ) {
+        sprintf(file, "%s/%s", diskcache_dir, name);
+        if( (fd = open(file, O_RDONLY)) >= 0 )
+            diskcache_use(de);
+        free(file);
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+    return(fd);
+}
+
+/*
+ * Returns 1 if 'path' is cached at revision 'rev'. Doesn't count as a use.
+ */
+int diskcache_has(const char *path, svn_revnum_t rev) {
+    char name[64];
+    int ret;
+
+    if( diskcache_dir == NULL )
+        return(0);
+
+    diskcache_name(name, sizeof(name), path, rev);
+    pthread_mutex_lock(&diskcache_lock);
+    ret = (apr_hash_get(diskcache_index, name, APR_HASH_KEY_STRING) != NULL);
+    pthread_mutex_unlock(&diskcache_lock);
+    return(ret);
+}
+
+/*
+ * Writes the full contents of 'path' at revision 'rev' to the cache.
+ */
+void diskcache_put(const char *path, svn_revnum_t rev, const char *data,
+        apr_size_t len) {
+    struct diskcache_entry *de;
+    char name[64];
+    char *tmp, *file;
+    apr_size_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if( diskcache_dir == NULL || len > diskcache_stats.limit )
+        return;
+
+    diskcache_name(name, sizeof(name), path, rev);
+    pthread_mutex_lock(&diskcache_lock);
+    de = apr_hash_get(diskcache_index, name, APR_HASH_KEY_STRING);
+    pthread_mutex_unlock(&diskcache_lock);
+    if( de )
+        return;
+
+    tmp = malloc(strlen(diskcache_dir) + strlen(DISKCACHE_TMP_PREFIX) + 8);
+    file = malloc(strlen(diskcache_dir) + strlen(name) + 2);
+    if( tmp == NULL || file == NULL )
+        goto diskcache_put_exit;
+    sprintf(tmp, "%s/" DISKCACHE_TMP_PREFIX "XXXXXX", diskcache_dir);
+    sprintf(file, "%s/%s", diskcache_dir, name);
+
+    if( (fd = mkstemp(tmp)) < 0 ) {
+        DEBUG("diskcache_put(): mkstemp() - %s", strerror(errno));
+        goto diskcache_put_exit;
+    }
+    while( done < len ) {
+        if( (n = write(fd, data + done, len - done)) < 0 ) {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+        done += n;
+    }
+    if( done < len || fsync(fd) ) {
+        DEBUG("diskcache_put(): writing %s - %s", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        goto diskcache_put_exit;
+    }
+    close(fd);
+
+    /* Another thread may have fetched the same file meanwhile */
+    pthread_mutex_lock(&diskcache_lock);
+    if( apr_hash_get(diskcache_index, name, APR_HASH_KEY_STRING) ) {
+        unlink(tmp);
+    } else if( rename(tmp, file) ) {
+        unlink(tmp);
+    } else {
+        diskcache_evict(len);
+        if( diskcache_add(name, len, time(NULL)) )
+            DEBUG("diskcache_put(): added %s as %s", path, name);
+    }
+    pthread_mutex_unlock(&diskcache_lock);
+
+diskcache_put_exit:
+    free(tmp);
+    free(file);
+}
+
+void diskcache_get_stats(struct diskcache_stats *stats) {
+    pthread_mutex_lock(&diskcache_lock);
+    *stats = diskcache_stats;
+    pthread_mutex_unlock(&diskcache_lock);
+}
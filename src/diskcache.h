@@ -0,0 +1,44 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_DISKCACHE_H
+#define _HAVE_DISKCACHE_H 1
+
+#include <sys/types.h>
+
+#include <apr.h>
+#include <svn_types.h>
+
+struct diskcache_stats {
+    apr_uint64_t hits;
+    apr_uint64_t misses;
+    apr_uint64_t evictions;
+    apr_size_t entries;
+    apr_uint64_t bytes;
+    apr_uint64_t limit;
+};
+
+int diskcache_init(const char *dir, const char *uuid, const char *prefix,
+        apr_uint64_t limit);
+
+int diskcache_get(const char *path, svn_revnum_t rev, char *buf,
+        size_t *size, off_t offset);
+
+int diskcache_open(const char *path, svn_revnum_t rev);
+
+int diskcache_has(const char *path, svn_revnum_t rev);
+
+void diskcache_put(const char *path, svn_revnum_t rev, const char *data,
+        apr_size_t len);
+
+void diskcache_get_stats(struct diskcache_stats *stats);
+
+#endif /* ifndef _HAVE_DISKCACHE_H */
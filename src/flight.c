@@ -0,0 +1,197 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "flight.h"
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Coalesces identical repository requests. When a parallel build has
+ * dozens of threads miss on the same directory or file at once, the first
+ * to ask makes the request and the rest wait for it to land, then take
+ * its result, failure included, instead of each asking for themselves.
+ *
+ * A request is keyed by its kind, path and revision. The caller making it
+ * gets a flight to land with flight_land(); waiting callers hold a
+ * reference, and the last one out frees it. How long callers wait is
+ * kept per key, for the ones waited on longest to be shown in the stats.
+ */
+
+struct flight {
+    char *key;                  /* In flight_index until landed */
+    int landed;
+    int result;                 /* 0 or an errno, once landed */
+    int waiters;
+    pthread_cond_t cond;
+};
+
+static const char *flight_kind_names[FLIGHT_KINDS] = { "list", "read" };
+
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static apr_pool_t *flight_pool;
+static apr_hash_t *flight_index;    /* key -> flight in progress */
+static apr_pool_t *flight_keys_pool;
+static apr_hash_t *flight_keys;     /* key -> struct flight_wait */
+static struct flight_stats flight_stats;
+
+int flight_init(void) {
+    if( apr_pool_create(&flight_pool, NULL) != APR_SUCCESS ||
+            apr_pool_create(&flight_keys_pool, NULL) != APR_SUCCESS )
+        return(1);
+    flight_index = apr_hash_make(flight_pool);
+    flight_keys = apr_hash_make(flight_keys_pool);
+    return(0);
+}
+
+static void flight_free(struct flight *f) {
+    pthread_cond_destroy(&f->cond);
+    free(f->key);
+    free(f);
+}
+
+/* Counts a wait of 'ns' on 'key'. The lock must be held. */
+static void flight_count(enum flight_kind kind, const char *key,
+        apr_uint64_t ns) {
+    struct flight_wait *w;
+
+    w = &flight_stats.kinds[kind];
+    w->waits++;
+    w->wait_ns += ns;
+    if( ns > w->max_ns )
+        w->max_ns = ns;
+
+    if( (w = apr_hash_get(flight_keys, key, APR_HASH_KEY_STRING)) == NULL ) {
+        if( apr_hash_count(flight_keys) >= FLIGHT_MAX_KEYS ) {
+            apr_pool_clear(flight_keys_pool);
+            flight_keys = apr_hash_make(flight_keys_pool);
+        }
+        w = apr_pcalloc(flight_keys_pool, sizeof(struct flight_wait));
+        apr_hash_set(flight_keys, apr_pstrdup(flight_keys_pool, key),
+                APR_HASH_KEY_STRING, w);
+        flight_stats.keys = apr_hash_count(flight_keys);
+    }
+    w->waits++;
+    w->wait_ns += ns;
+    if( ns > w->max_ns )
+        w->max_ns = ns;
+}
+
+/*
+ * Joins the request of 'kind' for 'path' at 'rev'. If none is in flight,
+ * returns -1 with *fp set: the caller is to make the request, and then
+ * hand its result to flight_land(). Otherwise waits for the one in flight
+ * to land and returns its result, 0 or an errno, with *fp NULL. If memory
+ * runs out, returns -1 with *fp NULL, and the caller goes it alone.
+ */
+int flight_join(enum flight_kind kind, const char *path, svn_revnum_t rev,
+        struct flight **fp) {
+    struct timespec start, now;
+    struct flight *f;
+    char *key;
+    int result;
+
+    *fp = NULL;
+    if( (key = malloc(strlen(path) + 32)) == NULL )
+        return(-1);
+    sprintf(key, "%s:%s@%ld", flight_kind_names[kind], path, (long)rev);
+
+    pthread_mutex_lock(&flight_lock);
+    if( (f = apr_hash_get(flight_index, key, APR_HASH_KEY_STRING)) == NULL ) {
+        if( (f = calloc(1, sizeof(struct flight))) != NULL ) {
+            f->key = key;
+            pthread_cond_init(&f->cond, NULL);
+            apr_hash_set(flight_index, f->key, APR_HASH_KEY_STRING, f);
+            flight_stats.flights[kind]++;
+            *fp = f;
+        } else {
+            free(key);
+        }
+        pthread_mutex_unlock(&flight_lock);
+        return(-1);
+    }
+
+    DEBUG("flight_join(): waiting on %s", key);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    f->waiters++;
+    while( !f->landed )
+        pthread_cond_wait(&f->cond, &flight_lock);
+    result = f->result;
+    if( --f->waiters == 0 )
+        flight_free(f);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    flight_count(kind, key, (apr_uint64_t)(now.tv_sec - start.tv_sec) *
+            1000000000 + (now.tv_nsec - start.tv_nsec));
+    pthread_mutex_unlock(&flight_lock);
+    free(key);
+    return(result);
+}
+
+/*
+ * Lands the request made for 'f' with 'result', 0 or an errno, handing it
+ * to everyone waiting. The next one for the same key makes a new request.
+ */
+void flight_land(struct flight *f, int result) {
+    if( f == NULL )
+        return;
+    pthread_mutex_lock(&flight_lock);
+    apr_hash_set(flight_index, f->key, APR_HASH_KEY_STRING, NULL);
+    f->landed = 1;
+    f->result = result;
+    if( f->waiters )
+        pthread_cond_broadcast(&f->cond);
+    else
+        flight_free(f);
+    pthread_mutex_unlock(&flight_lock);
+}
+
+/* Hands the FLIGHT_TOP keys waited on longest to 'func', longest first */
+void flight_top(flight_func_t func, void *baton) {
+    const struct flight_wait *top[FLIGHT_TOP];
+    const char *names[FLIGHT_TOP];
+    struct flight_wait *w;
+    apr_hash_index_t *hi;
+    const void *name;
+    void *val;
+    int n = 0, i;
+
+    pthread_mutex_lock(&flight_lock);
+    for( hi = apr_hash_first(NULL, flight_keys); hi; hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, &name, NULL, &val);
+        w = val;
+        /* Insertion into the few kept so far */
+        for( i = n; i > 0 && top[i - 1]->wait_ns < w->wait_ns; i-- ) {
+            if( i < FLIGHT_TOP ) {
+                top[i] = top[i - 1];
+                names[i] = names[i - 1];
+            }
+        }
+        if( i < FLIGHT_TOP ) {
+            top[i] = w;
+            names[i] = name;
+            if( n < FLIGHT_TOP )
+                n++;
+        }
+    }
+    for( i = 0; i < n; i++ )
+        func(baton, names[i], top[i]);
+    pthread_mutex_unlock(&flight_lock);
+}
+
+void flight_get_stats(struct flight_stats *stats) {
+    pthread_mutex_lock(&flight_lock);
+    *stats = flight_stats;
+    pthread_mutex_unlock(&flight_lock);
+}
@@ -0,0 +1,61 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_FLIGHT_H
+#define _HAVE_FLIGHT_H 1
+
+#include <apr.h>
+#include <svn_types.h>
+
+/* Keys whose waits are kept before they're all forgotten */
+#define FLIGHT_MAX_KEYS 4096
+
+/* Keys shown in the stats, those waited on longest first */
+#define FLIGHT_TOP 16
+
+/* Repository requests which are shared */
+enum flight_kind {
+    FLIGHT_LIST,                /* svnclient_list(), for getattr and readdir */
+    FLIGHT_READ,                /* File contents, for read and prefetch */
+    FLIGHT_KINDS
+};
+
+struct flight;
+
+/* Waits on one key, or for one kind */
+struct flight_wait {
+    apr_uint64_t waits;         /* Callers which waited on another's request */
+    apr_uint64_t wait_ns;       /* ... the time they spent waiting */
+    apr_uint64_t max_ns;        /* ... the longest one of them did */
+};
+
+struct flight_stats {
+    apr_uint64_t flights[FLIGHT_KINDS];   /* Requests made */
+    struct flight_wait kinds[FLIGHT_KINDS];
+    apr_size_t keys;            /* Keys with waits kept */
+};
+
+/* Called with each of the keys waited on longest by flight_top() */
+typedef void (*flight_func_t)(void *baton, const char *key,
+        const struct flight_wait *wait);
+
+int flight_init(void);
+
+int flight_join(enum flight_kind kind, const char *path, svn_revnum_t rev,
+        struct flight **fp);
+
+void flight_land(struct flight *f, int result);
+
+void flight_top(flight_func_t func, void *baton);
+
+void flight_get_stats(struct flight_stats *stats);
+
+#endif /* ifndef _HAVE_FLIGHT_H */
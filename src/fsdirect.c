@@ -0,0 +1,320 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "fsdirect.h"
+#include <apr_strings.h>
+#include <svn_pools.h>
+#include <svn_path.h>
+#include <svn_props.h>
+#include <svn_time.h>
+#include <svn_error.h>
+#include <svn_error_codes.h>
+
+/*
+ * Direct access to file:// repositories through libsvn_fs. The RA local
+ * layer goes through the same library, but works out the repository from
+ * the URL on every request and builds a fresh revision root each time;
+ * here the repository is opened once per handle, and the root of the
+ * revision last used is kept, so a pinned or polled mount reads straight
+ * from the one root.
+ *
+ * Handles stand in for RA sessions and are pooled with them (see
+ * rasession.c), since an svn_fs_t may only be used by one thread at a
+ * time. Listings come back as the svn_dirent_t's an RA listing would
+ * give, along with the properties of any node which has some, which the
+ * filesystem hands over for no more than it costs to say there are some.
+ */
+
+#define FSDIRECT_SCHEME "file://"
+
+struct fsdirect_date {
+    svn_revnum_t rev;
+    apr_time_t time;
+};
+
+/* Returns 1 if svnfs.svnpath can be opened directly */
+int fsdirect_usable(void) {
+    return( !svnfs.ra_local && !strncmp(svnfs.svnpath, FSDIRECT_SCHEME,
+                strlen(FSDIRECT_SCHEME)) );
+}
+
+/*
+ * Opens the repository svnfs.svnpath is in, allocating the handle in
+ * 'pool'.
+ */
+svn_error_t *fsdirect_open(struct fsdirect **fdp, apr_pool_t *pool) {
+    struct fsdirect *fd;
+    const char *path, *root;
+
+    /* file:///path or file://localhost/path */
+    path = svnfs.svnpath + strlen(FSDIRECT_SCHEME);
+    if( !strncmp(path, "localhost/", 10) )
+        path += 9;
+    if( *path != '/' )
+        return(svn_error_createf(SVN_ERR_RA_ILLEGAL_URL, NULL,
+                    "'%s' isn't a local URL", svnfs.svnpath));
+    path = svn_path_uri_decode(path, pool);
+
+    if( (root = svn_repos_find_root_path(path, pool)) == NULL )
+        return(svn_error_createf(SVN_ERR_RA_LOCAL_REPOS_OPEN_FAILED, NULL,
+                    "no repository found in '%s'", svnfs.svnpath));
+
+    fd = apr_pcalloc(pool, sizeof(struct fsdirect));
+    SVN_ERR(svn_repos_open(&fd->repos, root, pool));
+    fd->fs = svn_repos_fs(fd->repos);
+    fd->base = apr_pstrdup(pool, path + strlen(root));
+    fd->rev = SVN_INVALID_REVNUM;
+    fd->root_pool = svn_pool_create(pool);
+    fd->date_pool = svn_pool_create(pool);
+    fd->dates = apr_hash_make(fd->date_pool);
+
+    DEBUG("fsdirect_open(): opened %s, at '%s' in it", root, fd->base);
+    *fdp = fd;
+    return(SVN_NO_ERROR);
+}
+
+svn_error_t *fsdirect_youngest(struct fsdirect *fd, svn_revnum_t *rev,
+        apr_pool_t *pool) {
+    return(svn_fs_youngest_rev(rev, fd->fs, pool));
+}
+
+/* Places the root of revision 'rev', or of HEAD, in *root */
+static svn_error_t *fsdirect_root(struct fsdirect *fd, svn_revnum_t rev,
+        svn_fs_root_t **root, apr_pool_t *pool) {
+    if( !SVN_IS_VALID_REVNUM(rev) )
+        SVN_ERR(svn_fs_youngest_rev(&rev, fd->fs, pool));
+
+    if( fd->root == NULL || fd->rev != rev ) {
+        svn_pool_clear(fd->root_pool);
+        fd->root = NULL;
+        SVN_ERR(svn_fs_revision_root(&fd->root, fd->fs, rev, fd->root_pool));
+        fd->rev = rev;
+    }
+    *root = fd->root;
+    return(SVN_NO_ERROR);
+}
+
+/* Returns the repository path of 'relpath' */
+static const char *fsdirect_path(struct fsdirect *fd, const char *relpath,
+        apr_pool_t *pool) {
+    if( *relpath == '\0' )
+        return( *fd->base ? fd->base : "/" );
+    return(apr_pstrcat(pool, fd->base, "/", relpath, NULL));
+}
+
+/* Places the commit time of revision 'rev' in *time */
+static svn_error_t *fsdirect_date(struct fsdirect *fd, svn_revnum_t rev,
+        apr_time_t *time, apr_pool_t *pool) {
+    struct fsdirect_date *cached;
+    svn_string_t *date;
+
+    if( (cached = apr_hash_get(fd->dates, &rev, sizeof(rev))) != NULL ) {
+        *time = cached->time;
+        return(SVN_NO_ERROR);
+    }
+
+    *time = 0;
+    SVN_ERR(svn_fs_revision_prop(&date, fd->fs, rev, SVN_PROP_REVISION_DATE,
+                pool));
+    if( date )
+        SVN_ERR(svn_time_from_cstring(time, date->data, pool));
+
+    if( apr_hash_count(fd->dates) >= FSDIRECT_MAX_DATES ) {
+        svn_pool_clear(fd->date_pool);
+        fd->dates = apr_hash_make(fd->date_pool);
+    }
+    cached = apr_palloc(fd->date_pool, sizeof(struct fsdirect_date));
+    cached->rev = rev;
+    cached->time = *time;
+    apr_hash_set(fd->dates, &cached->rev, sizeof(cached->rev), cached);
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Describes the node at 'path' in 'root', which is of 'kind', as an RA
+ * listing would. *props is set to its properties if it has any, else NULL.
+ */
+static svn_error_t *fsdirect_dirent(struct fsdirect *fd, svn_fs_root_t *root,
+        const char *path, svn_node_kind_t kind, svn_dirent_t **dirent,
+        apr_hash_t **props, apr_pool_t *pool) {
+    svn_dirent_t *d;
+    apr_hash_t *proplist;
+
+    d = apr_pcalloc(pool, sizeof(svn_dirent_t));
+    d->kind = kind;
+    if( kind == svn_node_file )
+        SVN_ERR(svn_fs_file_length(&d->size, root, path, pool));
+    SVN_ERR(svn_fs_node_created_rev(&d->created_rev, root, path, pool));
+    SVN_ERR(fsdirect_date(fd, d->created_rev, &d->time, pool));
+    SVN_ERR(svn_fs_node_proplist(&proplist, root, path, pool));
+    d->has_props = (apr_hash_count(proplist) > 0);
+
+    *dirent = d;
+    *props = d->has_props ? proplist : NULL;
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Describes 'relpath' at revision 'rev' (or HEAD if invalid). *dirent is
+ * set to NULL if there's no such node.
+ */
+svn_error_t *fsdirect_stat(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_dirent_t **dirent, apr_hash_t **props,
+        apr_pool_t *pool) {
+    svn_fs_root_t *root;
+    svn_node_kind_t kind;
+    const char *path = fsdirect_path(fd, relpath, pool);
+
+    SVN_ERR(fsdirect_root(fd, rev, &root, pool));
+    SVN_ERR(svn_fs_check_path(&kind, root, path, pool));
+    if( kind == svn_node_none ) {
+        *dirent = NULL;
+        *props = NULL;
+        return(SVN_NO_ERROR);
+    }
+    return(fsdirect_dirent(fd, root, path, kind, dirent, props, pool));
+}
+
+/*
+ * Lists directory 'relpath' at revision 'rev' (or HEAD if invalid) into
+ * *dirents, name -> svn_dirent_t, and the properties of those children
+ * which have any into *props, name -> apr_hash_t.
+ */
+svn_error_t *fsdirect_get_dir(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, apr_hash_t **dirents, apr_hash_t **props,
+        apr_pool_t *pool) {
+    svn_fs_root_t *root;
+    apr_hash_t *entries, *proplist;
+    apr_hash_index_t *hi;
+    svn_fs_dirent_t *entry;
+    svn_dirent_t *dirent;
+    const char *path = fsdirect_path(fd, relpath, pool);
+    void *val;
+
+    SVN_ERR(fsdirect_root(fd, rev, &root, pool));
+    SVN_ERR(svn_fs_dir_entries(&entries, root, path, pool));
+
+    *dirents = apr_hash_make(pool);
+    *props = apr_hash_make(pool);
+    for( hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        entry = val;
+        SVN_ERR(fsdirect_dirent(fd, root, svn_path_join(path, entry->name,
+                        pool), entry->kind, &dirent, &proplist, pool));
+        apr_hash_set(*dirents, entry->name, APR_HASH_KEY_STRING, dirent);
+        if( proplist )
+            apr_hash_set(*props, entry->name, APR_HASH_KEY_STRING, proplist);
+    }
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Writes the contents of file 'relpath' at revision 'rev' to 'out'. An
+ * error from 'out' stops the copy and is returned.
+ */
+svn_error_t *fsdirect_get_file(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_stream_t *out, apr_pool_t *pool) {
+    svn_fs_root_t *root;
+    svn_stream_t *in;
+    char *buf;
+    apr_size_t len;
+
+    SVN_ERR(fsdirect_root(fd, rev, &root, pool));
+    SVN_ERR(svn_fs_file_contents(&in, root, fsdirect_path(fd, relpath, pool),
+                pool));
+
+    buf = apr_palloc(pool, SVN_STREAM_CHUNK_SIZE);
+    while( 1 ) {
+        len = SVN_STREAM_CHUNK_SIZE;
+        SVN_ERR(svn_stream_read(in, buf, &len));
+        if( len == 0 )
+            break;
+        SVN_ERR(svn_stream_write(out, buf, &len));
+    }
+    return(SVN_NO_ERROR);
+}
+
+/* Places the revision 'relpath' at revision 'rev' was last changed in in
+ * *created_rev */
+svn_error_t *fsdirect_created_rev(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_revnum_t *created_rev, apr_pool_t *pool) {
+    svn_fs_root_t *root;
+
+    SVN_ERR(fsdirect_root(fd, rev, &root, pool));
+    return(svn_fs_node_created_rev(created_rev, root,
+                fsdirect_path(fd, relpath, pool), pool));
+}
+
+/*
+ * Places the revision 'relpath' at revision 'rev' was last changed in in
+ * *created_rev, and its path in the repository then in *path, which is
+ * where it was copied from if it's been copied unchanged since.
+ */
+svn_error_t *fsdirect_created_path(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_revnum_t *created_rev, const char **path,
+        apr_pool_t *pool) {
+    svn_fs_root_t *root;
+    const char *fspath = fsdirect_path(fd, relpath, pool);
+
+    SVN_ERR(fsdirect_root(fd, rev, &root, pool));
+    SVN_ERR(svn_fs_node_created_rev(created_rev, root, fspath, pool));
+    return(svn_fs_node_created_path(path, root, fspath, pool));
+}
+
+/*
+ * Hands the paths changed in each of revisions 'start' to 'end' to
+ * 'receiver', as svn_ra_get_log() would with changed paths discovered.
+ * Only the changed paths are given; there's no author, date or message.
+ */
+svn_error_t *fsdirect_log(struct fsdirect *fd, svn_revnum_t start,
+        svn_revnum_t end, svn_log_message_receiver_t receiver, void *baton,
+        apr_pool_t *pool) {
+    static const char actions[] = { 'M', 'A', 'D', 'R', 'M' };
+    svn_fs_root_t *root;
+    svn_fs_path_change_t *change;
+    svn_log_changed_path_t *changed;
+    apr_hash_t *changes, *paths;
+    apr_hash_index_t *hi;
+    apr_pool_t *iterpool;
+    svn_revnum_t rev;
+    const void *key;
+    void *val;
+
+    iterpool = svn_pool_create(pool);
+    for( rev = start; rev <= end; rev++ ) {
+        svn_pool_clear(iterpool);
+        SVN_ERR(svn_fs_revision_root(&root, fd->fs, rev, iterpool));
+        SVN_ERR(svn_fs_paths_changed(&changes, root, iterpool));
+
+        paths = apr_hash_make(iterpool);
+        for( hi = apr_hash_first(iterpool, changes); hi;
+                hi = apr_hash_next(hi) ) {
+            apr_hash_this(hi, &key, NULL, &val);
+            change = val;
+            changed = apr_pcalloc(iterpool, sizeof(svn_log_changed_path_t));
+            changed->action =
+                ((apr_size_t)change->change_kind < sizeof(actions)) ?
+                actions[change->change_kind] : 'M';
+            changed->copyfrom_rev = SVN_INVALID_REVNUM;
+            apr_hash_set(paths, key, APR_HASH_KEY_STRING, changed);
+        }
+        SVN_ERR(receiver(baton, paths, rev, NULL, NULL, NULL, iterpool));
+    }
+    svn_pool_destroy(iterpool);
+    return(SVN_NO_ERROR);
+}
+
+svn_error_t *fsdirect_dated_revision(struct fsdirect *fd, svn_revnum_t *rev,
+        apr_time_t tm, apr_pool_t *pool) {
+    return(svn_repos_dated_revision(rev, fd->repos, tm, pool));
+}
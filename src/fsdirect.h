@@ -0,0 +1,71 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_FSDIRECT_H
+#define _HAVE_FSDIRECT_H 1
+
+#include <apr.h>
+#include <apr_pools.h>
+#include <apr_hash.h>
+#include <svn_types.h>
+#include <svn_io.h>
+#include <svn_fs.h>
+#include <svn_repos.h>
+
+/* Commit dates remembered per handle before they're all forgotten */
+#define FSDIRECT_MAX_DATES 4096
+
+/* A file:// repository opened directly, standing in for an RA session.
+ * Paths given to it are relative to svnfs.svnpath, as for a session */
+struct fsdirect {
+    svn_repos_t *repos;
+    svn_fs_t *fs;
+    const char *base;           /* Path of svnfs.svnpath in the repository */
+    svn_fs_root_t *root;        /* Of the last revision used, or NULL */
+    svn_revnum_t rev;
+    apr_pool_t *root_pool;
+    apr_hash_t *dates;          /* Revision -> its commit time */
+    apr_pool_t *date_pool;
+};
+
+int fsdirect_usable(void);
+
+svn_error_t *fsdirect_open(struct fsdirect **fdp, apr_pool_t *pool);
+
+svn_error_t *fsdirect_youngest(struct fsdirect *fd, svn_revnum_t *rev,
+        apr_pool_t *pool);
+
+svn_error_t *fsdirect_stat(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_dirent_t **dirent, apr_hash_t **props,
+        apr_pool_t *pool);
+
+svn_error_t *fsdirect_get_dir(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, apr_hash_t **dirents, apr_hash_t **props,
+        apr_pool_t *pool);
+
+svn_error_t *fsdirect_get_file(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_stream_t *out, apr_pool_t *pool);
+
+svn_error_t *fsdirect_created_rev(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_revnum_t *created_rev, apr_pool_t *pool);
+
+svn_error_t *fsdirect_created_path(struct fsdirect *fd, const char *relpath,
+        svn_revnum_t rev, svn_revnum_t *created_rev, const char **path,
+        apr_pool_t *pool);
+
+svn_error_t *fsdirect_log(struct fsdirect *fd, svn_revnum_t start,
+        svn_revnum_t end, svn_log_message_receiver_t receiver, void *baton,
+        apr_pool_t *pool);
+
+svn_error_t *fsdirect_dated_revision(struct fsdirect *fd, svn_revnum_t *rev,
+        apr_time_t tm, apr_pool_t *pool);
+
+#endif /* ifndef _HAVE_FSDIRECT_H */
@@ -0,0 +1,205 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "idcache.h"
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+#include <apr_hash.h>
+#include <pthread.h>
+
+/*
+ * Caches the results of user and group name lookups. Names which don't
+ * resolve are cached too, so a repository full of owners unknown to this
+ * host doesn't hit NSS on every stat. Lookups are rare once the cache is
+ * warm, so they're simply done with idcache_lock held.
+ */
+
+struct idcache_entry {
+    char *name;
+    long id;
+    int found;
+    time_t expires;
+};
+
+static pthread_mutex_t idcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static apr_pool_t *idcache_pool;
+static apr_hash_t *idcache_users;
+static apr_hash_t *idcache_groups;
+
+int idcache_init(void) {
+    if( apr_pool_create(&idcache_pool, NULL) != APR_SUCCESS )
+        return(1);
+    idcache_users = apr_hash_make(idcache_pool);
+    idcache_groups = apr_hash_make(idcache_pool);
+    return(0);
+}
+
+/*
+ * Returns a buffer suitable for getpwnam_r()/getgrnam_r(), doubling the
+ * size of 'buf' (and *len) if it's already allocated.
+ */
+static char *idcache_buffer(char *buf, size_t *len, int sysconf_name) {
+    long max;
+    char *newbuf;
+
+    if( buf == NULL ) {
+        max = sysconf(sysconf_name);
+        *len = (max > 0) ? max : 16384;
+    } else {
+        *len *= 2;
+    }
+
+    if( (newbuf = realloc(buf, *len)) == NULL )
+        free(buf);
+    return(newbuf);
+}
+
+static int idcache_lookup_user(const char *name, long *id) {
+    struct passwd pw, *result = NULL;
+    char *buf = NULL;
+    size_t len;
+    int err;
+
+    do {
+        if( (buf = idcache_buffer(buf, &len, _SC_GETPW_R_SIZE_MAX)) == NULL )
+            return(1);
+    } while( (err = getpwnam_r(name, &pw, buf, len, &result)) == ERANGE );
+
+    if( err == 0 && result )
+        *id = pw.pw_uid;
+    free(buf);
+    return( !(err == 0 && result) );
+}
+
+static int idcache_lookup_group(const char *name, long *id) {
+    struct group gr, *result = NULL;
+    char *buf = NULL;
+    size_t len;
+    int err;
+
+    do {
+        if( (buf = idcache_buffer(buf, &len, _SC_GETGR_R_SIZE_MAX)) == NULL )
+            return(1);
+    } while( (err = getgrnam_r(name, &gr, buf, len, &result)) == ERANGE );
+
+    if( err == 0 && result )
+        *id = gr.gr_gid;
+    free(buf);
+    return( !(err == 0 && result) );
+}
+
+/*
+ * Returns the (possibly refreshed) cache entry for 'name' in 'cache',
+ * resolving it with 'lookup' if it's missing or has expired.
+ */
+static struct idcache_entry *idcache_get(apr_hash_t *cache, const char *name,
+        int (*lookup)(const char *, long *)) {
+    struct idcache_entry *ie;
+    time_t now = time(NULL);
+
+    ie = apr_hash_get(cache, name, APR_HASH_KEY_STRING);
+    if( ie && ie->expires > now )
+        return(ie);
+
+    if( ie == NULL ) {
+        if( (ie = calloc(1, sizeof(struct idcache_entry))) == NULL )
+            return(NULL);
+        if( (ie->name = strdup(name)) == NULL ) {
+            free(ie);
+            return(NULL);
+        }
+        apr_hash_set(cache, ie->name, APR_HASH_KEY_STRING, ie);
+    }
+
+    ie->found = !lookup(name, &ie->id);
+    ie->expires = now + IDCACHE_TTL;
+    DEBUG("idcache_get(): %s -> %ld%s", name, ie->id,
+            ie->found ? "" : " (unknown)");
+    return(ie);
+}
+
+/*
+ * Places the uid for 'username' in 'uid'. Returns 1 if the user is unknown.
+ */
+int idcache_uid(const char *username, uid_t *uid) {
+    struct idcache_entry *ie;
+    int ret = 1;
+
+    pthread_mutex_lock(&idcache_lock);
+    ie = idcache_get(idcache_users, username, idcache_lookup_user);
+    if( ie && ie->found ) {
+        *uid = ie->id;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&idcache_lock);
+    return(ret);
+}
+
+/*
+ * Places the gid for 'groupname' in 'gid'. Returns 1 if the group is
+ * unknown.
+ */
+int idcache_gid(const char *groupname, gid_t *gid) {
+    struct idcache_entry *ie;
+    int ret = 1;
+
+    pthread_mutex_lock(&idcache_lock);
+    ie = idcache_get(idcache_groups, groupname, idcache_lookup_group);
+    if( ie && ie->found ) {
+        *gid = ie->id;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&idcache_lock);
+    return(ret);
+}
+
+/*
+ * Places a malloc()ed copy of the name of user 'uid' in 'name', for
+ * svnfs:owner_user. These aren't cached, as they're only wanted by chown.
+ * Returns 1 if the user is unknown or there's no memory.
+ */
+int idcache_username(uid_t uid, char **name) {
+    struct passwd pw, *result = NULL;
+    char *buf = NULL;
+    size_t len;
+    int err;
+
+    do {
+        if( (buf = idcache_buffer(buf, &len, _SC_GETPW_R_SIZE_MAX)) == NULL )
+            return(1);
+    } while( (err = getpwuid_r(uid, &pw, buf, len, &result)) == ERANGE );
+
+    *name = (err == 0 && result) ? strdup(pw.pw_name) : NULL;
+    free(buf);
+    return( *name == NULL );
+}
+
+/*
+ * As idcache_username(), for the name of group 'gid'.
+ */
+int idcache_groupname(gid_t gid, char **name) {
+    struct group gr, *result = NULL;
+    char *buf = NULL;
+    size_t len;
+    int err;
+
+    do {
+        if( (buf = idcache_buffer(buf, &len, _SC_GETGR_R_SIZE_MAX)) == NULL )
+            return(1);
+    } while( (err = getgrgid_r(gid, &gr, buf, len, &result)) == ERANGE );
+
+    *name = (err == 0 && result) ? strdup(gr.gr_name) : NULL;
+    free(buf);
+    return( *name == NULL );
+}
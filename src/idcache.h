@@ -0,0 +1,30 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_IDCACHE_H
+#define _HAVE_IDCACHE_H 1
+
+#include <sys/types.h>
+
+/* How long (in seconds) a resolved, or unknown, name is remembered */
+#define IDCACHE_TTL 300
+
+int idcache_init(void);
+
+int idcache_uid(const char *username, uid_t *uid);
+
+int idcache_gid(const char *groupname, gid_t *gid);
+
+int idcache_username(uid_t uid, char **name);
+
+int idcache_groupname(gid_t gid, char **name);
+
+#endif /* ifndef _HAVE_IDCACHE_H */
@@ -0,0 +1,200 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "inode.h"
+#include <apr_hash.h>
+#include <pthread.h>
+
+/*
+ * Inode numbers for the low-level interface (see lowlevel.c). A path is
+ * given a number the first time the kernel looks it up, and keeps it for
+ * as long as the kernel holds a reference: every lookup reply counts one,
+ * and the kernel gives them back with forget. Numbers are never reused,
+ * so a stale one can't name the wrong node. The root is always
+ * INODE_ROOT, and is never forgotten.
+ *
+ * The table is separate from the dircache because dircache nodes come and
+ * go with eviction and new revisions, while the kernel may hang on to an
+ * inode for as long as it likes.
+ */
+
+struct inode_entry {
+    apr_uint64_t ino;
+    apr_uint64_t nlookup;
+    char *path;
+};
+
+static pthread_mutex_t inode_lock = PTHREAD_MUTEX_INITIALIZER;
+static apr_pool_t *inode_pool;
+static apr_hash_t *inode_by_path;       /* path -> struct inode_entry */
+static apr_hash_t *inode_by_ino;        /* ino -> struct inode_entry */
+static apr_uint64_t inode_next = INODE_ROOT + 1;
+static struct inode_stats inode_stats;
+
+int inode_init(void) {
+    if( apr_pool_create(&inode_pool, NULL) != APR_SUCCESS )
+        return(1);
+    inode_by_path = apr_hash_make(inode_pool);
+    inode_by_ino = apr_hash_make(inode_pool);
+    return(0);
+}
+
+/*
+ * Returns the inode of 'path', numbering it if it has none, and counts
+ * one more reference to it held by the kernel. Returns 0 if out of memory.
+ */
+apr_uint64_t inode_ref(const char *path) {
+    struct inode_entry *ie;
+    apr_uint64_t ino;
+
+    if( !strcmp(path, "/") )
+        return(INODE_ROOT);
+
+    pthread_mutex_lock(&inode_lock);
+    if( (ie = apr_hash_get(inode_by_path, path, APR_HASH_KEY_STRING)) ==
+            NULL ) {
+        if( (ie = calloc(1, sizeof(struct inode_entry))) == NULL ||
+                (ie->path = strdup(path)) == NULL ) {
+            pthread_mutex_unlock(&inode_lock);
+            free(ie);
+            return(0);
+        }
+        ie->ino = inode_next++;
+        apr_hash_set(inode_by_path, ie->path, APR_HASH_KEY_STRING, ie);
+        apr_hash_set(inode_by_ino, &ie->ino, sizeof(ie->ino), ie);
+        inode_stats.entries++;
+    }
+    ie->nlookup++;
+    inode_stats.lookups++;
+    ino = ie->ino;
+    pthread_mutex_unlock(&inode_lock);
+    return(ino);
+}
+
+/*
+ * Returns the inode of 'path' if the kernel knows it, else 0. Doesn't
+ * count as a reference.
+ */
+apr_uint64_t inode_peek(const char *path) {
+    struct inode_entry *ie;
+    apr_uint64_t ino = 0;
+
+    if( !strcmp(path, "/") )
+        return(INODE_ROOT);
+
+    pthread_mutex_lock(&inode_lock);
+    if( (ie = apr_hash_get(inode_by_path, path, APR_HASH_KEY_STRING)) )
+        ino = ie->ino;
+    pthread_mutex_unlock(&inode_lock);
+    return(ino);
+}
+
+/*
+ * Returns a malloc()ed copy of the path of inode 'ino', or NULL if it's
+ * unknown or there's no memory.
+ */
+char *inode_path(apr_uint64_t ino) {
+    struct inode_entry *ie;
+    char *path = NULL;
+
+    if( ino == INODE_ROOT )
+        return(strdup("/"));
+
+    pthread_mutex_lock(&inode_lock);
+    if( (ie = apr_hash_get(inode_by_ino, &ino, sizeof(ino))) )
+        path = strdup(ie->path);
+    pthread_mutex_unlock(&inode_lock);
+    return(path);
+}
+
+/*
+ * Drops 'nlookup' of the kernel's references to 'ino', and the inode
+ * itself once there are none left.
+ */
+void inode_forget(apr_uint64_t ino, apr_uint64_t nlookup) {
+    struct inode_entry *ie;
+
+    if( ino == INODE_ROOT )
+        return;
+
+    pthread_mutex_lock(&inode_lock);
+    if( (ie = apr_hash_get(inode_by_ino, &ino, sizeof(ino))) == NULL ) {
+        pthread_mutex_unlock(&inode_lock);
+        return;
+    }
+    inode_stats.forgets += nlookup;
+    if( nlookup < ie->nlookup ) {
+        ie->nlookup -= nlookup;
+        pthread_mutex_unlock(&inode_lock);
+        return;
+    }
+    /* Unless it's been unlinked, and the path given to another */
+    if( apr_hash_get(inode_by_path, ie->path, APR_HASH_KEY_STRING) == ie )
+        apr_hash_set(inode_by_path, ie->path, APR_HASH_KEY_STRING, NULL);
+    apr_hash_set(inode_by_ino, &ie->ino, sizeof(ie->ino), NULL);
+    inode_stats.entries--;
+    pthread_mutex_unlock(&inode_lock);
+
+    free(ie->path);
+    free(ie);
+}
+
+/*
+ * Takes the path of 'path's inode away after it's been removed, so what's
+ * made there next gets a new one. The kernel may still hold the old one
+ * until it forgets it.
+ */
+void inode_unlink(const char *path) {
+    pthread_mutex_lock(&inode_lock);
+    apr_hash_set(inode_by_path, path, APR_HASH_KEY_STRING, NULL);
+    pthread_mutex_unlock(&inode_lock);
+}
+
+/*
+ * Moves the inodes of 'from', and of everything below it, to 'to' after a
+ * rename. Whatever was at 'to' is unlinked, as by inode_unlink().
+ */
+void inode_rename(const char *from, const char *to) {
+    struct inode_entry *ie;
+    apr_hash_index_t *hi;
+    size_t len = strlen(from);
+    char *path;
+    void *val;
+
+    pthread_mutex_lock(&inode_lock);
+    apr_hash_set(inode_by_path, to, APR_HASH_KEY_STRING, NULL);
+    for( hi = apr_hash_first(NULL, inode_by_ino); hi; hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        ie = val;
+        if( strncmp(ie->path, from, len) ||
+                (ie->path[len] != '\0' && ie->path[len] != '/') ||
+                apr_hash_get(inode_by_path, ie->path,
+                    APR_HASH_KEY_STRING) != ie )
+            continue;
+        /* Without memory it's left behind, and looked up afresh */
+        if( (path = malloc(strlen(to) + strlen(ie->path + len) + 1)) == NULL )
+            continue;
+        sprintf(path, "%s%s", to, ie->path + len);
+        apr_hash_set(inode_by_path, ie->path, APR_HASH_KEY_STRING, NULL);
+        free(ie->path);
+        ie->path = path;
+        apr_hash_set(inode_by_path, ie->path, APR_HASH_KEY_STRING, ie);
+    }
+    pthread_mutex_unlock(&inode_lock);
+}
+
+void inode_get_stats(struct inode_stats *stats) {
+    pthread_mutex_lock(&inode_lock);
+    *stats = inode_stats;
+    pthread_mutex_unlock(&inode_lock);
+}
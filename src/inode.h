@@ -0,0 +1,42 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_INODE_H
+#define _HAVE_INODE_H 1
+
+#include <apr.h>
+
+/* The root directory's inode, as FUSE expects */
+#define INODE_ROOT 1
+
+struct inode_stats {
+    apr_uint64_t lookups;       /* References handed to the kernel */
+    apr_uint64_t forgets;       /* ... and given back */
+    apr_size_t entries;         /* Inodes the kernel still knows about */
+};
+
+int inode_init(void);
+
+apr_uint64_t inode_ref(const char *path);
+
+apr_uint64_t inode_peek(const char *path);
+
+char *inode_path(apr_uint64_t ino);
+
+void inode_forget(apr_uint64_t ino, apr_uint64_t nlookup);
+
+void inode_unlink(const char *path);
+
+void inode_rename(const char *from, const char *to);
+
+void inode_get_stats(struct inode_stats *stats);
+
+#endif /* ifndef _HAVE_INODE_H */
@@ -0,0 +1,638 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#define FUSE_USE_VERSION 26
+
+#include "svnfs.h"
+#include "lowlevel.h"
+#include "inode.h"
+#include "svnclient.h"
+#include "negcache.h"
+#include "stats.h"
+#include <fuse_lowlevel.h>
+#include <limits.h>
+#include <utime.h>
+
+/*
+ * The low-level FUSE interface, used with -o lowlevel. The kernel talks
+ * in inodes (see inode.c) rather than paths, and is told per node how
+ * long it may keep entries and attributes: forever for anything which
+ * can't change, ie. everything at a pinned revision and everything under
+ * /@rev, so a HEAD mount can still cache its history views for good, and
+ * briefly for the rest. The high-level interface can only give one
+ * timeout for the whole mount.
+ *
+ * Each request is mapped back to a path and handed to the same
+ * operations as the high-level interface uses, so the two behave alike.
+ * Directory listings are read whole when opened, or rewound, and handed
+ * out from the copy; their entries carry the inode numbers of any nodes
+ * the kernel already knows. With -o rw, removals and renames move the
+ * inodes' paths along with them.
+ */
+
+/* d_ino of listed nodes the kernel hasn't looked up */
+#define LOWLEVEL_UNKNOWN_INO 0xffffffff
+
+struct lowlevel_dir {
+    fuse_req_t req;             /* Being answered, for sizing entries */
+    fuse_ino_t ino;
+    char *path;
+    char *buf;                  /* Entries as sent to the kernel */
+    size_t len;
+    size_t alloc;
+    int failed;                 /* No memory for the listing */
+};
+
+static const struct fuse_operations *lowlevel_op;
+
+/* Returns 1 if nothing about 'path' can change while mounted */
+static int lowlevel_fixed(const char *path) {
+    return( svnfs.rev >= 0 || svnclient_history(path, NULL, NULL) > 0 );
+}
+
+static double lowlevel_timeout(const char *path) {
+    size_t len = strlen(STATS_DIR);
+
+    /* The stats file's size changes each time it's opened */
+    if( !strncmp(path, STATS_DIR, len) &&
+            (path[len] == '\0' || path[len] == '/') )
+        return(0.0);
+    return( lowlevel_fixed(path) ? LOWLEVEL_FOREVER : LOWLEVEL_TIMEOUT );
+}
+
+/*
+ * How long a miss may be remembered, as negative_timeout is set in main().
+ * Under /@rev/N that's forever only if N is no newer than the revision
+ * the mount is known to be at; otherwise it may yet be committed.
+ */
+static double lowlevel_negative_timeout(const char *path) {
+    svn_revnum_t rev, youngest;
+
+    if( svnclient_history(path, &rev, NULL) > 0 ) {
+        youngest = svnclient_revnum();
+        if( SVN_IS_VALID_REVNUM(youngest) && rev <= youngest )
+            return(LOWLEVEL_FOREVER);
+    } else if( lowlevel_fixed(path) ) {
+        return(LOWLEVEL_FOREVER);
+    }
+    return( svnfs.poll_interval > 0 ? svnfs.poll_interval : NEGCACHE_TTL );
+}
+
+/* Returns the malloc()ed path of 'name' in directory 'parent', or NULL */
+static char *lowlevel_child(const char *parent, const char *name) {
+    char *path;
+
+    if( (path = malloc(strlen(parent) + strlen(name) + 2)) != NULL )
+        sprintf(path, "%s/%s", strcmp(parent, "/") ? parent : "", name);
+    return(path);
+}
+
+/* Places the malloc()ed path of 'name' in directory inode 'parent' in 'path' */
+static int lowlevel_child_of(fuse_ino_t parent, const char *name,
+        char **path) {
+    char *dir;
+
+    if( (dir = inode_path(parent)) == NULL )
+        return(ENOENT);
+    *path = lowlevel_child(dir, name);
+    free(dir);
+    return( *path ? 0 : ENOMEM );
+}
+
+/*
+ * Fills in 'e' for 'path', which exists, counting the reference the reply
+ * hands the kernel.
+ */
+static int lowlevel_entry(const char *path, struct fuse_entry_param *e) {
+    int err;
+
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    if( (err = -lowlevel_op->getattr(path, &e->attr)) )
+        return(err);
+    if( (e->ino = inode_ref(path)) == 0 )
+        return(ENOMEM);
+    e->attr.st_ino = e->ino;
+    e->attr_timeout = e->entry_timeout = lowlevel_timeout(path);
+    return(0);
+}
+
+/* Replies to a request which made 'path' with its entry */
+static void lowlevel_reply_made(fuse_req_t req, const char *path) {
+    struct fuse_entry_param e;
+    int err;
+
+    if( (err = lowlevel_entry(path, &e)) )
+        fuse_reply_err(req, err);
+    else if( fuse_reply_entry(req, &e) == -ENOENT )
+        inode_forget(e.ino, 1);     /* Interrupted */
+}
+
+static void lowlevel_lookup(fuse_req_t req, fuse_ino_t parent,
+        const char *name) {
+    struct fuse_entry_param e;
+    char *path;
+    int err;
+
+    if( (err = lowlevel_child_of(parent, name, &path)) ) {
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    if( (err = lowlevel_entry(path, &e)) ) {
+        if( err == ENOENT ) {
+            /* An entry with no inode has the kernel remember the miss */
+            memset(&e, 0, sizeof(e));
+            e.entry_timeout = lowlevel_negative_timeout(path);
+            fuse_reply_entry(req, &e);
+        } else {
+            fuse_reply_err(req, err);
+        }
+        free(path);
+        return;
+    }
+    free(path);
+
+    /* Interrupted, so the kernel never took the reference */
+    if( fuse_reply_entry(req, &e) == -ENOENT )
+        inode_forget(e.ino, 1);
+}
+
+static void lowlevel_create(fuse_req_t req, fuse_ino_t parent,
+        const char *name, mode_t mode, struct fuse_file_info *fi) {
+    struct fuse_entry_param e;
+    char *path;
+    int err;
+
+    if( (err = lowlevel_child_of(parent, name, &path)) ) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if( (err = -lowlevel_op->create(path, mode, fi)) ) {
+        fuse_reply_err(req, err);
+    } else if( (err = lowlevel_entry(path, &e)) ) {
+        lowlevel_op->release(path, fi);
+        fuse_reply_err(req, err);
+    } else if( fuse_reply_create(req, &e, fi) == -ENOENT ) {
+        /* Interrupted, so there'll be no release or forget */
+        lowlevel_op->release(path, fi);
+        inode_forget(e.ino, 1);
+    }
+    free(path);
+}
+
+static void lowlevel_mknod(fuse_req_t req, fuse_ino_t parent,
+        const char *name, mode_t mode, dev_t rdev) {
+    char *path;
+    int err;
+
+    if( (err = lowlevel_child_of(parent, name, &path)) ) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if( (err = -lowlevel_op->mknod(path, mode, rdev)) )
+        fuse_reply_err(req, err);
+    else
+        lowlevel_reply_made(req, path);
+    free(path);
+}
+
+static void lowlevel_mkdir(fuse_req_t req, fuse_ino_t parent,
+        const char *name, mode_t mode) {
+    char *path;
+    int err;
+
+    if( (err = lowlevel_child_of(parent, name, &path)) ) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if( (err = -lowlevel_op->mkdir(path, mode)) )
+        fuse_reply_err(req, err);
+    else
+        lowlevel_reply_made(req, path);
+    free(path);
+}
+
+/* unlink() and rmdir(), as 'remove' says */
+static void lowlevel_remove(fuse_req_t req, fuse_ino_t parent,
+        const char *name, int (*remove)(const char *)) {
+    char *path;
+    int err;
+
+    if( (err = lowlevel_child_of(parent, name, &path)) ) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if( (err = -remove(path)) == 0 )
+        inode_unlink(path);
+    fuse_reply_err(req, err);
+    free(path);
+}
+
+static void lowlevel_unlink(fuse_req_t req, fuse_ino_t parent,
+        const char *name) {
+    lowlevel_remove(req, parent, name, lowlevel_op->unlink);
+}
+
+static void lowlevel_rmdir(fuse_req_t req, fuse_ino_t parent,
+        const char *name) {
+    lowlevel_remove(req, parent, name, lowlevel_op->rmdir);
+}
+
+static void lowlevel_rename(fuse_req_t req, fuse_ino_t parent,
+        const char *name, fuse_ino_t newparent, const char *newname) {
+    char *from, *to;
+    int err;
+
+    if( (err = lowlevel_child_of(parent, name, &from)) ) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if( (err = lowlevel_child_of(newparent, newname, &to)) ) {
+        fuse_reply_err(req, err);
+        free(from);
+        return;
+    }
+    if( (err = -lowlevel_op->rename(from, to)) == 0 )
+        inode_rename(from, to);
+    fuse_reply_err(req, err);
+    free(from);
+    free(to);
+}
+
+/* chmod(), chown(), truncate() and utime() all in one */
+static void lowlevel_setattr(fuse_req_t req, fuse_ino_t ino,
+        struct stat *attr, int to_set, struct fuse_file_info *fi) {
+    struct utimbuf times;
+    struct stat st;
+    char *path;
+    int err = 0;
+
+    (void)fi;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if( to_set & FUSE_SET_ATTR_MODE )
+        err = -lowlevel_op->chmod(path, attr->st_mode);
+    if( !err && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) )
+        err = -lowlevel_op->chown(path,
+                (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1,
+                (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1);
+    if( !err && (to_set & FUSE_SET_ATTR_SIZE) )
+        err = -lowlevel_op->truncate(path, attr->st_size);
+    if( !err && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) ) {
+        times.actime = attr->st_atime;
+        times.modtime = attr->st_mtime;
+        err = -lowlevel_op->utime(path, &times);
+    }
+    if( !err )
+        err = -lowlevel_op->getattr(path, &st);
+
+    if( err ) {
+        fuse_reply_err(req, err);
+    } else {
+        st.st_ino = ino;
+        fuse_reply_attr(req, &st, lowlevel_timeout(path));
+    }
+    free(path);
+}
+
+static void lowlevel_forget(fuse_req_t req, fuse_ino_t ino,
+        unsigned long nlookup) {
+    inode_forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void lowlevel_getattr(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi) {
+    struct stat st;
+    char *path;
+    int err;
+
+    (void)fi;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if( (err = -lowlevel_op->getattr(path, &st)) ) {
+        fuse_reply_err(req, err);
+    } else {
+        st.st_ino = ino;
+        fuse_reply_attr(req, &st, lowlevel_timeout(path));
+    }
+    free(path);
+}
+
+static void lowlevel_readlink(fuse_req_t req, fuse_ino_t ino) {
+    char buf[PATH_MAX + 1];
+    char *path;
+    int err;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if( (err = -lowlevel_op->readlink(path, buf, sizeof(buf))) )
+        fuse_reply_err(req, err);
+    else
+        fuse_reply_readlink(req, buf);
+    free(path);
+}
+
+static void lowlevel_open(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi) {
+    char *path;
+    int err;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if( (err = -lowlevel_op->open(path, fi)) ) {
+        fuse_reply_err(req, err);
+    } else if( fuse_reply_open(req, fi) == -ENOENT ) {
+        /* Interrupted, so there'll be no release */
+        lowlevel_op->release(path, fi);
+    }
+    free(path);
+}
+
+#if FUSE_VERSION >= 29
+/* Replies with what read_buf() returned, spliced where it can be */
+static void lowlevel_reply_buf(fuse_req_t req, const char *path, size_t size,
+        off_t off, struct fuse_file_info *fi) {
+    struct fuse_bufvec *bv;
+    size_t i;
+    int ret;
+
+    if( (ret = lowlevel_op->read_buf(path, &bv, size, off, fi)) < 0 ) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    fuse_reply_data(req, bv, FUSE_BUF_SPLICE_MOVE);
+    for( i = 0; i < bv->count; i++ )
+        if( !(bv->buf[i].flags & FUSE_BUF_IS_FD) )
+            free(bv->buf[i].mem);
+    free(bv);
+}
+#endif
+
+static void lowlevel_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t off, struct fuse_file_info *fi) {
+    char *path, *buf;
+    int ret;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+#if FUSE_VERSION >= 29
+    if( lowlevel_op->read_buf ) {
+        lowlevel_reply_buf(req, path, size, off, fi);
+        free(path);
+        return;
+    }
+#endif
+    if( (buf = malloc(size ? size : 1)) == NULL ) {
+        fuse_reply_err(req, ENOMEM);
+        free(path);
+        return;
+    }
+    if( (ret = lowlevel_op->read(path, buf, size, off, fi)) < 0 )
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_buf(req, buf, ret);
+    free(buf);
+    free(path);
+}
+
+static void lowlevel_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+        size_t size, off_t off, struct fuse_file_info *fi) {
+    char *path;
+    int ret;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if( (ret = lowlevel_op->write(path, buf, size, off, fi)) < 0 )
+        fuse_reply_err(req, -ret);
+    else
+        fuse_reply_write(req, ret);
+    free(path);
+}
+
+static void lowlevel_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+        struct fuse_file_info *fi) {
+    char *path;
+
+    if( (path = inode_path(ino)) == NULL ) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    fuse_reply_err(req, -lowlevel_op->fsync(path, datasync, fi));
+    free(path);
+}
+
+static void lowlevel_release(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi) {
+    char *path;
+
+    /* The kernel keeps its reference until the file is closed */
+    if( (path = inode_path(ino)) != NULL ) {
+        lowlevel_op->release(path, fi);
+        free(path);
+    }
+    fuse_reply_err(req, 0);
+}
+
+static void lowlevel_opendir(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi) {
+    struct lowlevel_dir *d;
+
+    if( (d = calloc(1, sizeof(struct lowlevel_dir))) == NULL ) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    if( (d->path = inode_path(ino)) == NULL ) {
+        free(d);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    d->ino = ino;
+    fi->fh = (uintptr_t)d;
+    if( fuse_reply_open(req, fi) == -ENOENT ) {
+        free(d->path);
+        free(d);
+    }
+}
+
+/* The filler handed to the readdir operation */
+static int lowlevel_fill(void *buf, const char *name, const struct stat *stbuf,
+        off_t off) {
+    struct lowlevel_dir *d = buf;
+    struct stat st;
+    char *path, *grown;
+    size_t len;
+
+    (void)off;
+
+    memset(&st, 0, sizeof(st));
+    st.st_ino = LOWLEVEL_UNKNOWN_INO;
+    if( stbuf )
+        st.st_mode = stbuf->st_mode;
+    if( !strcmp(name, ".") ) {
+        st.st_ino = d->ino;
+    } else if( strcmp(name, "..") &&
+            (path = lowlevel_child(d->path, name)) != NULL ) {
+        if( (st.st_ino = inode_peek(path)) == 0 )
+            st.st_ino = LOWLEVEL_UNKNOWN_INO;
+        free(path);
+    }
+
+    len = fuse_add_direntry(d->req, NULL, 0, name, NULL, 0);
+    if( d->len + len > d->alloc ) {
+        if( (grown = realloc(d->buf, (d->len + len) * 2)) == NULL ) {
+            d->failed = 1;
+            return(1);
+        }
+        d->buf = grown;
+        d->alloc = (d->len + len) * 2;
+    }
+    /* Each entry's offset is where the next one starts */
+    fuse_add_direntry(d->req, d->buf + d->len, len, name, &st, d->len + len);
+    d->len += len;
+    return(0);
+}
+
+static void lowlevel_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t off, struct fuse_file_info *fi) {
+    struct lowlevel_dir *d = (struct lowlevel_dir *)(uintptr_t)fi->fh;
+    int err;
+
+    (void)ino;
+
+    /* Listed afresh when opened or rewound, not part way through */
+    if( off == 0 ) {
+        d->req = req;
+        d->len = 0;
+        d->failed = 0;
+        if( (err = -lowlevel_op->readdir(d->path, d, lowlevel_fill, 0,
+                        fi)) || d->failed ) {
+            d->len = 0;
+            fuse_reply_err(req, err ? err : ENOMEM);
+            return;
+        }
+    }
+
+    if( off < d->len ) {
+        if( size > d->len - off )
+            size = d->len - off;
+        fuse_reply_buf(req, d->buf + off, size);
+    } else {
+        fuse_reply_buf(req, NULL, 0);
+    }
+}
+
+static void lowlevel_releasedir(fuse_req_t req, fuse_ino_t ino,
+        struct fuse_file_info *fi) {
+    struct lowlevel_dir *d = (struct lowlevel_dir *)(uintptr_t)fi->fh;
+
+    (void)ino;
+
+    free(d->buf);
+    free(d->path);
+    free(d);
+    fuse_reply_err(req, 0);
+}
+
+static void lowlevel_init(void *userdata, struct fuse_conn_info *conn) {
+    (void)userdata;
+
+    if( lowlevel_op->init )
+        lowlevel_op->init(conn);
+}
+
+static void lowlevel_destroy(void *userdata) {
+    (void)userdata;
+
+    if( lowlevel_op->destroy )
+        lowlevel_op->destroy(NULL);
+}
+
+static struct fuse_lowlevel_ops lowlevel_oper = {
+    .init = lowlevel_init,
+    .destroy = lowlevel_destroy,
+    .lookup = lowlevel_lookup,
+    .forget = lowlevel_forget,
+    .getattr = lowlevel_getattr,
+    .setattr = lowlevel_setattr,
+    .readlink = lowlevel_readlink,
+    .mknod = lowlevel_mknod,
+    .mkdir = lowlevel_mkdir,
+    .unlink = lowlevel_unlink,
+    .rmdir = lowlevel_rmdir,
+    .rename = lowlevel_rename,
+    .create = lowlevel_create,
+    .open = lowlevel_open,
+    .read = lowlevel_read,
+    .write = lowlevel_write,
+    .fsync = lowlevel_fsync,
+    .release = lowlevel_release,
+    .opendir = lowlevel_opendir,
+    .readdir = lowlevel_readdir,
+    .releasedir = lowlevel_releasedir
+};
+
+/*
+ * Mounts and serves the filesystem as fuse_main() would, with 'op' doing
+ * the work. Returns non-zero on failure.
+ */
+int lowlevel_main(struct fuse_args *args, const struct fuse_operations *op) {
+    struct fuse_chan *ch;
+    struct fuse_session *se;
+    char *mountpoint;
+    int multithreaded, foreground;
+    int err = -1;
+
+    lowlevel_op = op;
+
+    if( fuse_parse_cmdline(args, &mountpoint, &multithreaded,
+                &foreground) == -1 )
+        return(1);
+    if( mountpoint == NULL ) {
+        fprintf(stderr, "No mount point given\n");
+        return(1);
+    }
+    if( (ch = fuse_mount(mountpoint, args)) == NULL ) {
+        free(mountpoint);
+        return(1);
+    }
+
+    if( (se = fuse_lowlevel_new(args, &lowlevel_oper, sizeof(lowlevel_oper),
+                    NULL)) != NULL ) {
+        if( fuse_set_signal_handlers(se) == 0 ) {
+            fuse_session_add_chan(se, ch);
+            if( fuse_daemonize(foreground) == 0 )
+                err = multithreaded ? fuse_session_loop_mt(se) :
+                    fuse_session_loop(se);
+            fuse_remove_signal_handlers(se);
+            fuse_session_remove_chan(ch);
+        }
+        fuse_session_destroy(se);
+    }
+    fuse_unmount(mountpoint, ch);
+    free(mountpoint);
+    return( err ? 1 : 0 );
+}
@@ -0,0 +1,23 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_LOWLEVEL_H
+#define _HAVE_LOWLEVEL_H 1
+
+/* Attributes and entries which can't change are kept this long (seconds) */
+#define LOWLEVEL_FOREVER 86400.0
+
+/* ... and the rest this long, as with the high-level interface */
+#define LOWLEVEL_TIMEOUT 1.0
+
+int lowlevel_main(struct fuse_args *args, const struct fuse_operations *op);
+
+#endif /* ifndef _HAVE_LOWLEVEL_H */
@@ -0,0 +1,110 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "negcache.h"
+#include <time.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <pthread.h>
+
+/*
+ * Remembers paths which don't exist in the repository, so that tools
+ * probing for .git, *.orig and the like don't cost a round trip each.
+ * Misses within a directory which has been completely listed don't need
+ * to be remembered here at all; see svnfs_getattr().
+ *
+ * Entries either expire after NEGCACHE_TTL seconds or, when the poller is
+ * keeping the dircache up to date, last until negcache_clear() is called
+ * for a new revision. The callers order negcache_add() and negcache_clear()
+ * through the dircache lock.
+ */
+
+static pthread_mutex_t negcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static apr_pool_t *negcache_pool;
+static apr_hash_t *negcache_index;      /* path -> time_t expiry, or 0 */
+static int negcache_expire;
+static struct negcache_stats negcache_stats;
+
+/* Drops every entry. The lock must be held. */
+static void negcache_empty(void) {
+    apr_pool_clear(negcache_pool);
+    negcache_index = apr_hash_make(negcache_pool);
+    negcache_stats.entries = 0;
+}
+
+/*
+ * 'expire' is non-zero if entries should expire after NEGCACHE_TTL.
+ */
+int negcache_init(int expire) {
+    if( apr_pool_create(&negcache_pool, NULL) != APR_SUCCESS )
+        return(1);
+    negcache_index = apr_hash_make(negcache_pool);
+    negcache_expire = expire;
+    return(0);
+}
+
+/*
+ * Returns 1 if 'path' is known not to exist.
+ */
+int negcache_lookup(const char *path) {
+    time_t *expires;
+    int ret = 0;
+
+    pthread_mutex_lock(&negcache_lock);
+    expires = apr_hash_get(negcache_index, path, APR_HASH_KEY_STRING);
+    if( expires && (*expires == 0 || *expires > time(NULL)) ) {
+        negcache_stats.hits++;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&negcache_lock);
+    return(ret);
+}
+
+void negcache_add(const char *path) {
+    time_t *expires;
+
+    pthread_mutex_lock(&negcache_lock);
+    if( (expires = apr_hash_get(negcache_index, path, APR_HASH_KEY_STRING)) ==
+            NULL ) {
+        /* Expired entries are only reclaimed by emptying the whole pool */
+        if( negcache_stats.entries >= NEGCACHE_MAX )
+            negcache_empty();
+        expires = apr_palloc(negcache_pool, sizeof(time_t));
+        apr_hash_set(negcache_index, apr_pstrdup(negcache_pool, path),
+                APR_HASH_KEY_STRING, expires);
+        negcache_stats.entries++;
+    }
+    *expires = negcache_expire ? time(NULL) + NEGCACHE_TTL : 0;
+    pthread_mutex_unlock(&negcache_lock);
+}
+
+/*
+ * Forgets every miss, because a new revision may have added any of them.
+ */
+void negcache_clear(void) {
+    pthread_mutex_lock(&negcache_lock);
+    negcache_empty();
+    pthread_mutex_unlock(&negcache_lock);
+}
+
+void negcache_count_parent_hit(void) {
+    pthread_mutex_lock(&negcache_lock);
+    negcache_stats.parent_hits++;
+    pthread_mutex_unlock(&negcache_lock);
+}
+
+void negcache_get_stats(struct negcache_stats *stats) {
+    pthread_mutex_lock(&negcache_lock);
+    *stats = negcache_stats;
+    pthread_mutex_unlock(&negcache_lock);
+}
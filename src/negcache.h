@@ -0,0 +1,42 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_NEGCACHE_H
+#define _HAVE_NEGCACHE_H 1
+
+#include <apr.h>
+
+/* How long (in seconds) a miss is remembered when nothing polls for new
+ * revisions; otherwise misses last until the next one */
+#define NEGCACHE_TTL 10
+
+/* Misses remembered before the cache is simply emptied */
+#define NEGCACHE_MAX 16384
+
+struct negcache_stats {
+    apr_uint64_t hits;          /* Answered from the cache */
+    apr_uint64_t parent_hits;   /* Answered from a listed parent */
+    apr_size_t entries;
+};
+
+int negcache_init(int expire);
+
+int negcache_lookup(const char *path);
+
+void negcache_add(const char *path);
+
+void negcache_clear(void);
+
+void negcache_count_parent_hit(void);
+
+void negcache_get_stats(struct negcache_stats *stats);
+
+#endif /* ifndef _HAVE_NEGCACHE_H */
@@ -0,0 +1,122 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "origin.h"
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <pthread.h>
+
+/*
+ * Remembers where nodes come from: for a path and the revision it was
+ * last changed in, the path it had in that revision. A file in a tag or
+ * branch which hasn't changed since it was copied is the very same node
+ * as the one it was copied from, so caching contents and listings under
+ * the origin lets every copy share one; see svnclient_origin().
+ *
+ * A path only ever gets another origin for the same last changed revision
+ * by being deleted and copied again from elsewhere, so entries last until
+ * the log shows a deletion or replacement and origin_clear() is called,
+ * or there are ORIGIN_MAX of them.
+ */
+
+static pthread_mutex_t origin_lock = PTHREAD_MUTEX_INITIALIZER;
+static apr_pool_t *origin_pool;
+static apr_hash_t *origin_index;    /* "rev path" -> origin, or "" if path */
+static struct origin_stats origin_stats;
+
+/* Drops every entry. The lock must be held. */
+static void origin_empty(void) {
+    apr_pool_clear(origin_pool);
+    origin_index = apr_hash_make(origin_pool);
+    origin_stats.entries = 0;
+}
+
+int origin_init(void) {
+    if( apr_pool_create(&origin_pool, NULL) != APR_SUCCESS )
+        return(1);
+    origin_index = apr_hash_make(origin_pool);
+    return(0);
+}
+
+/*
+ * Returns 1 if the origin of 'path', last changed in 'created_rev', is
+ * known, placing it in *origin, malloc()ed, or NULL if it's 'path' itself.
+ * Returns 0 if it has to be asked of the repository.
+ */
+int origin_get(const char *path, svn_revnum_t created_rev, char **origin) {
+    const char *found;
+    char *key;
+
+    *origin = NULL;
+    if( (key = malloc(strlen(path) + 24)) == NULL )
+        return(0);
+    sprintf(key, "%ld %s", (long)created_rev, path);
+
+    pthread_mutex_lock(&origin_lock);
+    found = apr_hash_get(origin_index, key, APR_HASH_KEY_STRING);
+    if( found && *found && (*origin = strdup(found)) == NULL )
+        found = NULL;
+    pthread_mutex_unlock(&origin_lock);
+    free(key);
+    return( found != NULL );
+}
+
+/*
+ * Records the origin of 'path', last changed in 'created_rev', as asked of
+ * the repository. 'origin' is NULL if it's 'path' itself.
+ */
+void origin_put(const char *path, svn_revnum_t created_rev,
+        const char *origin) {
+    pthread_mutex_lock(&origin_lock);
+    origin_stats.lookups++;
+    if( origin )
+        origin_stats.copies++;
+    if( origin_stats.entries >= ORIGIN_MAX )
+        origin_empty();
+    apr_hash_set(origin_index,
+            apr_psprintf(origin_pool, "%ld %s", (long)created_rev, path),
+            APR_HASH_KEY_STRING,
+            apr_pstrdup(origin_pool, origin ? origin : ""));
+    origin_stats.entries = apr_hash_count(origin_index);
+    pthread_mutex_unlock(&origin_lock);
+}
+
+/*
+ * Forgets every origin, because a path has been deleted or replaced and
+ * may have been copied again from somewhere else.
+ */
+void origin_clear(void) {
+    pthread_mutex_lock(&origin_lock);
+    origin_empty();
+    pthread_mutex_unlock(&origin_lock);
+}
+
+/* Counts an open of a file of 'size' bytes read from another's copy */
+void origin_count_file(apr_uint64_t size) {
+    pthread_mutex_lock(&origin_lock);
+    origin_stats.files++;
+    origin_stats.bytes += size;
+    pthread_mutex_unlock(&origin_lock);
+}
+
+void origin_count_listing(void) {
+    pthread_mutex_lock(&origin_lock);
+    origin_stats.listings++;
+    pthread_mutex_unlock(&origin_lock);
+}
+
+void origin_get_stats(struct origin_stats *stats) {
+    pthread_mutex_lock(&origin_lock);
+    *stats = origin_stats;
+    pthread_mutex_unlock(&origin_lock);
+}
@@ -0,0 +1,45 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_ORIGIN_H
+#define _HAVE_ORIGIN_H 1
+
+#include <apr.h>
+#include <svn_types.h>
+
+/* Origins remembered before they're all forgotten */
+#define ORIGIN_MAX 65536
+
+struct origin_stats {
+    apr_uint64_t lookups;       /* Origins asked of the repository */
+    apr_uint64_t copies;        /* ... which were another path */
+    apr_size_t entries;
+    apr_uint64_t files;         /* Opens read from another path's copy */
+    apr_uint64_t bytes;         /* ... the size of those files */
+    apr_uint64_t listings;      /* Directories given another's listing */
+};
+
+int origin_init(void);
+
+int origin_get(const char *path, svn_revnum_t created_rev, char **origin);
+
+void origin_put(const char *path, svn_revnum_t created_rev,
+        const char *origin);
+
+void origin_clear(void);
+
+void origin_count_file(apr_uint64_t size);
+
+void origin_count_listing(void);
+
+void origin_get_stats(struct origin_stats *stats);
+
+#endif /* ifndef _HAVE_ORIGIN_H */
@@ -0,0 +1,185 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "svnclient.h"
+#include "contentcache.h"
+#include "prefetch.h"
+#include <apr_hash.h>
+#include <pthread.h>
+
+/*
+ * Background prefetching of small files. Listing a directory is usually
+ * followed by reading most of the small files in it, so svnfs_readdir()
+ * queues those here and a few threads fetch them into the content cache
+ * before they're asked for.
+ *
+ * Prefetching only uses spare capacity: a thread won't start a fetch
+ * while any foreground read is waiting on the repository, and the queue
+ * is thrown away rather than let prefetched files evict ones which have
+ * actually been read. The threads are started by the first prefetch_queue()
+ * call, since FUSE forks into the background after svnfs is initialised.
+ */
+
+struct prefetch_job {
+    char *path;
+    svn_revnum_t rev;
+    apr_size_t size;
+};
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t prefetch_once = PTHREAD_ONCE_INIT;
+static apr_pool_t *prefetch_pool;
+static apr_hash_t *prefetch_pending;    /* path -> struct prefetch_job */
+static struct prefetch_job prefetch_jobs[PREFETCH_QUEUE_MAX];
+static int prefetch_head;
+static int prefetch_count;
+static int prefetch_busy;               /* Foreground fetches in progress */
+static apr_size_t prefetch_max_size;
+static int prefetch_threads;
+static struct prefetch_stats prefetch_stats;
+
+int prefetch_init(apr_size_t max_size, int threads) {
+    if( apr_pool_create(&prefetch_pool, NULL) != APR_SUCCESS )
+        return(1);
+    prefetch_pending = apr_hash_make(prefetch_pool);
+    prefetch_max_size = max_size;
+    prefetch_threads = threads;
+    return(0);
+}
+
+/* Removes the job at the head of the queue. The lock must be held. */
+static void prefetch_pop(struct prefetch_job *job) {
+    *job = prefetch_jobs[prefetch_head];
+    apr_hash_set(prefetch_pending, job->path, APR_HASH_KEY_STRING, NULL);
+    prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE_MAX;
+    prefetch_count--;
+}
+
+static void *prefetch_thread(void *arg) {
+    struct prefetch_job job;
+
+    (void)arg;
+
+    while( 1 ) {
+        pthread_mutex_lock(&prefetch_lock);
+        while( prefetch_count == 0 || prefetch_busy > 0 )
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        prefetch_pop(&job);
+        pthread_mutex_unlock(&prefetch_lock);
+
+        if( !contentcache_room(job.size) ) {
+            prefetch_cancel();
+            pthread_mutex_lock(&prefetch_lock);
+            prefetch_stats.cancelled++;
+            pthread_mutex_unlock(&prefetch_lock);
+        } else if( svnclient_prefetch(job.path, job.rev) ) {
+            pthread_mutex_lock(&prefetch_lock);
+            prefetch_stats.failed++;
+            pthread_mutex_unlock(&prefetch_lock);
+        } else {
+            pthread_mutex_lock(&prefetch_lock);
+            prefetch_stats.fetched++;
+            pthread_mutex_unlock(&prefetch_lock);
+        }
+        free(job.path);
+    }
+
+    return(NULL);
+}
+
+static void prefetch_start(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int i;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for( i = 0; i < prefetch_threads; i++ ) {
+        if( pthread_create(&thread, &attr, prefetch_thread, NULL) ) {
+            DEBUG("prefetch_start(): %s", strerror(errno));
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Queues 'path', of 'size' bytes and last changed in 'rev', to be fetched
+ * in the background if it's small enough and not already queued.
+ */
+void prefetch_queue(const char *path, svn_revnum_t rev, apr_size_t size) {
+    struct prefetch_job *job;
+
+    if( prefetch_threads == 0 || size == 0 || size > prefetch_max_size )
+        return;
+
+    pthread_once(&prefetch_once, prefetch_start);
+
+    pthread_mutex_lock(&prefetch_lock);
+    if( apr_hash_get(prefetch_pending, path, APR_HASH_KEY_STRING) ) {
+        pthread_mutex_unlock(&prefetch_lock);
+        return;
+    }
+    if( prefetch_count == PREFETCH_QUEUE_MAX ) {
+        prefetch_stats.dropped++;
+        pthread_mutex_unlock(&prefetch_lock);
+        return;
+    }
+
+    job = &prefetch_jobs[(prefetch_head + prefetch_count) % PREFETCH_QUEUE_MAX];
+    if( (job->path = strdup(path)) != NULL ) {
+        job->rev = rev;
+        job->size = size;
+        apr_hash_set(prefetch_pending, job->path, APR_HASH_KEY_STRING, job);
+        prefetch_count++;
+        prefetch_stats.queued++;
+        pthread_cond_signal(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/*
+ * Discards everything queued for prefetching.
+ */
+void prefetch_cancel(void) {
+    struct prefetch_job job;
+
+    pthread_mutex_lock(&prefetch_lock);
+    if( prefetch_count )
+        DEBUG("prefetch_cancel(): dropping %d files", prefetch_count);
+    prefetch_stats.cancelled += prefetch_count;
+    while( prefetch_count ) {
+        prefetch_pop(&job);
+        free(job.path);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/*
+ * Called with 1 before and -1 after a foreground fetch from the
+ * repository. Prefetches don't start while any are in progress.
+ */
+void prefetch_foreground(int delta) {
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch_busy += delta;
+    if( prefetch_busy == 0 && prefetch_count )
+        pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+void prefetch_get_stats(struct prefetch_stats *stats) {
+    pthread_mutex_lock(&prefetch_lock);
+    *stats = prefetch_stats;
+    pthread_mutex_unlock(&prefetch_lock);
+}
@@ -0,0 +1,39 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_PREFETCH_H
+#define _HAVE_PREFETCH_H 1
+
+#include <apr.h>
+#include <svn_types.h>
+
+/* Files waiting to be prefetched; more are dropped */
+#define PREFETCH_QUEUE_MAX 256
+
+struct prefetch_stats {
+    apr_uint64_t queued;
+    apr_uint64_t fetched;
+    apr_uint64_t dropped;       /* Queue was full */
+    apr_uint64_t cancelled;     /* Discarded because memory was tight */
+    apr_uint64_t failed;
+};
+
+int prefetch_init(apr_size_t max_size, int threads);
+
+void prefetch_queue(const char *path, svn_revnum_t rev, apr_size_t size);
+
+void prefetch_cancel(void);
+
+void prefetch_foreground(int delta);
+
+void prefetch_get_stats(struct prefetch_stats *stats);
+
+#endif /* ifndef _HAVE_PREFETCH_H */
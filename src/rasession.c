@@ -0,0 +1,189 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "svnclient.h"
+#include "rasession.h"
+#include "stats.h"
+#include <pthread.h>
+
+/*
+ * Pool of open RA sessions. Opening a session costs a connection and a
+ * handshake (or opening the repository for file://), so instead of letting
+ * every svn_client_* call open its own, requests borrow an idle session
+ * and hand it back when done. A session is only ever used by one thread at
+ * a time, and carries its own client context since the auth baton it was
+ * opened with is used for the rest of its life.
+ *
+ * A file:// repository is opened directly instead (see fsdirect.c), which
+ * has the same one thread at a time rule, so those handles are pooled
+ * here just the same.
+ *
+ * Sessions all stay rooted at svnfs.svnpath and are given relative paths,
+ * so they never need reparenting. One which has been idle for a while is
+ * checked before reuse, and one whose last request failed for any reason
+ * other than the node not existing is thrown away. That includes requests
+ * cancelled part way through, which may leave unread data on the
+ * connection; a repository opened directly has no connection, so it's
+ * kept, along with its cached revision root.
+ */
+
+static pthread_mutex_t rasession_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rasession *rasession_idle;
+static struct rasession_stats rasession_stats;
+
+static void rasession_count(apr_uint64_t *counter) {
+    pthread_mutex_lock(&rasession_lock);
+    (*counter)++;
+    pthread_mutex_unlock(&rasession_lock);
+}
+
+static void rasession_destroy(struct rasession *rs) {
+    svn_pool_destroy(rs->pool);
+    free(rs);
+}
+
+static svn_error_t *rasession_open(struct rasession **rsp) {
+    struct rasession *rs;
+    svn_error_t *err;
+
+    if( (rs = calloc(1, sizeof(struct rasession))) == NULL )
+        return(svn_error_create(SVN_ERR_FS_GENERAL, NULL, strerror(errno)));
+    rs->pool = svn_pool_create(NULL);
+    stats_ra(STATS_RA_OPEN);
+
+    if( fsdirect_usable() ) {
+        if( (err = fsdirect_open(&rs->direct, rs->pool)) ) {
+            rasession_destroy(rs);
+            return(err);
+        }
+        *rsp = rs;
+        return(SVN_NO_ERROR);
+    }
+
+    if( (err = svnclient_create_ctx(&rs->ctx, rs->pool)) ||
+            (err = svn_client_open_ra_session(&rs->session, svnfs.svnpath,
+                    rs->ctx, rs->pool)) ) {
+        rasession_destroy(rs);
+        return(err);
+    }
+
+    DEBUG("rasession_open(): opened a session to %s", svnfs.svnpath);
+    *rsp = rs;
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Returns true if 'err' says something about the request rather than
+ * about session 'rs' that made it.
+ */
+static int rasession_healthy(const struct rasession *rs, svn_error_t *err) {
+    if( err == SVN_NO_ERROR )
+        return(1);
+
+    switch(err->apr_err) {
+        case SVN_ERR_FS_NOT_FOUND:
+        case SVN_ERR_FS_NOT_FILE:
+        case SVN_ERR_FS_NOT_DIRECTORY:
+        case SVN_ERR_FS_NO_SUCH_REVISION:
+            return(1);
+        case SVN_ERR_CANCELLED:
+            return(rs->direct != NULL);
+        default:
+            return(0);
+    }
+}
+
+/*
+ * Borrows a session, opening a new one if none are idle.
+ */
+svn_error_t *rasession_get(struct rasession **rsp) {
+    struct rasession *rs;
+    svn_revnum_t youngest;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+
+    while( 1 ) {
+        pthread_mutex_lock(&rasession_lock);
+        if( (rs = rasession_idle) != NULL ) {
+            rasession_idle = rs->next;
+            rasession_stats.idle--;
+        }
+        pthread_mutex_unlock(&rasession_lock);
+
+        if( rs == NULL )
+            break;
+
+        /* There's no connection to a local repository to lose */
+        if( rs->direct || time(NULL) - rs->used < RASESSION_CHECK_AFTER ) {
+            rasession_count(&rasession_stats.reused);
+            *rsp = rs;
+            return(SVN_NO_ERROR);
+        }
+
+        /* The server may have dropped the connection in the meantime */
+        subpool = svn_pool_create(rs->pool);
+        stats_ra(STATS_RA_LATEST_REVNUM);
+        err = svn_ra_get_latest_revnum(rs->session, &youngest, subpool);
+        svn_pool_destroy(subpool);
+        if( err == SVN_NO_ERROR ) {
+            rasession_count(&rasession_stats.reused);
+            *rsp = rs;
+            return(SVN_NO_ERROR);
+        }
+
+        DEBUG("rasession_get(): discarding a stale session");
+        svn_error_clear(err);
+        rasession_destroy(rs);
+        rasession_count(&rasession_stats.discarded);
+    }
+
+    SVN_ERR(rasession_open(rsp));
+    rasession_count(&rasession_stats.opened);
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Hands back a session borrowed with rasession_get(), along with the
+ * result of the last request made with it. Returns 1 if the session was
+ * discarded because of that error, in which case the request is worth
+ * retrying once on a fresh session.
+ */
+int rasession_release(struct rasession *rs, svn_error_t *err) {
+    if( !rasession_healthy(rs, err) ) {
+        DEBUG("rasession_release(): discarding session after error %d",
+                err->apr_err);
+        rasession_destroy(rs);
+        rasession_count(&rasession_stats.discarded);
+        return(1);
+    }
+
+    rs->used = time(NULL);
+    pthread_mutex_lock(&rasession_lock);
+    if( rasession_stats.idle < RASESSION_MAX_IDLE ) {
+        rs->next = rasession_idle;
+        rasession_idle = rs;
+        rasession_stats.idle++;
+        rs = NULL;
+    }
+    pthread_mutex_unlock(&rasession_lock);
+
+    if( rs )
+        rasession_destroy(rs);
+    return(0);
+}
+
+void rasession_get_stats(struct rasession_stats *stats) {
+    pthread_mutex_lock(&rasession_lock);
+    *stats = rasession_stats;
+    pthread_mutex_unlock(&rasession_lock);
+}
@@ -0,0 +1,57 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_RASESSION_H
+#define _HAVE_RASESSION_H 1
+
+#include <time.h>
+
+#include <apr.h>
+#include <apr_pools.h>
+#include <svn_types.h>
+#include <svn_client.h>
+#include <svn_ra.h>
+
+#include "fsdirect.h"
+
+/* Idle sessions kept open for reuse */
+#define RASESSION_MAX_IDLE 8
+
+/* Seconds a session may sit idle before it's checked before reuse */
+#define RASESSION_CHECK_AFTER 30
+
+/* A long-lived RA session rooted at svnfs.svnpath. Paths given to it are
+ * relative to the root of the filesystem, without the leading '/'. For a
+ * file:// URL it's the repository opened directly instead, and only
+ * 'direct' is set */
+struct rasession {
+    svn_ra_session_t *session;
+    struct fsdirect *direct;
+    svn_client_ctx_t *ctx;      /* Owned by this session, for its auth */
+    apr_pool_t *pool;
+    time_t used;
+    struct rasession *next;
+};
+
+struct rasession_stats {
+    apr_uint64_t opened;
+    apr_uint64_t reused;
+    apr_uint64_t discarded;
+    apr_size_t idle;
+};
+
+svn_error_t *rasession_get(struct rasession **rsp);
+
+int rasession_release(struct rasession *rs, svn_error_t *err);
+
+void rasession_get_stats(struct rasession_stats *stats);
+
+#endif /* ifndef _HAVE_RASESSION_H */
@@ -0,0 +1,252 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "snapshot.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Snapshots of the dircache, so a remount starts with warm metadata
+ * instead of listing everything again. A snapshot is a header, then one
+ * fixed size record per node followed by its name, written out in a
+ * single pass over the tree and read back through mmap(). It records the
+ * revision the dircache was up to date with; on loading, svnfs replays the
+ * log since then with svnclient_catch_up().
+ *
+ * Snapshots are written to a temporary file and renamed into place, like
+ * the disk cache's files, so a crash never leaves a truncated one.
+ */
+
+static const char snapshot_pad[8];
+
+struct snapshot_write_baton {
+    FILE *fp;
+    apr_uint64_t count;         /* Nodes written so far */
+    apr_uint32_t parent;        /* Index of the node being expanded */
+};
+
+static int snapshot_write_node(void *baton, struct dirbuf *dp) {
+    struct snapshot_write_baton *wb = baton;
+    struct snapshot_node node;
+    apr_uint32_t parent = wb->parent;
+    int ret;
+
+    /* Revisions under /@rev are cheap to list again, and nothing reads
+     * them at mount */
+    if( dp->hidden )
+        return(0);
+
+    memset(&node, 0, sizeof(node));
+    node.parent = parent;
+    node.namelen = dp->namelen;
+    node.mode = dp->mode;
+    node.uid = dp->uid;
+    node.gid = dp->gid;
+    node.flags = dp->listed ? SNAPSHOT_LISTED : 0;
+    node.size = dp->size;
+    node.mtime = dp->mtime;
+    node.rev = dp->rev;
+
+    if( fwrite(&node, sizeof(node), 1, wb->fp) != 1 ||
+            fwrite(dp->name, 1, dp->namelen, wb->fp) != dp->namelen ||
+            fwrite(snapshot_pad, 1, SNAPSHOT_ALIGN(dp->namelen) - dp->namelen,
+                wb->fp) != SNAPSHOT_ALIGN(dp->namelen) - dp->namelen )
+        return(-1);
+
+    wb->parent = wb->count++;
+    ret = dircache_foreach(dp, snapshot_write_node, wb);
+    wb->parent = parent;
+    return(ret);
+}
+
+/*
+ * Writes a snapshot of the dircache to 'file'. Returns non-zero, having
+ * left any existing snapshot alone, on failure.
+ */
+int snapshot_write(const char *file) {
+    struct snapshot_write_baton wb;
+    struct snapshot_header header;
+    char *tmp;
+    int fd;
+    int ret;
+
+    if( (tmp = malloc(strlen(file) + 8)) == NULL )
+        return(1);
+    sprintf(tmp, "%s.XXXXXX", file);
+    if( (fd = mkstemp(tmp)) < 0 || (wb.fp = fdopen(fd, "w")) == NULL ) {
+        DEBUG("snapshot_write(): %s - %s", tmp, strerror(errno));
+        if( fd >= 0 ) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return(1);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byteorder = SNAPSHOT_BYTEORDER;
+    header.urllen = strlen(svnfs.svnpath);
+
+    wb.count = 0;
+    wb.parent = 0;
+
+    /* The header is written again once the count is known. Without a
+     * revision to catch up from, a snapshot would be no use */
+    dircache_rdlock();
+    header.rev = dircache_get_rev();
+    ret = (!SVN_IS_VALID_REVNUM(header.rev) ||
+            fwrite(&header, sizeof(header), 1, wb.fp) != 1 ||
+            fwrite(svnfs.svnpath, 1, header.urllen, wb.fp) != header.urllen ||
+            fwrite(snapshot_pad, 1, SNAPSHOT_ALIGN(header.urllen) -
+                header.urllen, wb.fp) != SNAPSHOT_ALIGN(header.urllen) -
+                header.urllen ||
+            snapshot_write_node(&wb, dircache_root()));
+    dircache_unlock();
+    header.count = wb.count;
+
+    if( ret || fseek(wb.fp, 0, SEEK_SET) ||
+            fwrite(&header, sizeof(header), 1, wb.fp) != 1 ||
+            fflush(wb.fp) || fsync(fd) ) {
+        DEBUG("snapshot_write(): writing %s - %s", tmp, strerror(errno));
+        ret = 1;
+    }
+    if( fclose(wb.fp) )
+        ret = 1;
+
+    if( ret || rename(tmp, file) ) {
+        unlink(tmp);
+        ret = 1;
+    } else {
+        DEBUG("snapshot_write(): %llu nodes at r%ld",
+                (unsigned long long)header.count, (long)header.rev);
+    }
+
+    free(tmp);
+    return(ret);
+}
+
+/*
+ * Checks that the 'count' nodes from 'p' fit within 'end' and each has a
+ * parent before it, so that loading them can't fail part way through.
+ */
+static int snapshot_check(const char *p, const char *end, apr_uint64_t count) {
+    const struct snapshot_node *node;
+    apr_uint64_t i;
+
+    for( i = 0; i < count; i++ ) {
+        node = (const struct snapshot_node *)p;
+        if( end - p < (ptrdiff_t)sizeof(*node) ||
+                (apr_uint64_t)(end - p - sizeof(*node)) <
+                    SNAPSHOT_ALIGN(node->namelen) )
+            return(1);
+        if( i == 0 ? node->namelen != 0 :
+                (node->parent >= i || node->namelen == 0 ||
+                 memchr(p + sizeof(*node), '/', node->namelen)) )
+            return(1);
+        p += sizeof(*node) + SNAPSHOT_ALIGN(node->namelen);
+    }
+    return(0);
+}
+
+/*
+ * Loads the snapshot in 'file' into the (empty) dircache, unless it's of
+ * another repository or newer than 'max_rev'. Returns the revision it's
+ * up to date with, or SVN_INVALID_REVNUM if nothing was loaded.
+ */
+svn_revnum_t snapshot_load(const char *file, svn_revnum_t max_rev) {
+    const struct snapshot_header *header;
+    const struct snapshot_node *node;
+    struct dirbuf **nodes = NULL;
+    struct dirbuf *dp;
+    struct stat st;
+    const char *map, *p, *end;
+    svn_revnum_t rev = SVN_INVALID_REVNUM;
+    apr_uint64_t i;
+    int fd;
+
+    if( (fd = open(file, O_RDONLY)) < 0 ) {
+        DEBUG("snapshot_load(): %s - %s", file, strerror(errno));
+        return(SVN_INVALID_REVNUM);
+    }
+    if( fstat(fd, &st) || st.st_size < sizeof(*header) ||
+            (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+                MAP_FAILED ) {
+        close(fd);
+        return(SVN_INVALID_REVNUM);
+    }
+    close(fd);
+
+    header = (const struct snapshot_header *)map;
+    end = map + st.st_size;
+    p = map + sizeof(*header) + SNAPSHOT_ALIGN(header->urllen);
+
+    if( memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+            header->byteorder != SNAPSHOT_BYTEORDER ||
+            header->urllen != strlen(svnfs.svnpath) || p > end ||
+            memcmp(map + sizeof(*header), svnfs.svnpath, header->urllen) ) {
+        DEBUG("snapshot_load(): %s isn't a snapshot of %s", file,
+                svnfs.svnpath);
+        goto snapshot_load_exit;
+    }
+    if( header->rev > max_rev || header->count == 0 ||
+            header->count > (apr_uint64_t)(end - p) / sizeof(*node) ||
+            snapshot_check(p, end, header->count) ) {
+        DEBUG("snapshot_load(): ignoring %s at r%ld", file,
+                (long)header->rev);
+        goto snapshot_load_exit;
+    }
+    if( (nodes = malloc(header->count * sizeof(struct dirbuf *))) == NULL )
+        goto snapshot_load_exit;
+
+    dircache_wrlock();
+    for( i = 0; i < header->count; i++ ) {
+        node = (const struct snapshot_node *)p;
+        p += sizeof(*node);
+
+        if( i == 0 ) {
+            dp = dircache_root();
+        } else {
+            /* Children of a node which couldn't be added are skipped */
+            if( nodes[node->parent] == NULL ||
+                    (dp = dircache_add_child(nodes[node->parent], p,
+                        node->namelen)) == NULL ) {
+                nodes[i] = NULL;
+                p += SNAPSHOT_ALIGN(node->namelen);
+                continue;
+            }
+            dp->mode = node->mode;
+            dp->uid = node->uid;
+            dp->gid = node->gid;
+            dp->size = node->size;
+            dp->mtime = node->mtime;
+            dp->rev = node->rev;
+        }
+        dp->listed = (node->flags & SNAPSHOT_LISTED) != 0;
+        nodes[i] = dp;
+
+        p += SNAPSHOT_ALIGN(node->namelen);
+    }
+    rev = header->rev;
+    dircache_set_rev(rev);
+    dircache_trim();
+    dircache_unlock();
+
+    DEBUG("snapshot_load(): %llu nodes at r%ld",
+            (unsigned long long)header->count, (long)rev);
+
+snapshot_load_exit:
+    free(nodes);
+    munmap((void *)map, st.st_size);
+    return(rev);
+}
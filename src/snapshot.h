@@ -0,0 +1,54 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_SNAPSHOT_H
+#define _HAVE_SNAPSHOT_H 1
+
+#include <apr.h>
+#include <svn_types.h>
+
+#define SNAPSHOT_MAGIC "SVNFSSN1"
+
+/* Records in a snapshot, and the names following them, are 8 byte aligned */
+#define SNAPSHOT_ALIGN(n) (((n) + 7) & ~((apr_size_t)7))
+
+/* Followed by the repository URL the snapshot is of, then the nodes */
+struct snapshot_header {
+    char magic[8];
+    apr_uint32_t byteorder;     /* SNAPSHOT_BYTEORDER as written */
+    apr_uint32_t urllen;
+    apr_int64_t rev;            /* Revision the metadata is up to date with */
+    apr_uint64_t count;         /* Number of nodes */
+};
+
+#define SNAPSHOT_BYTEORDER 0x01020304
+
+#define SNAPSHOT_LISTED 0x1
+
+/* One node, followed by its name. Nodes are in depth first order, so a
+ * node's parent always comes before it; the first is the root. */
+struct snapshot_node {
+    apr_uint32_t parent;        /* Index of the parent node */
+    apr_uint32_t namelen;
+    apr_uint32_t mode;
+    apr_uint32_t uid;
+    apr_uint32_t gid;
+    apr_uint32_t flags;
+    apr_int64_t size;
+    apr_int64_t mtime;
+    apr_int64_t rev;
+};
+
+svn_revnum_t snapshot_load(const char *file, svn_revnum_t max_rev);
+
+int snapshot_write(const char *file);
+
+#endif /* ifndef _HAVE_SNAPSHOT_H */
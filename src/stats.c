@@ -0,0 +1,341 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "stats.h"
+#include "contentcache.h"
+#include "diskcache.h"
+#include "blockcache.h"
+#include "negcache.h"
+#include "origin.h"
+#include "flight.h"
+#include "prefetch.h"
+#include "rasession.h"
+#include "inode.h"
+#include "writeback.h"
+#include <apr_atomic.h>
+#include <pthread.h>
+
+/*
+ * Live counters behind the virtual /.svnfs/stats file. Everything on the
+ * hot path is a single atomic increment, with no locks; the counters are
+ * 32 bits, so they wrap after about four billion events. The other caches
+ * keep their own statistics, which are only gathered when the file is
+ * opened.
+ *
+ * The file is plain "name value" lines, one per counter, so it can be
+ * scraped without a parser.
+ */
+
+struct stats_histogram {
+    volatile apr_uint32_t count;
+    volatile apr_uint32_t errors;
+    volatile apr_uint32_t buckets[STATS_BUCKETS];
+};
+
+static struct stats_histogram stats_ops[STATS_OPS];
+static volatile apr_uint32_t stats_ra_calls[STATS_RA_CALLS];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static apr_uint64_t stats_bytes;        /* Fetched from the repository */
+
+static const char *stats_op_names[STATS_OPS] = {
+    "getattr", "readdir", "open", "read", "write"
+};
+
+static const char *stats_ra_names[STATS_RA_CALLS] = {
+    "open", "stat", "get_dir", "get_file", "get_props", "latest_revnum",
+    "log", "repos_root", "dated_rev", "commit", "get_locations"
+};
+
+static const char *stats_flight_names[FLIGHT_KINDS] = { "list", "read" };
+
+void stats_start(struct timespec *start) {
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/*
+ * Counts a call of 'op' which started at 'start', and failed if 'err' is
+ * non-zero.
+ */
+void stats_op(enum stats_op op, const struct timespec *start, int err) {
+    struct timespec now;
+    apr_uint64_t usec;
+    int bucket = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usec = (apr_uint64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+        (now.tv_nsec - start->tv_nsec) / 1000;
+    while( usec > 1 && bucket < STATS_BUCKETS - 1 ) {
+        usec >>= 1;
+        bucket++;
+    }
+
+    apr_atomic_inc32(&stats_ops[op].count);
+    apr_atomic_inc32(&stats_ops[op].buckets[bucket]);
+    if( err )
+        apr_atomic_inc32(&stats_ops[op].errors);
+}
+
+void stats_ra(enum stats_ra call) {
+    apr_atomic_inc32(&stats_ra_calls[call]);
+}
+
+/*
+ * Counts file contents received from the repository. This is once per
+ * network buffer rather than per FUSE call, so a mutex is cheap enough to
+ * keep the total in 64 bits.
+ */
+void stats_fetched(apr_size_t bytes) {
+    pthread_mutex_lock(&stats_lock);
+    stats_bytes += bytes;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Returns the upper bound, in microseconds, of the bucket holding the
+ * 'percent'th percentile of 'buckets', or 0 if it's empty.
+ */
+static apr_uint64_t stats_percentile(const apr_uint32_t *buckets,
+        int percent) {
+    apr_uint64_t total = 0, seen = 0;
+    int i;
+
+    for( i = 0; i < STATS_BUCKETS; i++ )
+        total += buckets[i];
+    if( total == 0 )
+        return(0);
+
+    for( i = 0; i < STATS_BUCKETS - 1; i++ ) {
+        seen += buckets[i];
+        if( seen * 100 >= total * percent )
+            break;
+    }
+    return( (apr_uint64_t)2 << i );
+}
+
+struct stats_buf {
+    char *data;
+    size_t len;
+    size_t alloc;
+    int failed;
+};
+
+static void stats_printf(struct stats_buf *sb, const char *fmt, ...) {
+    va_list ap;
+    char *data;
+    int n;
+
+    while( !sb->failed ) {
+        va_start(ap, fmt);
+        n = vsnprintf(sb->data + sb->len, sb->alloc - sb->len, fmt, ap);
+        va_end(ap);
+        if( n >= 0 && sb->len + n < sb->alloc ) {
+            sb->len += n;
+            return;
+        }
+        if( (data = realloc(sb->data, sb->alloc * 2)) == NULL ) {
+            sb->failed = 1;
+            return;
+        }
+        sb->data = data;
+        sb->alloc *= 2;
+    }
+}
+
+/* Called by flight_top() with the keys waited on longest */
+static void stats_flight_func(void *baton, const char *key,
+        const struct flight_wait *wait) {
+    struct stats_buf *sb = baton;
+
+    stats_printf(sb, "flight.key.%s.waits %llu\n", key,
+            (unsigned long long)wait->waits);
+    stats_printf(sb, "flight.key.%s.wait_us %llu\n", key,
+            (unsigned long long)(wait->wait_ns / 1000));
+    stats_printf(sb, "flight.key.%s.max_us %llu\n", key,
+            (unsigned long long)(wait->max_ns / 1000));
+}
+
+/*
+ * Formats the current stats into a malloc()ed buffer, returned in *buf.
+ * Returns ENOMEM if there's no memory for it.
+ */
+int stats_render(char **buf, size_t *len) {
+    struct stats_buf sb;
+    struct dircache_stats ms;
+    struct contentcache_stats cs;
+    struct diskcache_stats ds;
+    struct blockcache_stats bs;
+    struct negcache_stats ns;
+    struct origin_stats os;
+    struct flight_stats fs;
+    struct prefetch_stats ps;
+    struct rasession_stats rs;
+    struct inode_stats is;
+    struct writeback_stats ws;
+    apr_uint32_t buckets[STATS_BUCKETS];
+    apr_uint64_t bytes;
+    int op, i;
+
+    sb.len = 0;
+    sb.alloc = 4096;
+    sb.failed = 0;
+    if( (sb.data = malloc(sb.alloc)) == NULL )
+        return(ENOMEM);
+
+    for( op = 0; op < STATS_OPS; op++ ) {
+        for( i = 0; i < STATS_BUCKETS; i++ )
+            buckets[i] = apr_atomic_read32(&stats_ops[op].buckets[i]);
+        stats_printf(&sb, "op.%s.count %lu\n", stats_op_names[op],
+                (unsigned long)apr_atomic_read32(&stats_ops[op].count));
+        stats_printf(&sb, "op.%s.errors %lu\n", stats_op_names[op],
+                (unsigned long)apr_atomic_read32(&stats_ops[op].errors));
+        stats_printf(&sb, "op.%s.p50_us %llu\n", stats_op_names[op],
+                (unsigned long long)stats_percentile(buckets, 50));
+        stats_printf(&sb, "op.%s.p99_us %llu\n", stats_op_names[op],
+                (unsigned long long)stats_percentile(buckets, 99));
+    }
+
+    for( i = 0; i < STATS_RA_CALLS; i++ )
+        stats_printf(&sb, "ra.%s %lu\n", stats_ra_names[i],
+                (unsigned long)apr_atomic_read32(&stats_ra_calls[i]));
+    pthread_mutex_lock(&stats_lock);
+    bytes = stats_bytes;
+    pthread_mutex_unlock(&stats_lock);
+    stats_printf(&sb, "ra.bytes_fetched %llu\n", (unsigned long long)bytes);
+    rasession_get_stats(&rs);
+    stats_printf(&sb, "ra.sessions.opened %llu\n",
+            (unsigned long long)rs.opened);
+    stats_printf(&sb, "ra.sessions.reused %llu\n",
+            (unsigned long long)rs.reused);
+    stats_printf(&sb, "ra.sessions.discarded %llu\n",
+            (unsigned long long)rs.discarded);
+    stats_printf(&sb, "ra.sessions.idle %lu\n", (unsigned long)rs.idle);
+
+    dircache_get_stats(&ms);
+    stats_printf(&sb, "meta.nodes %lu\n", (unsigned long)ms.nodes);
+    stats_printf(&sb, "meta.bytes %lu\n", (unsigned long)ms.bytes);
+    stats_printf(&sb, "meta.name_bytes %lu\n", (unsigned long)ms.names);
+    stats_printf(&sb, "meta.slab_bytes %lu\n", (unsigned long)ms.slabs);
+    stats_printf(&sb, "meta.limit %lu\n", (unsigned long)ms.limit);
+    stats_printf(&sb, "meta.evictions %llu\n",
+            (unsigned long long)ms.evictions);
+
+    contentcache_get_stats(&cs);
+    stats_printf(&sb, "content.hits %llu\n", (unsigned long long)cs.hits);
+    stats_printf(&sb, "content.misses %llu\n", (unsigned long long)cs.misses);
+    stats_printf(&sb, "content.evictions %llu\n",
+            (unsigned long long)cs.evictions);
+    stats_printf(&sb, "content.files %lu\n", (unsigned long)cs.entries);
+    stats_printf(&sb, "content.bytes %lu\n", (unsigned long)cs.bytes);
+    stats_printf(&sb, "content.limit %lu\n", (unsigned long)cs.limit);
+    stats_printf(&sb, "content.compressions %llu\n",
+            (unsigned long long)cs.compressions);
+    stats_printf(&sb, "content.promotions %llu\n",
+            (unsigned long long)cs.promotions);
+    stats_printf(&sb, "content.compressed.files %lu\n",
+            (unsigned long)cs.compressed);
+    stats_printf(&sb, "content.compressed.bytes %lu\n",
+            (unsigned long)cs.compressed_bytes);
+    stats_printf(&sb, "content.compressed.raw_bytes %lu\n",
+            (unsigned long)cs.compressed_len);
+    stats_printf(&sb, "content.compressed.ratio %.2f\n",
+            cs.compressed_bytes ?
+            (double)cs.compressed_len / cs.compressed_bytes : 0.0);
+    stats_printf(&sb, "content.inflate.reads %llu\n",
+            (unsigned long long)cs.inflates);
+    stats_printf(&sb, "content.inflate.ns_per_read %llu\n",
+            (unsigned long long)(cs.inflates ?
+                cs.inflate_ns / cs.inflates : 0));
+
+    diskcache_get_stats(&ds);
+    stats_printf(&sb, "disk.hits %llu\n", (unsigned long long)ds.hits);
+    stats_printf(&sb, "disk.misses %llu\n", (unsigned long long)ds.misses);
+    stats_printf(&sb, "disk.evictions %llu\n",
+            (unsigned long long)ds.evictions);
+    stats_printf(&sb, "disk.files %lu\n", (unsigned long)ds.entries);
+    stats_printf(&sb, "disk.bytes %llu\n", (unsigned long long)ds.bytes);
+    stats_printf(&sb, "disk.limit %llu\n", (unsigned long long)ds.limit);
+
+    blockcache_get_stats(&bs);
+    stats_printf(&sb, "block.hits %llu\n", (unsigned long long)bs.hits);
+    stats_printf(&sb, "block.misses %llu\n", (unsigned long long)bs.misses);
+    stats_printf(&sb, "block.evictions %llu\n",
+            (unsigned long long)bs.evictions);
+    stats_printf(&sb, "block.files %lu\n", (unsigned long)bs.entries);
+    stats_printf(&sb, "block.bytes %llu\n", (unsigned long long)bs.bytes);
+    stats_printf(&sb, "block.limit %llu\n", (unsigned long long)bs.limit);
+
+    negcache_get_stats(&ns);
+    stats_printf(&sb, "negative.hits %llu\n", (unsigned long long)ns.hits);
+    stats_printf(&sb, "negative.parent_hits %llu\n",
+            (unsigned long long)ns.parent_hits);
+    stats_printf(&sb, "negative.paths %lu\n", (unsigned long)ns.entries);
+
+    origin_get_stats(&os);
+    stats_printf(&sb, "origin.lookups %llu\n", (unsigned long long)os.lookups);
+    stats_printf(&sb, "origin.copies %llu\n", (unsigned long long)os.copies);
+    stats_printf(&sb, "origin.entries %lu\n", (unsigned long)os.entries);
+    stats_printf(&sb, "dedup.files %llu\n", (unsigned long long)os.files);
+    stats_printf(&sb, "dedup.bytes %llu\n", (unsigned long long)os.bytes);
+    stats_printf(&sb, "dedup.listings %llu\n",
+            (unsigned long long)os.listings);
+
+    flight_get_stats(&fs);
+    for( i = 0; i < FLIGHT_KINDS; i++ ) {
+        stats_printf(&sb, "flight.%s.requests %llu\n", stats_flight_names[i],
+                (unsigned long long)fs.flights[i]);
+        stats_printf(&sb, "flight.%s.waits %llu\n", stats_flight_names[i],
+                (unsigned long long)fs.kinds[i].waits);
+        stats_printf(&sb, "flight.%s.wait_us %llu\n", stats_flight_names[i],
+                (unsigned long long)(fs.kinds[i].wait_ns / 1000));
+        stats_printf(&sb, "flight.%s.max_us %llu\n", stats_flight_names[i],
+                (unsigned long long)(fs.kinds[i].max_ns / 1000));
+    }
+    stats_printf(&sb, "flight.keys %lu\n", (unsigned long)fs.keys);
+    flight_top(stats_flight_func, &sb);
+
+    inode_get_stats(&is);
+    stats_printf(&sb, "inode.lookups %llu\n", (unsigned long long)is.lookups);
+    stats_printf(&sb, "inode.forgets %llu\n", (unsigned long long)is.forgets);
+    stats_printf(&sb, "inode.entries %lu\n", (unsigned long)is.entries);
+
+    writeback_get_stats(&ws);
+    stats_printf(&sb, "write.commits %llu\n", (unsigned long long)ws.commits);
+    stats_printf(&sb, "write.failed %llu\n", (unsigned long long)ws.failed);
+    stats_printf(&sb, "write.paths %llu\n", (unsigned long long)ws.paths);
+    stats_printf(&sb, "write.bytes_written %llu\n",
+            (unsigned long long)ws.written);
+    stats_printf(&sb, "write.bytes_sent %llu\n", (unsigned long long)ws.sent);
+    stats_printf(&sb, "write.pending %lu\n", (unsigned long)ws.pending);
+
+    prefetch_get_stats(&ps);
+    stats_printf(&sb, "prefetch.queued %llu\n", (unsigned long long)ps.queued);
+    stats_printf(&sb, "prefetch.fetched %llu\n",
+            (unsigned long long)ps.fetched);
+    stats_printf(&sb, "prefetch.used %llu\n",
+            (unsigned long long)cs.prefetch_used);
+    stats_printf(&sb, "prefetch.unused %llu\n",
+            (unsigned long long)cs.prefetch_unused);
+    stats_printf(&sb, "prefetch.dropped %llu\n",
+            (unsigned long long)ps.dropped);
+    stats_printf(&sb, "prefetch.cancelled %llu\n",
+            (unsigned long long)ps.cancelled);
+    stats_printf(&sb, "prefetch.failed %llu\n", (unsigned long long)ps.failed);
+
+    if( sb.failed ) {
+        free(sb.data);
+        return(ENOMEM);
+    }
+    *buf = sb.data;
+    *len = sb.len;
+    return(0);
+}
@@ -0,0 +1,64 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_STATS_H
+#define _HAVE_STATS_H 1
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <apr.h>
+
+/* The virtual control directory, and the stats file within it */
+#define STATS_DIR "/.svnfs"
+#define STATS_FILE "/.svnfs/stats"
+
+/* Latencies are counted in power of two buckets of microseconds, the last
+ * holding everything from about 35 minutes up */
+#define STATS_BUCKETS 32
+
+/* FUSE operations timed */
+enum stats_op {
+    STATS_GETATTR,
+    STATS_READDIR,
+    STATS_OPEN,
+    STATS_READ,
+    STATS_WRITE,
+    STATS_OPS
+};
+
+/* Repository requests counted */
+enum stats_ra {
+    STATS_RA_OPEN,
+    STATS_RA_STAT,
+    STATS_RA_GET_DIR,
+    STATS_RA_GET_FILE,
+    STATS_RA_GET_PROPS,
+    STATS_RA_LATEST_REVNUM,
+    STATS_RA_LOG,
+    STATS_RA_REPOS_ROOT,
+    STATS_RA_DATED_REV,
+    STATS_RA_COMMIT,
+    STATS_RA_LOCATIONS,
+    STATS_RA_CALLS
+};
+
+void stats_start(struct timespec *start);
+
+void stats_op(enum stats_op op, const struct timespec *start, int err);
+
+void stats_ra(enum stats_ra call);
+
+void stats_fetched(apr_size_t bytes);
+
+int stats_render(char **buf, size_t *len);
+
+#endif /* ifndef _HAVE_STATS_H */
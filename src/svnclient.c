@@ -12,412 +12,1753 @@
 
 #include "svnfs.h"
 #include "svnclient.h"
+#include "contentcache.h"
+#include "diskcache.h"
+#include "idcache.h"
+#include "rasession.h"
+#include "prefetch.h"
+#include "negcache.h"
+#include "origin.h"
+#include "flight.h"
+#include "stats.h"
 #include <apr_tables.h>
 #include <apr_hash.h>
+#include <apr_strings.h>
+#include <svn_path.h>
+#include <svn_props.h>
+#include <svn_time.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <pthread.h>
+
+static pthread_key_t svnclient_thread_key;
+
+static pthread_mutex_t svnclient_prefix_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *svnclient_repos_prefix;
 
 /*
- * Returns the string value assigned to a property at a given path target (or NULL).
- * The return value of this function is volatile, you should copy it if you intend
- * to keep it around for any length of time.
+ * Returns the string value of 'propname' in a property hash, as handed to
+ * a proplist receiver, or NULL if it isn't set (or there are no props).
+ * The return value lives as long as the hash does.
  */
-void *svnclient_property_for_path(char *path, char *propname)
+const char *svnclient_property(apr_hash_t *props, const char *propname)
 {
-    svn_opt_revision_t *rev;
-    apr_hash_index_t *hi = NULL;
-    apr_hash_t *hashmap = NULL;
-    void *key;
-    void *data;
-    rev = malloc(sizeof(svn_opt_revision_t));
-
-    if ( rev != NULL ) {
-      rev->kind = svn_opt_revision_head;
-      // Get the ownership information from the svnfs: properties.
-      svn_client_propget(&hashmap,
-			 propname,
-			 path,
-			 rev,
-			 FALSE,
-			 ctx,
-			 pool);
-      if ( apr_hash_count(hashmap) < 1 )
-	return NULL;
-
-      hi = apr_hash_first(pool, hashmap);
-      if ( hi == NULL )
-	return NULL;
-      apr_hash_this(apr_hash_first(pool, hashmap), &key, NULL, &data);
-      free(rev);
-      return ((svn_string_t *)data)->data;
-    }
-}
-
-/*
- * Exec a shell command (via /bin/sh) and return its stdout
- */
-int svnclient_popen_output(char *cmd, char *buf, int readsize, int nreads)
-{
-  FILE *fp = popen(cmd, "r");
-  int reads = 0;
-  if ( fp == NULL )
-    return 0;
-  reads = fread(buf, readsize, nreads, fp);
-  pclose(fp);
-  return reads * readsize;
+  svn_string_t *value;
+
+  if ( props == NULL )
+    return NULL;
+  if ( (value = apr_hash_get(props, propname, APR_HASH_KEY_STRING)) == NULL )
+    return NULL;
+  return value->data;
 }
 
 /*
  * Places the uid for the given username in 'uid'.
  * If the username is not found, returns 1, meaning 'uid'
- * contains an invalid value (NULL).
+ * has not been set.
  */
-int svnclient_uid_for_username(char *username, int *uid)
+int svnclient_uid_for_username(const char *username, int *uid)
 {
-  int retcode = 1;
-  if ( uid == NULL )
+  uid_t id;
+  if ( uid == NULL || idcache_uid(username, &id) )
     return 1;
-  char *cmdbuf = malloc(1024);
-  if ( cmdbuf == NULL ) {
-    goto svnclient_uid_for_username_out_of_memory;
-  }
-  char *buf = malloc(256);
-  if ( buf == NULL ) {
-    free(cmdbuf);
-    goto svnclient_uid_for_username_out_of_memory;
-  }
-
-  sprintf(cmdbuf, "getent passwd %s", username);
-
-  if ( svnclient_popen_output(cmdbuf, buf, 1, 512) == 0 ) {
-    goto svnclient_uid_for_username_clean_exit;
-  }
-
-
-  char *tok = strtok(buf, ":");
-  tok = strtok(NULL, ":");
-  tok = strtok(NULL, ":");
-
-  *uid = strtol(tok, NULL, 10);
-  retcode = 0;
-
-  svnclient_uid_for_username_clean_exit:
-      free(buf);
-      free(cmdbuf);
-      return retcode;
-  svnclient_uid_for_username_out_of_memory:
-      DEBUG("Out of memory in svnclient_uid_for_username!");
-      *uid = 0;
-      return retcode;
+  *uid = id;
+  return 0;
 }
 
 /*
  * Places the gid for the given groupname in 'gid'.
  * If the groupname is not found, returns 1, meaning 'gid'
- * contains an invalid value (NULL).
+ * has not been set.
  */
-int svnclient_gid_for_groupname(char *groupname, int *gid)
+int svnclient_gid_for_groupname(const char *groupname, int *gid)
 {
-  int retcode = 1;
-  if ( gid == NULL )
+  gid_t id;
+  if ( gid == NULL || idcache_gid(groupname, &id) )
     return 1;
-  char *cmdbuf = malloc(1024);
-  if ( cmdbuf == NULL ) {
-    goto svnclient_gid_for_groupname_out_of_memory;
-  }
-  char *buf = malloc(256);
-  if ( buf == NULL ) {
-    free(cmdbuf);
-    goto svnclient_gid_for_groupname_out_of_memory;
-  }
-
-  sprintf(cmdbuf, "getent group %s", groupname);
-
-  if ( svnclient_popen_output(cmdbuf, buf, 1, 512) == 0 ) {
-    goto svnclient_gid_for_groupname_clean_exit;
-  }
-
-  char *tok = strtok(buf, ":");
-  tok = strtok(NULL, ":");
-  tok = strtok(NULL, ":");
-
-  *gid = strtol(tok, NULL, 10);
-  retcode = 0;
-
-  svnclient_gid_for_groupname_clean_exit:
-      free(buf);
-      free(cmdbuf);
-      return retcode;
-  svnclient_gid_for_groupname_out_of_memory:
-      DEBUG("Out of memory in svnclient_gid_for_groupname!");
-      *gid = 0;
-      return retcode;
+  *gid = id;
+  return 0;
 }
 
 /*
- * Returns the file mode for the given path
+ * Returns the file mode according to svnfs:mode in 'props'
  */
-int svnclient_mode_for_path(char *path)
+int svnclient_mode_for_props(apr_hash_t *props)
 {
-  char *mode = NULL;
-  if ( (mode = svnclient_property_for_path(path, "svnfs:mode")) != NULL)
-    return strtol(mode, NULL, 8);
+  const char *mode = NULL;
+  if ( (mode = svnclient_property(props, "svnfs:mode")) != NULL)
+    return strtol(mode, NULL, 8) & 07777;
   return 0775;
 }
 
 /*
- * Returns the uid of the owner for the given path according to svnfs:owner_user
+ * Returns the uid of the owner according to svnfs:owner_user in 'props'
  */
-int svnclient_uid_for_path(char *path)
+int svnclient_uid_for_props(apr_hash_t *props)
 {
-  char *username = NULL;
+  const char *username = NULL;
   int uid = 0;
-  if ( (username = svnclient_property_for_path(path, "svnfs:owner_user")) != NULL ) {
-    svnclient_uid_for_username(username, &uid);
+  if ( (username = svnclient_property(props, "svnfs:owner_user")) != NULL ) {
+    if ( svnclient_uid_for_username(username, &uid) && svnfs.unknown_uid >= 0 )
+      return svnfs.unknown_uid;
     return uid;
   }
   return 0;
 }
 
 /*
- * Returns the gid of the owner for the given path according to svnfs:owner_group
+ * Returns the gid of the owner according to svnfs:owner_group in 'props'
  */
-int svnclient_gid_for_path(char *path)
+int svnclient_gid_for_props(apr_hash_t *props)
 {
-  char *groupname = NULL;
+  const char *groupname = NULL;
   int gid = 0;
-  if ( (groupname = svnclient_property_for_path(path, "svnfs:owner_group")) != NULL) {
-    svnclient_gid_for_groupname(groupname, &gid);
+  if ( (groupname = svnclient_property(props, "svnfs:owner_group")) != NULL) {
+    if ( svnclient_gid_for_groupname(groupname, &gid) && svnfs.unknown_gid >= 0 )
+      return svnfs.unknown_gid;
     return gid;
   }
   return 0;
 }
 
-int svnclient_setup_ctx() {
+/*
+ * Fills in the owner, group and permission bits of a listed entry from its
+ * svnfs:* properties. A NULL 'props' gives the defaults.
+ */
+static void svnclient_entry_from_props(struct svnclient_entry *entry,
+        apr_hash_t *props)
+{
+    entry->uid = svnclient_uid_for_props(props);
+    entry->gid = svnclient_gid_for_props(props);
+    entry->mode = svnclient_mode_for_props(props);
+}
+
+/*
+ * Creates a client context (with its own auth baton) in 'pool'.
+ */
+svn_error_t *svnclient_create_ctx(svn_client_ctx_t **ctxp,
+        apr_pool_t *pool) {
+    svn_client_ctx_t *ctx;
     svn_auth_baton_t *auth_baton;
     apr_array_header_t *providers;
     svn_auth_provider_object_t *username_wc_provider;
+
+    /* Create a client context object */
+    SVN_ERR(svn_client_create_context(&ctx, pool));
+
+    SVN_ERR(svn_config_get_config(&(ctx->config), NULL, pool));
+
+    providers = apr_array_make(pool, 1, sizeof(svn_auth_provider_object_t *));
+    username_wc_provider = apr_pcalloc(pool, sizeof(*username_wc_provider));
+    svn_client_get_username_provider(&username_wc_provider, pool);
+    *(svn_auth_provider_object_t **)apr_array_push(providers)
+        = username_wc_provider;
+    svn_auth_open(&auth_baton, providers, pool);
+    ctx->auth_baton = auth_baton;
+
+    *ctxp = ctx;
+    return(SVN_NO_ERROR);
+}
+
+static void svnclient_thread_destroy(void *data) {
+    struct svnclient_thread *thread = data;
+
+    svn_pool_destroy(thread->pool);
+    free(thread);
+}
+
+/*
+ * Returns the calling thread's client context and pool, creating them the
+ * first time round. Neither a client context nor an APR pool may be used
+ * by two threads at once, so each FUSE worker thread gets its own. All
+ * allocations for a request should be made in a subpool of thread->pool,
+ * which is destroyed when the request is done.
+ */
+struct svnclient_thread *svnclient_thread(void) {
+    struct svnclient_thread *thread;
+    svn_error_t *err;
+    char errbuf[1024];
+
+    if( (thread = pthread_getspecific(svnclient_thread_key)) != NULL )
+        return(thread);
+
+    if( (thread = calloc(1, sizeof(struct svnclient_thread))) == NULL )
+        return(NULL);
+    thread->pool = svn_pool_create(NULL);
+    if( (err = svnclient_create_ctx(&thread->ctx, thread->pool)) ) {
+        DEBUG("svnclient_thread(): %s",
+                svn_strerror(err->apr_err, errbuf, sizeof(errbuf)));
+        svn_error_clear(err);
+        svnclient_thread_destroy(thread);
+        return(NULL);
+    }
+    pthread_setspecific(svnclient_thread_key, thread);
+
+    return(thread);
+}
+
+int svnclient_setup_ctx() {
     svn_error_t *err;
+    svn_client_ctx_t *ctx;
     char errbuf[1024];
 
     /* Initialise a pool */
     apr_initialize();
-    pool = svn_pool_create(pool);
+    pool = svn_pool_create(NULL);
 
-    /* Initialise errbuf */
-    memset(&errbuf, '\0', 1024);
+    if( pthread_key_create(&svnclient_thread_key, svnclient_thread_destroy) ) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        return(1);
+    }
 
-    /* Create a client context object */
-    if( (err = svn_client_create_context(&ctx, pool)) ) {
+    /* Create a client context object here too, so that any problem with
+     * the configuration is reported before mounting */
+    if( (err = svnclient_create_ctx(&ctx, pool)) ) {
         fprintf(stderr, "%s\n", svn_strerror(err->apr_err, errbuf, 1024));
         return(1);
     }
 
-    if( (err = (svn_error_t *)svn_config_get_config(
-                    &(ctx->config), NULL, pool)) ) {
+    return(0);
+}
+
+/*
+ * Places the UUID of the repository in 'uuid', allocated in the global pool.
+ */
+int svnclient_uuid(const char **uuid) {
+    struct svnclient_thread *thread;
+    svn_error_t *err;
+    char errbuf[1024];
+
+    if( (thread = svnclient_thread()) == NULL )
+        return(1);
+    if( (err = svn_client_uuid_from_url(uuid, svnfs.svnpath, thread->ctx,
+                    pool)) ) {
         fprintf(stderr, "%s\n", svn_strerror(err->apr_err, errbuf, 1024));
+        svn_error_clear(err);
         return(1);
     }
+    return(0);
+}
 
-    providers = apr_array_make(pool, 1, sizeof(svn_auth_provider_object_t *));
-    username_wc_provider = apr_pcalloc(pool, sizeof(*username_wc_provider));
-    svn_client_get_username_provider(&username_wc_provider, pool);
-    *(svn_auth_provider_object_t **)apr_array_push(providers)
-        = username_wc_provider;
-    svn_auth_open(&auth_baton, providers, pool);
-    ctx->auth_baton = auth_baton;
+/*
+ * Returns 1 if the dircache follows HEAD through the poller, in which case
+ * everything is fetched at the revision it's up to date with.
+ */
+static int svnclient_polling(void) {
+    return( !SVN_IS_VALID_REVNUM(svnfs.rev) && svnfs.poll_interval > 0 );
+}
 
-    return(0);
+/*
+ * Returns the revision every operation works against: the one the
+ * filesystem was pinned to with -o rev=, or that the poller has caught the
+ * dircache up to, otherwise SVN_INVALID_REVNUM, meaning HEAD.
+ */
+svn_revnum_t svnclient_revnum(void) {
+    svn_revnum_t rev;
+
+    if( SVN_IS_VALID_REVNUM(svnfs.rev) )
+        return(svnfs.rev);
+    if( !svnclient_polling() )
+        return(SVN_INVALID_REVNUM);
+
+    dircache_rdlock();
+    rev = dircache_get_rev();
+    dircache_unlock();
+    return(rev);
 }
 
-static svn_error_t *_svnclient_list_func(void *baton, const char *path,
-        const svn_dirent_t *dirent, const svn_lock_t *lock,
-        const char *abs_path, apr_pool_t *pool) {
-    svn_error_t *retval = SVN_NO_ERROR;
+/*
+ * Returns 1 if 'path' is under /@rev/N, placing N in *rev and the rest of
+ * the path (eg. "/trunk", or "" for the revision's root) in *rest. Returns
+ * -1 if it's under /@rev but N isn't a revision number, and 0 otherwise.
+ * 'rev' and 'rest' may be NULL.
+ */
+int svnclient_history(const char *path, svn_revnum_t *rev, const char **rest) {
+    size_t len = strlen(SVNCLIENT_REV_DIR);
+    char *end;
+    long n;
+
+    if( strncmp(path, SVNCLIENT_REV_DIR, len) || path[len] != '/' )
+        return(0);
+    if( !isdigit((unsigned char)path[len + 1]) )
+        return(-1);
+    n = strtol(path + len + 1, &end, 10);
+    if( *end != '\0' && *end != '/' )
+        return(-1);
+
+    if( rev )
+        *rev = n;
+    if( rest )
+        *rest = end;
+    return(1);
+}
+
+/*
+ * Returns the /@rev directory, creating it if need be. It holds whichever
+ * revisions have been looked at, and isn't part of the repository, so
+ * it's hidden from the root's listing. The lock must be held exclusively.
+ */
+static struct dirbuf *svnclient_history_dir(void) {
     struct dirbuf *dp;
-    char *abspath;
-    char *fullpath;
-    int slash_idx;
-    char found = 0;
-    struct svnfs_attr *attr = (struct svnfs_attr *)baton;
-
-    /* The first 'path' argument is blank, meaning it's the details for
-     * attr->path. If path length is 0 and attr->path length is 1, then
-     * we're listing the '/' of the filesystem, for which a static
-     * dirent is returned from svnfs_getattr(), so skip it */
-    if( (strlen(path) == 0) && (strlen(attr->path) == 1) )
+
+    if( (dp = dircache_add(SVNCLIENT_REV_DIR)) != NULL && !dp->hidden ) {
+        dp->hidden = 1;
+        dp->mode = S_IFDIR | 0555;
+        dp->mtime = svnfs.mnttime.tv_sec;
+    }
+    return(dp);
+}
+
+/* Returns 1 if 'from' is a listing 'dp' can be given instead of its own */
+static int svnclient_same_dir(const struct dirbuf *dp,
+        const struct dirbuf *from) {
+    return( from != dp && from->listed && !from->hidden &&
+            S_ISDIR(from->mode) && from->rev == dp->rev );
+}
+
+struct svnclient_twin_baton {
+    const struct dirbuf *dp;
+    const char *rest;
+    struct dirbuf *from;
+};
+
+static int svnclient_twin_func(void *baton, struct dirbuf *child) {
+    struct svnclient_twin_baton *tb = baton;
+    struct dirbuf *from;
+    char *path;
+
+    if( (path = malloc(strlen(SVNCLIENT_REV_DIR) + child->namelen +
+                    strlen(tb->rest) + 2)) == NULL )
+        return(0);
+    sprintf(path, "%s/%s%s", SVNCLIENT_REV_DIR, child->name, tb->rest);
+    from = dircache_lookup(path);
+    free(path);
+
+    if( from && svnclient_same_dir(tb->dp, from) ) {
+        tb->from = from;
+        return(1);
+    }
+    return(0);
+}
+
+/*
+ * Finds a listed copy of directory 'dp', which is 'rest' under one of the
+ * /@rev directories. A directory's last changed revision covers everything
+ * in it, so the same path with the same one, at HEAD or another revision,
+ * has the same children. The lock must be held exclusively.
+ */
+static struct dirbuf *svnclient_twin(const struct dirbuf *dp,
+        const char *rest) {
+    struct svnclient_twin_baton tb;
+    struct dirbuf *from, *history;
+
+    /* HEAD only shows a single revision when pinned or polled */
+    if( (SVN_IS_VALID_REVNUM(svnfs.rev) || svnclient_polling()) &&
+            (from = dircache_lookup(*rest ? rest : "/")) != NULL &&
+            svnclient_same_dir(dp, from) )
+        return(from);
+
+    if( (history = dircache_lookup(SVNCLIENT_REV_DIR)) == NULL )
+        return(NULL);
+    tb.dp = dp;
+    tb.rest = rest;
+    tb.from = NULL;
+    dircache_foreach(history, svnclient_twin_func, &tb);
+    return(tb.from);
+}
+
+static char *svnclient_origin(const char *path, svn_revnum_t rev,
+        svn_revnum_t created_rev);
+
+/*
+ * Lists directory 'path' without asking the repository, if its parent's
+ * listing gave its last changed revision and a directory with the same
+ * one has been listed already: at 'rest' (its path in the repository,
+ * which is 'path' unless it's under /@rev/N), or failing that at its
+ * origin, as for anything in a tag or branch unchanged since it was
+ * copied. 'rev' is the revision it's being listed at. Returns non-zero if
+ * it has to be listed the usual way.
+ */
+static int svnclient_share(const char *path, const char *rest,
+        svn_revnum_t rev, struct stat *st) {
+    struct dirbuf *dp, *from;
+    svn_revnum_t created_rev = 0;
+    char *origin = NULL;
+    int ret = 1;
+
+    while( 1 ) {
+        dircache_wrlock();
+        if( (dp = dircache_lookup(path)) != NULL && S_ISDIR(dp->mode) &&
+                !dp->listed && dp->rev > 0 &&
+                (origin == NULL || dp->rev == created_rev) ) {
+            created_rev = dp->rev;
+            if( (from = svnclient_twin(dp, origin ? origin : rest)) != NULL &&
+                    dircache_copy_children(dp, from) == 0 ) {
+                DEBUG("svnclient_share(): %s shares %s's r%ld listing",
+                        path, origin ? origin : rest, (long)dp->rev);
+                if( origin )
+                    origin_count_listing();
+                if( st )
+                    dircache_stat(dp, st);
+                dircache_trim();
+                ret = 0;
+            }
+        } else {
+            created_rev = 0;
+        }
+        dircache_unlock();
+
+        /* Asking where it came from means dropping the lock */
+        if( ret == 0 || origin || created_rev <= 0 || *rest == '\0' ||
+                (origin = svnclient_origin(rest, rev, created_rev)) == NULL )
+            break;
+    }
+    free(origin);
+    return(ret);
+}
+
+/*
+ * Returns 'path' (eg. "/trunk/README") relative to the root of the RA
+ * sessions, ie. without leading or trailing '/'s.
+ */
+static const char *svnclient_relpath(const char *path, apr_pool_t *pool) {
+    char *relpath;
+
+    while( *path == '/' )
+        path++;
+    relpath = apr_pstrdup(pool, path);
+    while( strlen(relpath) && relpath[strlen(relpath)-1] == '/' )
+        relpath[strlen(relpath)-1] = '\0';
+    return(relpath);
+}
+
+/*
+ * Records one node of a listing; 'name' is relative to the listed path
+ * and blank for the listed path itself.
+ */
+static struct svnclient_entry *svnclient_add_entry(struct svnfs_attr *attr,
+        const char *name, const svn_dirent_t *dirent) {
+    struct svnclient_entry *entry;
+
+    entry = apr_pcalloc(attr->pool, sizeof(struct svnclient_entry));
+    entry->name = apr_pstrdup(attr->pool, name);
+
+    if( strlen(name) == 0 )
+        entry->path = attr->path;
+    else if( strlen(attr->path) == 1 )
+        entry->path = apr_pstrcat(attr->pool, "/", name, NULL);
+    else
+        entry->path = apr_pstrcat(attr->pool, attr->path, "/", name, NULL);
+
+    DEBUG("svnclient_add_entry(): %s", entry->path);
+
+    entry->kind = dirent->kind;
+    entry->size = dirent->size;
+    entry->time = dirent->time;
+    entry->created_rev = dirent->created_rev;
+
+    /* Ownership and mode come from the svnfs:* properties, if there are
+     * any, otherwise use the defaults */
+    svnclient_entry_from_props(entry, NULL);
+
+    APR_ARRAY_PUSH(attr->entries, struct svnclient_entry *) = entry;
+    return(entry);
+}
+
+/*
+ * Fetches the properties of a node which has some and applies them to its
+ * entry. Only nodes which have properties cost a request.
+ */
+static svn_error_t *svnclient_fetch_props(svn_ra_session_t *session,
+        struct svnclient_entry *entry, const char *relpath,
+        svn_revnum_t revnum, apr_pool_t *pool) {
+    apr_hash_t *props;
+
+    stats_ra(STATS_RA_GET_PROPS);
+    if( entry->kind == svn_node_dir )
+        SVN_ERR(svn_ra_get_dir2(session, NULL, NULL, &props, relpath, revnum,
+                    0, pool));
+    else
+        SVN_ERR(svn_ra_get_file(session, relpath, revnum, NULL, NULL, &props,
+                    pool));
+    svnclient_entry_from_props(entry, props);
+
+    return(SVN_NO_ERROR);
+}
+
+/* Slashes in a URL, not counting a trailing one */
+static int svnclient_url_depth(const char *url) {
+    int depth = 0;
+
+    for( ; *url; url++ )
+        if( *url == '/' && url[1] )
+            depth++;
+    return(depth);
+}
+
+/* Children of a directory still waiting on their properties */
+struct svnclient_props_baton {
+    apr_hash_t *pending;        /* name -> struct svnclient_entry */
+    int depth;                  /* svnclient_url_depth() of the directory */
+};
+
+/* Hands each child reported by svn_client_proplist3() its properties */
+static svn_error_t *svnclient_props_receiver(void *baton, const char *path,
+        apr_hash_t *props, apr_pool_t *pool) {
+    struct svnclient_props_baton *pb = baton;
+    struct svnclient_entry *entry;
+    const char *name;
+
+    /* The directory itself had its properties along with its entries */
+    if( svnclient_url_depth(path) <= pb->depth ||
+            (name = strrchr(path, '/')) == NULL )
         return(SVN_NO_ERROR);
+    name = svn_path_uri_decode(name + 1, pool);
+    if( (entry = apr_hash_get(pb->pending, name, APR_HASH_KEY_STRING)) ) {
+        svnclient_entry_from_props(entry, props);
+        apr_hash_set(pb->pending, entry->name, APR_HASH_KEY_STRING, NULL);
+    }
+    return(SVN_NO_ERROR);
+}
 
-    /* path is a file under the directory */
-    if( (strlen(path) > 0) && (strlen(attr->path) > 1) ) {
-        if( (fullpath = malloc((sizeof(char)) *
-                        (strlen(attr->path) + strlen(path) + 2))) == NULL )
-            return(svn_error_create(SVN_ERR_FS_GENERAL, NULL, strerror(errno)));
-        sprintf(fullpath, "%s/%s", attr->path, path);
-    } else {
-        if( (fullpath = malloc((sizeof(char)) *
-                        (strlen(attr->path) + strlen(path) + 1))) == NULL )
-            return(svn_error_create(SVN_ERR_FS_GENERAL, NULL, strerror(errno)));
-        sprintf(fullpath, "%s%s", attr->path, path);
+/*
+ * Fetches the properties of the children of directory 'relpath' in
+ * 'pending' with a single request for the lot. Any it doesn't account for
+ * are left in 'pending'.
+ */
+static svn_error_t *svnclient_batch_props(struct rasession *rs,
+        apr_hash_t *pending, const char *relpath, svn_revnum_t revnum,
+        apr_pool_t *pool) {
+    struct svnclient_props_baton pb;
+    svn_opt_revision_t rev;
+    const char *url;
+
+    url = *relpath ? svn_path_url_add_component(svnfs.svnpath, relpath, pool) :
+        svnfs.svnpath;
+    rev.kind = svn_opt_revision_number;
+    rev.value.number = revnum;
+    pb.pending = pending;
+    pb.depth = svnclient_url_depth(url);
+
+    stats_ra(STATS_RA_GET_PROPS);
+    return(svn_client_proplist3(url, &rev, &rev, svn_depth_immediates, NULL,
+                svnclient_props_receiver, &pb, rs->ctx, pool));
+}
+
+/*
+ * Lists 'relpath' into 'attr': the node itself and, for a directory, each
+ * of its children, along with their svnfs:* properties. Those of the
+ * children come in one request for the directory when several have any,
+ * and a request apiece only when that fails.
+ */
+static svn_error_t *svnclient_ra_list(struct rasession *rs,
+        struct svnfs_attr *attr, const char *relpath, svn_revnum_t revnum) {
+    apr_uint32_t dirent_fields = SVN_DIRENT_KIND | SVN_DIRENT_SIZE |
+        SVN_DIRENT_TIME | SVN_DIRENT_CREATED_REV | SVN_DIRENT_HAS_PROPS;
+    svn_ra_session_t *session = rs->session;
+    svn_dirent_t *dirent;
+    apr_hash_t *dirents;
+    apr_hash_t *props;
+    apr_hash_t *pending;
+    apr_hash_index_t *hi;
+    struct svnclient_entry *target, *entry;
+    const void *key;
+    void *val;
+    apr_pool_t *iterpool;
+    svn_error_t *err;
+
+    stats_ra(STATS_RA_STAT);
+    SVN_ERR(svn_ra_stat(session, relpath, revnum, &dirent, attr->pool));
+    if( dirent == NULL )
+        return(svn_error_create(SVN_ERR_FS_NOT_FOUND, NULL, relpath));
+    target = svnclient_add_entry(attr, "", dirent);
+
+    if( dirent->kind != svn_node_dir ) {
+        if( dirent->has_props )
+            SVN_ERR(svnclient_fetch_props(session, target, relpath, revnum,
+                        attr->pool));
+        return(SVN_NO_ERROR);
     }
 
-    if( (abspath = malloc(strlen(svnfs.svnpath) + strlen(fullpath) + 1)) == NULL )
-        return(EIO);
-    sprintf(abspath, "%s%s", svnfs.svnpath, fullpath);
-    while( abspath[strlen(abspath)-1] == '/' )
-        abspath[strlen(abspath)-1] = '\0';
-
-    DEBUG("_svnclient_list_func(): abspath %s from %s", abspath, fullpath);
-
-    slash_idx = (strlen(fullpath) - strlen(rindex(fullpath, '/')));
-
-    /* If this file is already in the dirbuf cache, update stats */
-    dp = first;
-    // FIXME: Refactor this loop out into a generic function that returns
-    // dp when it's already in the cache, NULL otherwise before this becomes
-    // a bad pattern.
-    while( dp && dp->name ) {
-        if( dp->name[slash_idx] != '/' ) {
-            dp = dp->next;
+    /* The directory's own properties come with its entries */
+    stats_ra(STATS_RA_GET_DIR);
+    SVN_ERR(svn_ra_get_dir2(session, &dirents, NULL,
+                dirent->has_props ? &props : NULL, relpath, revnum,
+                dirent_fields, attr->pool));
+    if( dirent->has_props )
+        svnclient_entry_from_props(target, props);
+
+    pending = apr_hash_make(attr->pool);
+    for( hi = apr_hash_first(attr->pool, dirents); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, &key, NULL, &val);
+        dirent = val;
+        entry = svnclient_add_entry(attr, key, dirent);
+        if( dirent->has_props )
+            apr_hash_set(pending, entry->name, APR_HASH_KEY_STRING, entry);
+    }
+
+    if( apr_hash_count(pending) >= SVNCLIENT_BATCH_PROPS &&
+            (err = svnclient_batch_props(rs, pending, relpath, revnum,
+                    attr->pool)) ) {
+        DEBUG("svnclient_ra_list(): fetching the properties in '%s' one "
+                "at a time: %s", relpath,
+                err->message ? err->message : "unknown error");
+        svn_error_clear(err);
+    }
+
+    iterpool = svn_pool_create(attr->pool);
+    for( hi = apr_hash_first(attr->pool, pending); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, &key, NULL, &val);
+        svn_pool_clear(iterpool);
+        SVN_ERR(svnclient_fetch_props(session, val,
+                    apr_pstrcat(iterpool, relpath, *relpath ? "/" : "",
+                        (const char *)key, NULL),
+                    revnum, iterpool));
+    }
+    svn_pool_destroy(iterpool);
+
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * svnclient_ra_list() for a repository opened directly. The properties of
+ * each node come along with it rather than costing a request of their own.
+ */
+static svn_error_t *svnclient_fs_list(struct fsdirect *fd,
+        struct svnfs_attr *attr, const char *relpath, svn_revnum_t revnum) {
+    svn_dirent_t *dirent;
+    apr_hash_t *dirents;
+    apr_hash_t *props, *child_props;
+    apr_hash_index_t *hi;
+    struct svnclient_entry *target, *entry;
+    const void *key;
+    void *val;
+
+    stats_ra(STATS_RA_STAT);
+    SVN_ERR(fsdirect_stat(fd, relpath, revnum, &dirent, &props, attr->pool));
+    if( dirent == NULL )
+        return(svn_error_create(SVN_ERR_FS_NOT_FOUND, NULL, relpath));
+    target = svnclient_add_entry(attr, "", dirent);
+    if( props )
+        svnclient_entry_from_props(target, props);
+    if( dirent->kind != svn_node_dir )
+        return(SVN_NO_ERROR);
+
+    stats_ra(STATS_RA_GET_DIR);
+    SVN_ERR(fsdirect_get_dir(fd, relpath, revnum, &dirents, &child_props,
+                attr->pool));
+    for( hi = apr_hash_first(attr->pool, dirents); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, &key, NULL, &val);
+        entry = svnclient_add_entry(attr, key, val);
+        if( (props = apr_hash_get(child_props, key, APR_HASH_KEY_STRING)) )
+            svnclient_entry_from_props(entry, props);
+    }
+
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Adds (or updates) the collected entries of a listing in the dircache,
+ * and copies the stats of the listed node to 'st'. Returns 1 if the
+ * listing didn't include the node itself, and -1 if it was made at a
+ * revision the dircache has since been caught up past.
+ */
+static int svnclient_apply(struct svnfs_attr *attr, struct stat *st) {
+    struct svnclient_entry *entry;
+    struct dirbuf *dp;
+    struct dirbuf *target = NULL;
+    apr_uint32_t gen;
+    int complete = 1;
+    int i;
+
+    dircache_wrlock();
+
+    /* The poller has moved on while this was being listed, and may have
+     * already invalidated what it would add */
+    if( !attr->history && svnclient_polling() &&
+            attr->rev != dircache_get_rev() ) {
+        dircache_unlock();
+        return(-1);
+    }
+    if( attr->history )
+        svnclient_history_dir();
+
+    gen = dircache_next_gen();
+
+    for( i = 0; i < attr->entries->nelts; i++ ) {
+        entry = APR_ARRAY_IDX(attr->entries, i, struct svnclient_entry *);
+
+        /* Finds the existing entry, or adds it (and any missing parents)
+         * to the dircache */
+        if( (dp = dircache_add(entry->path)) == NULL ) {
+            complete = 0;
             continue;
         }
-        if( !(strncmp(dp->name, fullpath, strlen(fullpath))) ) {
-            dp->st.st_size = dirent->size;
-	    dp->st.st_mtime = apr_to_time_t(dirent->time);
-            attr->dp = dp;
-	    found = 1;
-	    break;
+        dp->gen = gen;
+        if( entry->name[0] == '\0' )
+            target = dp;
+
+        /* The '/' of the filesystem has a static dirent */
+        if( dp == dircache_root() )
+            continue;
+
+        dp->mode = (entry->kind == svn_node_file ? S_IFREG : S_IFDIR) |
+            entry->mode;
+        dp->uid = entry->uid;
+        dp->gid = entry->gid;
+        dp->size = entry->size;
+        dp->mtime = apr_to_time_t(entry->time);
+        dp->rev = entry->created_rev;
+    }
+
+    if( target ) {
+        /* A non-recursive list returns every child of a directory, so
+         * anything not seen this time round has gone from the repository */
+        if( S_ISDIR(target->mode) && complete ) {
+            dircache_prune(target, gen);
+            target->listed = 1;
         }
-        dp = dp->next;
+        if( st )
+            dircache_stat(target, st);
     }
-    if ( found == 0 ) {
-      dp->name = strdup(fullpath);
+    dircache_trim();
+    dircache_unlock();
 
-      dp->st.st_size = dirent->size;
-      dp->st.st_mtime = apr_to_time_t(dirent->time);
-      DEBUG("_svnclient_list_func(): st_mtime = %d dirent->time = %ld", dp->st.st_mtime, dirent->time);
+    return( target == NULL );
+}
 
-      DEBUG("_svnclient_list_func(): added %s", dp->name);
+/* Maps the error from a failed repository request to an errno */
+static int svnclient_errno(svn_error_t *err) {
+    char errbuf[1024];
 
-      /* Point attr->dp at the newly created element */
-      attr->dp = dp;
+    DEBUG("svnclient_errno(): %s",
+            svn_strerror(err->apr_err, errbuf, sizeof(errbuf)));
 
-      /* Deliberately allocating a new struct here. This is required for
-       * subsequent lists so that dp is allocated after finishing the
-       * while() loop above */
-      if( (dp->next = malloc(sizeof(struct dirbuf))) == NULL ) {
-	retval = svn_error_create(SVN_ERR_FS_GENERAL, NULL, strerror(errno));
-	goto _svnclient_list_func_early_exit;
-      }
+    switch(err->apr_err) {
+        case SVN_ERR_FS_NOT_FOUND:
+        case SVN_ERR_FS_NOT_DIRECTORY:
+        case SVN_ERR_FS_NO_SUCH_REVISION:
+            return(ENOENT);
+        case SVN_ERR_FS_NOT_FILE:
+            return(EISDIR);
+        default:
+            return(EIO);
     }
+}
 
-    dp->st.st_uid = svnclient_uid_for_path(abspath);
-    dp->st.st_gid = svnclient_gid_for_path(abspath);
-    if( dirent->kind == svn_node_file )
-      dp->st.st_mode = S_IFREG | svnclient_mode_for_path(abspath);
-    else
-      dp->st.st_mode = S_IFDIR | svnclient_mode_for_path(abspath);
+/*
+ * Places the repository path of the filesystem root (eg. "/project", or ""
+ * for the repository's own) in *prefix. Over RA it's asked for once.
+ */
+static svn_error_t *svnclient_prefix(struct rasession *rs,
+        const char **prefix, apr_pool_t *pool) {
+    svn_error_t *err = SVN_NO_ERROR;
+    const char *root;
+
+    if( rs->direct ) {
+        *prefix = rs->direct->base;
+        return(SVN_NO_ERROR);
+    }
+
+    pthread_mutex_lock(&svnclient_prefix_lock);
+    if( svnclient_repos_prefix == NULL ) {
+        stats_ra(STATS_RA_REPOS_ROOT);
+        err = svn_ra_get_repos_root(rs->session, &root, pool);
+        if( err == SVN_NO_ERROR &&
+                strncmp(svnfs.svnpath, root, strlen(root)) )
+            err = svn_error_create(SVN_ERR_RA_ILLEGAL_URL, NULL,
+                    "repository root doesn't prefix the URL");
+        if( err == SVN_NO_ERROR && (svnclient_repos_prefix =
+                    strdup(svn_path_uri_decode(svnfs.svnpath + strlen(root),
+                            pool))) == NULL )
+            err = svn_error_create(SVN_ERR_FS_GENERAL, NULL,
+                    strerror(errno));
+    }
+    *prefix = svnclient_repos_prefix;
+    pthread_mutex_unlock(&svnclient_prefix_lock);
+    return(err);
+}
 
-_svnclient_list_func_early_exit:
-    if (dp->next) {
-      dp = dp->next;
-      dp->next = NULL;
-      dp->name = NULL;
+/*
+ * As svnclient_prefix(), for outside a request, allocated in the global
+ * pool. Returns non-zero on failure.
+ */
+int svnclient_repos_path(const char **prefix) {
+    struct rasession *rs;
+    svn_error_t *err;
+    char errbuf[1024];
+
+    if( (err = rasession_get(&rs)) == SVN_NO_ERROR ) {
+        err = svnclient_prefix(rs, prefix, pool);
+        if( err == SVN_NO_ERROR )
+            *prefix = apr_pstrdup(pool, *prefix);
+        rasession_release(rs, err);
+    }
+    if( err ) {
+        fprintf(stderr, "%s\n", svn_strerror(err->apr_err, errbuf, 1024));
+        svn_error_clear(err);
+        return(1);
+    }
+    return(0);
+}
+
+/*
+ * Returns 1 if it's worth asking where 'path', at revision 'rev', came
+ * from. Its last changed revision has to be one the dircache can vouch
+ * for, at a pinned or polled revision or under /@rev, ie. 'rev' must be
+ * valid. Direct sessions can tell for next to nothing; over RA it costs a
+ * request, so only paths within a tag or branch of the standard layout
+ * are asked about.
+ */
+static int svnclient_copied(const char *path, svn_revnum_t rev) {
+    const char *p;
+
+    if( !SVN_IS_VALID_REVNUM(rev) )
+        return(0);
+    if( fsdirect_usable() )
+        return(1);
+    for( p = path; (p = strchr(p, '/')) != NULL; p++ ) {
+        if( !strncmp(p, "/tags/", 6) || !strncmp(p, "/branches/", 10) ) {
+            /* Below the tag or branch itself, which is always new */
+            p = strchr(p + 1, '/');
+            return( strchr(p + 1, '/') != NULL );
+        }
+    }
+    return(0);
+}
+
+/*
+ * Returns the origin of 'path' at revision 'rev', last changed in
+ * 'created_rev': the path it had in that revision, malloc()ed, if that's
+ * another within the filesystem. Something copied, and unchanged since,
+ * is the same node as where it was copied from, so its contents and
+ * listing are the same too, and can be cached under the origin once
+ * for every copy. Returns NULL if there's no other, or it's not known.
+ */
+static char *svnclient_origin(const char *path, svn_revnum_t rev,
+        svn_revnum_t created_rev) {
+    struct svnclient_thread *thread;
+    struct rasession *rs;
+    apr_array_header_t *revs;
+    apr_hash_t *locations;
+    apr_pool_t *subpool;
+    svn_revnum_t fs_created_rev = SVN_INVALID_REVNUM;
+    const char *prefix = "", *found = NULL;
+    char *origin = NULL;
+    svn_error_t *err;
+    size_t len;
+
+    if( created_rev <= 0 || !svnclient_copied(path, rev) ||
+            origin_get(path, created_rev, &origin) )
+        return(origin);
+    if( (thread = svnclient_thread()) == NULL )
+        return(NULL);
+    subpool = svn_pool_create(thread->pool);
+
+    if( (err = rasession_get(&rs)) == SVN_NO_ERROR ) {
+        stats_ra(STATS_RA_LOCATIONS);
+        if( (err = svnclient_prefix(rs, &prefix, subpool)) != SVN_NO_ERROR ) {
+            /* Nothing to ask */
+        } else if( rs->direct ) {
+            err = fsdirect_created_path(rs->direct,
+                    svnclient_relpath(path, subpool), rev, &fs_created_rev,
+                    &found, subpool);
+            /* The dircache disagrees, so leave it be */
+            if( fs_created_rev != created_rev )
+                found = NULL;
+        } else {
+            revs = apr_array_make(subpool, 1, sizeof(svn_revnum_t));
+            APR_ARRAY_PUSH(revs, svn_revnum_t) = created_rev;
+            err = svn_ra_get_locations(rs->session, &locations,
+                    svnclient_relpath(path, subpool), rev, revs, subpool);
+            if( err == SVN_NO_ERROR )
+                found = apr_hash_get(locations, &created_rev,
+                        sizeof(svn_revnum_t));
+        }
+        rasession_release(rs, err);
     }
 
-    if (abspath)
-      free(abspath);
-    if ( fullpath )
-      free(fullpath);
-    return retval;
+    if( err ) {
+        DEBUG("svnclient_origin(): %s: %s", path,
+                err->message ? err->message : "unknown error");
+        svn_error_clear(err);
+    } else {
+        /* Only something within the filesystem can be cached under */
+        len = strlen(prefix);
+        if( found && !strncmp(found, prefix, len) && found[len] == '/' &&
+                strcmp(found + len, path) ) {
+            origin = strdup(found + len);
+            DEBUG("svnclient_origin(): %s r%ld is %s", path,
+                    (long)created_rev, found + len);
+        }
+        origin_put(path, created_rev, origin);
+    }
+    svn_pool_destroy(subpool);
+    return(origin);
 }
 
-/* If a file isn't contained in the dirbuf cache, this will get called.
- * Return the files result in *dp, and also append it to the dirbuf
- * cache */
-int svnclient_list(const char *path, struct dirbuf *dp) {
-    svn_opt_revision_t *rev;
-    apr_uint32_t dirent_fields = SVN_DIRENT_KIND | SVN_DIRENT_SIZE;
+/* If a file isn't contained in the dircache, this will get called.
+ * Return the files stats in *st, and also add it (and, for a directory,
+ * its children) to the dircache */
+int svnclient_list(const char *path, struct stat *st) {
+    struct dirbuf *dp;
     svn_error_t *err = NULL;
-    struct svnfs_attr *attr;
+    struct rasession *rs;
+    struct svnfs_attr attr;
+    const char *relpath;
+    apr_pool_t *subpool;
+    int ret = 0;
+    struct svnclient_thread *thread;
+    struct flight *flight;
+    svn_revnum_t rev;
+    const char *rest;
+    int history;
+    int attempt;
+
+    DEBUG("svnclient_list(): '%s'", path);
 
-    char *fullpath;
+    /* /@rev itself only lists the revisions looked at so far */
+    if( !strcmp(path, SVNCLIENT_REV_DIR) ) {
+        dircache_wrlock();
+        if( (dp = svnclient_history_dir()) != NULL && st )
+            dircache_stat(dp, st);
+        dircache_unlock();
+        return( dp ? 0 : ENOMEM );
+    }
+    if( (history = svnclient_history(path, &rev, &rest)) < 0 )
+        return(ENOENT);
 
-    attr = malloc(sizeof(struct svnfs_attr));
-    attr->path = strdup(path);
+    /* HEAD's last changed revisions can be trusted when pinned or polled */
+    if( !history ) {
+        rev = svnclient_revnum();
+        rest = path;
+    }
+    if( SVN_IS_VALID_REVNUM(rev) && svnclient_share(path, rest, rev, st) == 0 )
+        return(0);
 
-    rev = malloc(sizeof(svn_opt_revision_t));
-    rev->kind = svn_opt_revision_head;
+    /* Take the outcome of the same listing if another thread is at it */
+    if( (ret = flight_join(FLIGHT_LIST, path, rev, &flight)) > 0 )
+        return(ret);
+    if( ret == 0 ) {
+        dircache_rdlock();
+        if( (dp = dircache_lookup(path)) != NULL && st )
+            dircache_stat(dp, st);
+        dircache_unlock();
+        /* Unless it's been evicted since */
+        if( dp )
+            return(0);
+    }
+    ret = 0;
 
-    if( (fullpath = malloc(strlen(svnfs.svnpath) + strlen(path) + 1)) == NULL )
+    if( (thread = svnclient_thread()) == NULL ) {
+        flight_land(flight, EIO);
         return(EIO);
-    sprintf(fullpath, "%s%s", svnfs.svnpath, path);
-    while( fullpath[strlen(fullpath)-1] == '/' )
-        fullpath[strlen(fullpath)-1] = '\0';
-
-    DEBUG("svnclient_list(): '%s'", fullpath);
-
-    if( (err = svn_client_list(fullpath, rev, rev, FALSE, dirent_fields, FALSE,
-                _svnclient_list_func, (void *)attr, ctx, pool))
-            != SVN_NO_ERROR ) {
-        switch(err->apr_err) {
-            case SVN_ERR_FS_NOT_FOUND:
-                return(ENOENT);
-            default:
-                return(EIO);
+    }
+    subpool = svn_pool_create(thread->pool);
+
+    /* A session which has gone bad gets one retry on a fresh one, and a
+     * listing overtaken by the poller is done again at the new revision */
+    for( attempt = 0; attempt < SVNCLIENT_LIST_ATTEMPTS; attempt++ ) {
+        svn_pool_clear(subpool);
+        attr.path = apr_pstrdup(subpool, path);
+        attr.rev = history ? rev : svnclient_revnum();
+        attr.history = history;
+        attr.entries = apr_array_make(subpool, 16,
+                sizeof(struct svnclient_entry *));
+        attr.pool = subpool;
+        relpath = svnclient_relpath(history ? rest : path, subpool);
+
+        if( (err = rasession_get(&rs)) != SVN_NO_ERROR )
+            break;
+        if( rs->direct )
+            err = svnclient_fs_list(rs->direct, &attr, relpath, attr.rev);
+        else
+            err = svnclient_ra_list(rs, &attr, relpath, attr.rev);
+        if( rasession_release(rs, err) &&
+                attempt + 1 < SVNCLIENT_LIST_ATTEMPTS ) {
+            svn_error_clear(err);
+            err = SVN_NO_ERROR;
+            continue;
+        }
+        if( err || (ret = svnclient_apply(&attr, st)) >= 0 )
+            break;
+        DEBUG("svnclient_list(): '%s' overtaken by r%ld", path,
+                svnclient_revnum());
+    }
+
+    if( err ) {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
+
+        /* Unless the poller has already moved on */
+        if( ret == ENOENT ) {
+            dircache_rdlock();
+            if( history || !svnclient_polling() ||
+                    attr.rev == dircache_get_rev() )
+                negcache_add(path);
+            dircache_unlock();
+        }
+    } else if( ret > 0 ) {
+        ret = ENOENT;
+    } else if( ret < 0 ) {
+        /* Lost every race with the poller */
+        ret = EAGAIN;
+    }
+
+    flight_land(flight, ret);
+    svn_pool_destroy(subpool);
+    return(ret);
+}
+
+/*
+ * Opens 'path' for reading. 'created_rev' and 'size' are what the dircache
+ * has for it; the revision the contents are read from is fixed by the
+ * first fetch, so every read through the handle sees the same file. Files
+ * under /@rev/N are read at N, and cached under their path in the
+ * repository, so they're shared with every other revision they're
+ * unchanged in.
+ */
+/* The path the contents of 'h' are cached under */
+static const char *svnclient_key(const struct svnclient_handle *h) {
+    return( h->key ? h->key : h->path );
+}
+
+/* Looks for the origin of 'h', once */
+static void svnclient_resolve(struct svnclient_handle *h) {
+    if( h->resolved )
+        return;
+    h->resolved = 1;
+    h->key = svnclient_origin(h->path, h->rev, h->created_rev);
+}
+
+/*
+ * Reads from the content or disk cache what svnclient_read() would, or
+ * with buf NULL only checks they have the file. Under its own path first,
+ * which costs nothing, then under its origin. Returns 1 if found.
+ */
+static int svnclient_cached(struct svnclient_handle *h, char *buf,
+        size_t *size, off_t offset) {
+    const char *key;
+    int found;
+
+    for( ;; ) {
+        key = svnclient_key(h);
+        if( buf )
+            found = contentcache_get(key, h->created_rev, buf, size,
+                    offset) ||
+                diskcache_get(key, h->created_rev, buf, size, offset);
+        else
+            found = contentcache_has(key, h->created_rev) ||
+                diskcache_has(key, h->created_rev);
+        if( found && h->key && !h->shared ) {
+            h->shared = 1;
+            origin_count_file(h->size);
         }
+        if( found || h->resolved )
+            return(found);
+        svnclient_resolve(h);
+        if( h->key == NULL )
+            return(0);
+    }
+}
+
+/* Returns 1 if the whole of 'h', once fetched, would be cached */
+static int svnclient_shareable(const struct svnclient_handle *h) {
+    return( (svnfs.cache_size && (apr_uint64_t)h->size <= svnfs.cache_size) ||
+            (svnfs.cache_dir &&
+             (apr_uint64_t)h->size <= svnfs.cache_dir_size) );
+}
+
+int svnclient_open(const char *path, svn_revnum_t created_rev,
+        svn_filesize_t size, struct svnclient_handle **hp) {
+    struct svnclient_handle *h;
+    svn_revnum_t rev = svnclient_revnum();
+    const char *rest;
+
+    if( svnclient_history(path, &rev, &rest) > 0 )
+        path = *rest ? rest : "/";
+
+    if( (h = calloc(1, sizeof(struct svnclient_handle))) == NULL )
+        return(ENOMEM);
+    if( (h->path = strdup(path)) == NULL ) {
+        free(h);
+        return(ENOMEM);
     }
-    /* Point at the last created dirbuf element. This is primarily for
-     * getattr() */
-    dp = attr->dp;
+    h->rev = rev;
+    h->created_rev = created_rev;
+    /* Only the dircache's revision, at a pinned or polled one, is current */
+    h->checked = SVN_IS_VALID_REVNUM(rev);
+    h->size = size;
+    if( size >= SVNCLIENT_MIN_BLOCK_FILE ) {
+        svnclient_resolve(h);
+        h->blocks = blockcache_open(svnclient_key(h), created_rev, size);
+    }
+    h->cache_fd = -1;
+    pthread_mutex_init(&h->lock, NULL);
 
+    *hp = h;
     return(0);
 }
 
-int svnclient_read(struct dirbuf *dp, char *buf, size_t *size, off_t offset) {
-    svn_opt_revision_t *rev;
+void svnclient_close(struct svnclient_handle *h) {
+    if( h->blocks )
+        blockcache_close(h->blocks);
+    if( h->cache_fd >= 0 )
+        close(h->cache_fd);
+    pthread_mutex_destroy(&h->lock);
+    free(h->buf);
+    free(h->key);
+    free(h->path);
+    free(h);
+}
+
+struct svnclient_fetch_baton {
+    struct svnclient_handle *h;
+    apr_size_t pos;             /* Bytes seen in this fetch */
+    apr_size_t target;          /* Stop once the handle has this many */
+
+    /* Fetching into the block cache, for a read of dest_len bytes at
+     * dest_offset, and stopping at target bytes into the file instead */
+    char *block;                /* The block going past */
+    int skip;                   /* ... unless it's already cached */
+    char *dest;
+    apr_size_t dest_offset;
+    apr_size_t dest_len;
+    apr_size_t copied;          /* Bytes of dest filled in */
+};
+
+/*
+ * Stream write handler for svnclient_fetch(). The repository can only send
+ * a file from the start, so skip what the handle already has, keep the
+ * rest, and cancel the transfer once there's enough.
+ */
+static svn_error_t *svnclient_fetch_write(void *baton, const char *data,
+        apr_size_t *len) {
+    struct svnclient_fetch_baton *fb = baton;
+    struct svnclient_handle *h = fb->h;
+    apr_size_t skip = 0;
+    apr_size_t want;
+    char *buf;
+
+    if( fb->pos < h->len )
+        skip = (h->len - fb->pos < *len) ? h->len - fb->pos : *len;
+    fb->pos += *len;
+    want = *len - skip;
+    stats_fetched(*len);
+
+    if( want ) {
+        if( h->len + want > h->alloc ) {
+            apr_size_t alloc = h->alloc ? h->alloc : 65536;
+
+            while( alloc < h->len + want )
+                alloc *= 2;
+            if( (buf = realloc(h->buf, alloc)) == NULL )
+                return(svn_error_create(SVN_ERR_FS_GENERAL, NULL,
+                            strerror(errno)));
+            h->buf = buf;
+            h->alloc = alloc;
+        }
+        memcpy(h->buf + h->len, data + skip, want);
+        h->len += want;
+    }
+
+    /* Not at the end, though, so a fetch which gets the lot completes */
+    if( h->len >= fb->target && (svn_filesize_t)h->len < h->size )
+        return(svn_error_create(SVN_ERR_CANCELLED, NULL, NULL));
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Stream write handler for svnclient_fetch() into the block cache. Every
+ * whole block which goes past is kept, as the next read may well need it
+ * and getting back to it means starting from the beginning again, and the
+ * bytes the read is waiting for are copied straight to it, so it doesn't
+ * depend on them staying cached.
+ */
+static svn_error_t *svnclient_fetch_block_write(void *baton, const char *data,
+        apr_size_t *len) {
+    struct svnclient_fetch_baton *fb = baton;
+    struct svnclient_handle *h = fb->h;
+    apr_size_t start, end, off, blocklen, n;
+    apr_size_t left = *len;
+    apr_uint32_t block;
+
+    stats_fetched(*len);
+
+    start = fb->pos > fb->dest_offset ? fb->pos : fb->dest_offset;
+    end = fb->pos + *len;
+    if( end > fb->dest_offset + fb->dest_len )
+        end = fb->dest_offset + fb->dest_len;
+    if( start < end ) {
+        memcpy(fb->dest + (start - fb->dest_offset),
+                data + (start - fb->pos), end - start);
+        if( end - fb->dest_offset > fb->copied )
+            fb->copied = end - fb->dest_offset;
+    }
+
+    while( left && fb->pos < (apr_size_t)h->size ) {
+        block = fb->pos / BLOCKCACHE_BLOCK_SIZE;
+        off = fb->pos % BLOCKCACHE_BLOCK_SIZE;
+        blocklen = h->size - (svn_filesize_t)block * BLOCKCACHE_BLOCK_SIZE;
+        if( blocklen > BLOCKCACHE_BLOCK_SIZE )
+            blocklen = BLOCKCACHE_BLOCK_SIZE;
+        if( off == 0 )
+            fb->skip = blockcache_has(h->blocks, block);
+
+        n = (left < blocklen - off) ? left : blocklen - off;
+        if( !fb->skip ) {
+            memcpy(fb->block + off, data, n);
+            if( off + n == blocklen )
+                blockcache_write(h->blocks, block, fb->block, blocklen);
+        }
+        fb->pos += n;
+        data += n;
+        left -= n;
+    }
+    /* Past the size the dircache had */
+    fb->pos += left;
+
+    if( fb->pos >= fb->target && (svn_filesize_t)fb->pos < h->size )
+        return(svn_error_create(SVN_ERR_CANCELLED, NULL, NULL));
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Settles the last changed revision of 'h' as 'created_rev', which the
+ * repository gave for the revision being read. Read at HEAD, the dircache
+ * may have had an older one, and the contents would be cached under it.
+ */
+static void svnclient_rekey(struct svnclient_handle *h,
+        svn_revnum_t created_rev) {
+    h->checked = 1;
+    if( !SVN_IS_VALID_REVNUM(created_rev) || created_rev == h->created_rev )
+        return;
+    DEBUG("svnclient_rekey(): %s was last changed in r%ld, not r%ld",
+            h->path, (long)created_rev, (long)h->created_rev);
+    h->created_rev = created_rev;
+    if( h->blocks ) {
+        blockcache_close(h->blocks);
+        h->blocks = blockcache_open(svnclient_key(h), created_rev, h->size);
+    }
+}
+
+/*
+ * Extends the prefix of the file held by 'fb->h' to at least 'fb->target'
+ * bytes, or to the whole file, or with a block cache, fetches into that
+ * instead.
+ */
+static svn_error_t *svnclient_fetch(struct svnclient_fetch_baton *fb,
+        apr_pool_t *pool) {
+    struct svnclient_handle *h = fb->h;
+    struct rasession *rs;
     svn_stream_t *out;
-    svn_stringbuf_t *sbuf;
-    char *path;
-    apr_pool_t *subpool = svn_pool_create(pool);
-    svn_error_t *err = NULL;
-    char *errbuf;
+    svn_error_t *err = SVN_NO_ERROR;
+    svn_dirent_t *dirent;
+    svn_string_t *value;
+    svn_revnum_t created_rev;
+    apr_hash_t *props;
+    const char *relpath;
+    int attempt;
 
-    sbuf = svn_stringbuf_create("", subpool);
-    out = svn_stream_from_stringbuf(sbuf, subpool);
+    /* A session which has gone bad gets one retry on a fresh one */
+    for( attempt = 0; attempt < 2; attempt++ ) {
+        SVN_ERR(rasession_get(&rs));
+        if( !SVN_IS_VALID_REVNUM(h->rev) ) {
+            stats_ra(STATS_RA_LATEST_REVNUM);
+            err = rs->direct ? fsdirect_youngest(rs->direct, &h->rev, pool) :
+                svn_ra_get_latest_revnum(rs->session, &h->rev, pool);
+        }
+        relpath = svnclient_relpath(h->path, pool);
 
-    path = malloc(strlen(svnfs.svnpath) + strlen(dp->name) + 1);
-    sprintf(path, "%s%s", svnfs.svnpath, dp->name);
+        /* Anything fetched at HEAD has its last changed revision checked
+         * before it's cached. Blocks are cached as they arrive, so ask
+         * first for those; otherwise it comes with the file's props */
+        created_rev = SVN_INVALID_REVNUM;
+        if( err == SVN_NO_ERROR && !h->checked && rs->direct ) {
+            err = fsdirect_created_rev(rs->direct, relpath, h->rev,
+                    &created_rev, pool);
+            if( err == SVN_NO_ERROR )
+                svnclient_rekey(h, created_rev);
+        } else if( err == SVN_NO_ERROR && !h->checked && h->blocks ) {
+            stats_ra(STATS_RA_STAT);
+            err = svn_ra_stat(rs->session, relpath, h->rev, &dirent, pool);
+            if( err == SVN_NO_ERROR && dirent )
+                svnclient_rekey(h, dirent->created_rev);
+        }
+        if( err == SVN_NO_ERROR ) {
+            /* Which may have been reopened under another revision */
+            fb->pos = 0;
+            out = svn_stream_create(fb, pool);
+            svn_stream_set_write(out, h->blocks ?
+                    svnclient_fetch_block_write : svnclient_fetch_write);
+            stats_ra(STATS_RA_GET_FILE);
+            props = NULL;
+            if( rs->direct )
+                err = fsdirect_get_file(rs->direct, relpath, h->rev, out,
+                        pool);
+            else
+                err = svn_ra_get_file(rs->session, relpath, h->rev, out,
+                        NULL, h->checked ? NULL : &props, pool);
+            if( err == SVN_NO_ERROR && props &&
+                    (value = apr_hash_get(props, SVN_PROP_ENTRY_COMMITTED_REV,
+                                          APR_HASH_KEY_STRING)) )
+                svnclient_rekey(h, SVN_STR_TO_REV(value->data));
+        }
+        if( err == SVN_NO_ERROR && h->blocks == NULL )
+            h->complete = 1;
+
+        /* An RA session is thrown away if we cut the transfer short */
+        if( !rasession_release(rs, err) || attempt == 1 ||
+                (err && err->apr_err == SVN_ERR_CANCELLED) )
+            break;
+        svn_error_clear(err);
+        err = SVN_NO_ERROR;
+    }
 
-    rev = malloc(sizeof(svn_opt_revision_t));
-    rev->kind = svn_opt_revision_head;
+    if( err && err->apr_err == SVN_ERR_CANCELLED ) {
+        svn_error_clear(err);
+        err = SVN_NO_ERROR;
+    }
+    return(err);
+}
 
-    if( (err = svn_client_cat2(out, path, rev, rev, ctx, subpool))
-            == SVN_NO_ERROR ) {
-        if( sbuf->len < *size ) {
-            memcpy(buf, sbuf->data + offset, sbuf->len);
-            *size = sbuf->len;
+/* Copies *size bytes from 'offset' of the prefix held by 'h' */
+static void svnclient_copy(struct svnclient_handle *h, char *buf,
+        size_t *size, off_t offset) {
+    if( offset >= h->len ) {
+        *size = 0;
+    } else {
+        if( *size > h->len - offset )
+            *size = h->len - offset;
+        memcpy(buf, h->buf + offset, *size);
+    }
+}
+
+/*
+ * svnclient_read() for a file read through the block cache. A read of
+ * blocks which aren't cached yet fetches as far as the last of them, or
+ * twice as far as the blocks cached from the start, whichever is further,
+ * so that working through the file costs at most twice its size.
+ */
+static int svnclient_read_blocks(struct svnclient_handle *h, char *buf,
+        size_t *size, off_t offset) {
+    struct svnclient_fetch_baton fb;
+    struct svnclient_thread *thread;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+    apr_size_t target, prefix;
+    int ret = 0;
+
+    if( blockcache_read(h->blocks, buf, size, offset) )
+        return(0);
+
+    if( (thread = svnclient_thread()) == NULL )
+        return(EIO);
+    memset(&fb, 0, sizeof(fb));
+    if( (fb.block = malloc(BLOCKCACHE_BLOCK_SIZE)) == NULL )
+        return(ENOMEM);
+    subpool = svn_pool_create(thread->pool);
+
+    fb.h = h;
+    fb.dest = buf;
+    fb.dest_offset = offset;
+    fb.dest_len = *size;
+    target = (offset + *size + BLOCKCACHE_BLOCK_SIZE - 1) /
+        BLOCKCACHE_BLOCK_SIZE * BLOCKCACHE_BLOCK_SIZE;
+    prefix = (apr_size_t)blockcache_prefix(h->blocks) * BLOCKCACHE_BLOCK_SIZE;
+    if( target < prefix * 2 )
+        target = prefix * 2;
+    fb.target = target;
+
+    prefetch_foreground(1);
+    err = svnclient_fetch(&fb, subpool);
+    prefetch_foreground(-1);
+    if( err == SVN_NO_ERROR ) {
+        DEBUG("svnclient_read_blocks(): %s, %ld bytes at %ld, fetched %ld",
+                h->path, (long)*size, (long)offset, (long)fb.pos);
+        *size = fb.copied;
+    } else {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
+    }
+
+    svn_pool_destroy(subpool);
+    free(fb.block);
+    return(ret);
+}
+
+/* Reads *size bytes from 'offset' of the file open as 'h'. Whole files are
+ * served from the content cache, or the disk cache if enabled. Otherwise
+ * only as much of the file as is needed is fetched: each fetch goes at
+ * least twice as far as the last, so reading a file sequentially costs at
+ * most twice its size, and reading just its head stops early. */
+int svnclient_read(struct svnclient_handle *h, char *buf, size_t *size,
+        off_t offset) {
+    struct svnclient_fetch_baton fb;
+    struct svnclient_thread *thread;
+    struct flight *flight = NULL;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+    apr_size_t target;
+    int ret = 0;
+
+    pthread_mutex_lock(&h->lock);
+
+    if( h->complete || offset + *size <= h->len ) {
+        svnclient_copy(h, buf, size, offset);
+        goto svnclient_read_exit;
+    }
+
+    if( svnclient_cached(h, buf, size, offset) )
+        goto svnclient_read_exit;
+
+    if( h->blocks ) {
+        ret = svnclient_read_blocks(h, buf, size, offset);
+        goto svnclient_read_exit;
+    }
+
+    target = offset + *size;
+    if( target < h->len * 2 )
+        target = h->len * 2;
+    if( target < SVNCLIENT_MIN_FETCH )
+        target = SVNCLIENT_MIN_FETCH;
+
+    /* Another open of the same file may be fetching it already. What it
+     * fetches is only shared through the caches, so only a fetch of the
+     * whole file, which they'll take, is waited for */
+    if( target >= h->size && svnclient_shareable(h) &&
+            ((ret = flight_join(FLIGHT_READ, svnclient_key(h),
+                    h->created_rev, &flight)) > 0 ||
+             (ret == 0 && svnclient_cached(h, buf, size, offset))) )
+        goto svnclient_read_exit;
+    ret = 0;
+
+    if( (thread = svnclient_thread()) == NULL ) {
+        ret = EIO;
+        goto svnclient_read_exit;
+    }
+    subpool = svn_pool_create(thread->pool);
+
+    memset(&fb, 0, sizeof(fb));
+    fb.h = h;
+    fb.target = target;
+    prefetch_foreground(1);
+    err = svnclient_fetch(&fb, subpool);
+    prefetch_foreground(-1);
+    if( err == SVN_NO_ERROR ) {
+        DEBUG("svnclient_read(): have %ld bytes of %s%s", (long)h->len,
+                h->path, h->complete ? " (complete)" : "");
+        /* Unless it's not known what revision it was last changed in */
+        if( h->complete && h->checked ) {
+            contentcache_put(svnclient_key(h), h->created_rev, h->buf,
+                    h->len, 0);
+            diskcache_put(svnclient_key(h), h->created_rev, h->buf, h->len);
+        }
+        svnclient_copy(h, buf, size, offset);
+    } else {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
+    }
+
+    svn_pool_destroy(subpool);
+
+svnclient_read_exit:
+    flight_land(flight, ret);
+    pthread_mutex_unlock(&h->lock);
+    return(ret);
+}
+
+/*
+ * Finds the *size bytes from 'offset' of the file open as 'h' in a cache
+ * file, so they can be handed to the kernel without being copied. Returns
+ * 1 with *fd set to a descriptor holding them at 'offset', which belongs
+ * to the handle, or 0 if they have to be read with svnclient_read(). The
+ * disk cache's copy is looked for until found, as a read may put it there.
+ */
+int svnclient_read_fd(struct svnclient_handle *h, size_t *size,
+        off_t offset, int *fd) {
+    int ret = 0;
+
+    pthread_mutex_lock(&h->lock);
+    if( h->cache_fd < 0 )
+        h->cache_fd = diskcache_open(svnclient_key(h), h->created_rev);
+    if( h->cache_fd >= 0 ) {
+        *fd = h->cache_fd;
+        ret = 1;
+    } else if( h->blocks &&
+            (*fd = blockcache_fd(h->blocks, size, offset)) >= 0 ) {
+        ret = 1;
+    }
+    pthread_mutex_unlock(&h->lock);
+    return(ret);
+}
+
+/*
+ * Fetches the whole of 'path', last changed in 'created_rev', into the
+ * caches ahead of it being read. Called from the prefetch threads.
+ */
+int svnclient_prefetch(const char *path, svn_revnum_t created_rev) {
+    struct svnclient_fetch_baton fb;
+    struct svnclient_thread *thread;
+    struct svnclient_handle *h;
+    struct flight *flight;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+    int ret;
+
+    if( (thread = svnclient_thread()) == NULL )
+        return(EIO);
+    if( (ret = svnclient_open(path, created_rev, 0, &h)) )
+        return(ret);
+    /* A read already fetching it will cache it anyway */
+    if( svnclient_cached(h, NULL, NULL, 0) ||
+            (ret = flight_join(FLIGHT_READ, svnclient_key(h), created_rev,
+                    &flight)) >= 0 ) {
+        svnclient_close(h);
+        return( ret > 0 ? ret : 0 );
+    }
+    ret = 0;
+    subpool = svn_pool_create(thread->pool);
+
+    memset(&fb, 0, sizeof(fb));
+    fb.h = h;
+    fb.target = (apr_size_t)-1;
+    if( (err = svnclient_fetch(&fb, subpool)) == SVN_NO_ERROR ) {
+        DEBUG("svnclient_prefetch(): %s, %ld bytes", path, (long)h->len);
+        if( h->checked ) {
+            contentcache_put(svnclient_key(h), h->created_rev, h->buf,
+                    h->len, 1);
+            diskcache_put(svnclient_key(h), h->created_rev, h->buf, h->len);
+        }
+    } else {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
+    }
+    flight_land(flight, ret);
+
+    svn_pool_destroy(subpool);
+    svnclient_close(h);
+    return(ret);
+}
+
+/*
+ * Places the revision the filesystem shows in 'rev': the pinned revision,
+ * or else the youngest in the repository.
+ */
+int svnclient_youngest(svn_revnum_t *rev) {
+    struct rasession *rs;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+    int ret = 0;
+
+    if( SVN_IS_VALID_REVNUM(svnfs.rev) ) {
+        *rev = svnfs.rev;
+        return(0);
+    }
+
+    subpool = svn_pool_create(pool);
+    if( (err = rasession_get(&rs)) == SVN_NO_ERROR ) {
+        stats_ra(STATS_RA_LATEST_REVNUM);
+        err = rs->direct ? fsdirect_youngest(rs->direct, rev, subpool) :
+            svn_ra_get_latest_revnum(rs->session, rev, subpool);
+        rasession_release(rs, err);
+    }
+    if( err ) {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
+    }
+    svn_pool_destroy(subpool);
+    return(ret);
+}
+
+struct svnclient_change {
+    const char *path;           /* Path within the filesystem */
+    char action;                /* 'A'dded, 'D'eleted, 'R'eplaced, 'M'odified */
+};
+
+struct svnclient_log_baton {
+    const char *prefix;         /* Repository path of the filesystem root */
+    apr_size_t prefixlen;
+    apr_array_header_t *changes;
+};
+
+/*
+ * Log receiver for svnclient_catch_up(). Changed paths are relative to the
+ * repository root; keep those at or below the filesystem root, and turn
+ * any change to a parent of it into a change to the root.
+ */
+static svn_error_t *svnclient_log_func(void *baton, apr_hash_t *changed_paths,
+        svn_revnum_t revision, const char *author, const char *date,
+        const char *message, apr_pool_t *pool) {
+    struct svnclient_log_baton *lb = baton;
+    struct svnclient_change *change;
+    apr_hash_index_t *hi;
+    const void *key;
+    void *val;
+    const char *path;
+    apr_size_t len;
+
+    if( changed_paths == NULL )
+        return(SVN_NO_ERROR);
+
+    for( hi = apr_hash_first(pool, changed_paths); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, &key, NULL, &val);
+        path = key;
+        len = strlen(path);
+
+        if( len <= lb->prefixlen ) {
+            /* A parent of (or) the root, unless it's a sibling */
+            if( strncmp(lb->prefix, path, len) ||
+                    (lb->prefix[len] != '/' && lb->prefix[len] != '\0') )
+                continue;
+            path = "/";
         } else {
-            memcpy(buf, sbuf->data + offset, *size);
+            if( strncmp(lb->prefix, path, lb->prefixlen) ||
+                    path[lb->prefixlen] != '/' )
+                continue;
+            path += lb->prefixlen;
         }
-        DEBUG("svnclient_read(): size %ld", sbuf->len);
+
+        change = apr_palloc(lb->changes->pool, sizeof(*change));
+        change->path = apr_pstrdup(lb->changes->pool, path);
+        change->action = ((svn_log_changed_path_t *)val)->action;
+        APR_ARRAY_PUSH(lb->changes, struct svnclient_change *) = change;
+    }
+
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Forgets whatever the dircache has for 'path' because of 'action' in a
+ * later revision. The lock must be held exclusively.
+ */
+static void svnclient_invalidate(const char *path, char action) {
+    struct dirbuf *dp;
+    char *parent, *slash;
+
+    if( (dp = dircache_lookup(path)) == NULL ) {
+        /* Not cached, but its parent's listing may now be incomplete */
+        if( (parent = strdup(path)) == NULL )
+            return;
+        if( (slash = strrchr(parent, '/')) != NULL ) {
+            *slash = '\0';
+            if( (dp = dircache_lookup(*parent ? parent : "/")) != NULL )
+                dp->listed = 0;
+        }
+        free(parent);
+        return;
+    }
+
+    /* Property changes on a directory leave its children alone, and the
+     * root's attributes aren't taken from the repository at all */
+    if( action == 'M' && S_ISDIR(dp->mode) ) {
+        if( dp->parent )
+            dp->parent->listed = 0;
+        return;
+    }
+    dircache_remove(dp);
+}
+
+/*
+ * Brings the dircache, last known to be up to date with revision 'from',
+ * up to date with revision 'to' by forgetting everything changed in
+ * between, according to the log. Nothing is listed; changed nodes are
+ * simply fetched again when next used.
+ */
+int svnclient_catch_up(svn_revnum_t from, svn_revnum_t to) {
+    struct svnclient_log_baton lb;
+    struct svnclient_change *change;
+    struct rasession *rs;
+    apr_array_header_t *paths;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+    int cleared = 0, ret = 0;
+    int i;
+
+    if( from >= to )
+        return(0);
+
+    subpool = svn_pool_create(pool);
+    paths = apr_array_make(subpool, 1, sizeof(const char *));
+    APR_ARRAY_PUSH(paths, const char *) = "";
+    lb.changes = apr_array_make(subpool, 16, sizeof(struct svnclient_change *));
+
+    if( (err = rasession_get(&rs)) == SVN_NO_ERROR ) {
+        err = svnclient_prefix(rs, &lb.prefix, subpool);
+        if( err == SVN_NO_ERROR ) {
+            lb.prefixlen = strlen(lb.prefix);
+            stats_ra(STATS_RA_LOG);
+            if( rs->direct )
+                err = fsdirect_log(rs->direct, from + 1, to,
+                        svnclient_log_func, &lb, subpool);
+            else
+                err = svn_ra_get_log(rs->session, paths, from + 1, to, 0,
+                        TRUE, FALSE, svnclient_log_func, &lb, subpool);
+        }
+        rasession_release(rs, err);
+    }
+
+    if( err ) {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
     } else {
-        errbuf = malloc(1024);
-        DEBUG("svnclient_read(): svn_client_cat() - %s",
-                svn_strerror(err->apr_err, errbuf, 1024));
-        free(errbuf);
-
-        switch(err->apr_err) {
-            case SVN_ERR_UNVERSIONED_RESOURCE:
-            case SVN_ERR_ENTRY_NOT_FOUND:
-                return(EEXIST);
-            case SVN_ERR_CLIENT_IS_DIRECTORY:
-                return(EISDIR);
-            default:
-                return(EIO);
+        DEBUG("svnclient_catch_up(): r%ld to r%ld, %d changes", from, to,
+                lb.changes->nelts);
+        dircache_wrlock();
+        for( i = 0; i < lb.changes->nelts; i++ ) {
+            change = APR_ARRAY_IDX(lb.changes, i, struct svnclient_change *);
+            svnclient_invalidate(change->path, change->action);
+            /* Paths made again may be copies of something else */
+            if( change->action == 'D' || change->action == 'R' )
+                cleared = 1;
         }
+        negcache_clear();
+        if( cleared )
+            origin_clear();
+        /* A commit through this mount may have got there first */
+        if( to > dircache_get_rev() )
+            dircache_set_rev(to);
+        dircache_unlock();
     }
 
-    apr_pool_destroy(subpool);
-    return(0);
+    svn_pool_destroy(subpool);
+    return(ret);
+}
+
+/*
+ * Places the revision which was youngest at 'date' (anything svn accepts
+ * in {DATE}, eg. "2007-06-01" or "2007-06-01T12:00") in 'rev'.
+ */
+int svnclient_dated(const char *date, svn_revnum_t *rev) {
+    struct rasession *rs;
+    apr_pool_t *subpool;
+    svn_boolean_t matched;
+    apr_time_t tm;
+    svn_error_t *err;
+    int ret = 0;
+
+    subpool = svn_pool_create(pool);
+    err = svn_parse_date(&matched, &tm, date, apr_time_now(), subpool);
+    if( err == SVN_NO_ERROR && !matched ) {
+        svn_pool_destroy(subpool);
+        return(ENOENT);
+    }
+    if( err == SVN_NO_ERROR && (err = rasession_get(&rs)) == SVN_NO_ERROR ) {
+        stats_ra(STATS_RA_DATED_REV);
+        err = rs->direct ?
+            fsdirect_dated_revision(rs->direct, rev, tm, subpool) :
+            svn_ra_get_dated_revision(rs->session, rev, tm, subpool);
+        rasession_release(rs, err);
+    }
+    if( err ) {
+        ret = svnclient_errno(err);
+        svn_error_clear(err);
+    }
+    svn_pool_destroy(subpool);
+    return(ret);
 }
@@ -23,23 +23,113 @@
 #include <svn_io.h>
 #include <svn_error.h>
 #include <apr_time.h>
+#include <pthread.h>
 
 #include "svnfs.h"
+#include "blockcache.h"
+
+/* One node returned by a listing */
+struct svnclient_entry {
+    const char *path;           /* Path within the filesystem */
+    const char *name;           /* Relative to the listed path */
+    svn_node_kind_t kind;
+    svn_filesize_t size;
+    apr_time_t time;
+    svn_revnum_t created_rev;
+    int uid;                    /* From the svnfs:* properties */
+    int gid;
+    int mode;
+};
 
 struct svnfs_attr {
+    const char *path;
+    svn_revnum_t rev;               /* Revision listed at */
+    int history;                    /* Under /@rev, so rev is fixed */
+    apr_array_header_t *entries;    /* struct svnclient_entry * */
+    apr_pool_t *pool;
+};
+
+/* Past revisions are browsed as /@rev/N/..., and dates as /@date/DATE,
+ * a symlink to the revision current then */
+#define SVNCLIENT_REV_DIR "/@rev"
+#define SVNCLIENT_DATE_DIR "/@date"
+
+/* Tries at listing, between bad sessions and races with the poller */
+#define SVNCLIENT_LIST_ATTEMPTS 3
+
+/* Children with properties for a listing to fetch them all in one request,
+ * which opens a session of its own, rather than a request apiece */
+#define SVNCLIENT_BATCH_PROPS 2
+
+/* Fetches of a file's contents go at least this far */
+#define SVNCLIENT_MIN_FETCH (128 * 1024)
+
+/* Files at least this big are read through the block cache, if enabled,
+ * rather than held whole by the handle */
+#define SVNCLIENT_MIN_BLOCK_FILE (8 * BLOCKCACHE_BLOCK_SIZE)
+
+/* An open file, see svnclient_open() */
+struct svnclient_handle {
     char *path;
-    struct dirbuf *dp;
+    char *key;                  /* Origin cached under, if not path */
+    int resolved;               /* key has been looked for */
+    int shared;                 /* Found cached under key */
+    svn_revnum_t rev;           /* Revision being read */
+    svn_revnum_t created_rev;   /* Last changed revision, for the caches */
+    int checked;                /* ... which is known to go with rev */
+    svn_filesize_t size;
+    char *buf;                  /* The start of the file fetched so far */
+    apr_size_t len;
+    apr_size_t alloc;
+    int complete;               /* buf holds the whole file */
+    struct blockcache_file *blocks; /* For large files, instead of buf */
+    int cache_fd;               /* On the disk cache's copy, or -1 */
+    pthread_mutex_t lock;
+};
+
+/* Per-thread client state, see svnclient_thread() */
+struct svnclient_thread {
+    apr_pool_t *pool;
+    svn_client_ctx_t *ctx;
 };
 
-svn_client_ctx_t *ctx;
 apr_pool_t *pool;
 
 #define apr_to_time_t(x) ((time_t) (x / APR_USEC_PER_SEC))
 
 int svnclient_setup_ctx(void);
 
-int svnclient_list(const char *path, struct dirbuf *dp);
+svn_error_t *svnclient_create_ctx(svn_client_ctx_t **ctxp, apr_pool_t *pool);
+
+struct svnclient_thread *svnclient_thread(void);
+
+int svnclient_uuid(const char **uuid);
+
+int svnclient_repos_path(const char **prefix);
+
+svn_revnum_t svnclient_revnum(void);
+
+int svnclient_history(const char *path, svn_revnum_t *rev, const char **rest);
+
+int svnclient_list(const char *path, struct stat *st);
+
+int svnclient_open(const char *path, svn_revnum_t created_rev,
+        svn_filesize_t size, struct svnclient_handle **hp);
+
+int svnclient_read(struct svnclient_handle *h, char *buf, size_t *size,
+        off_t offset);
+
+int svnclient_read_fd(struct svnclient_handle *h, size_t *size,
+        off_t offset, int *fd);
+
+void svnclient_close(struct svnclient_handle *h);
+
+int svnclient_prefetch(const char *path, svn_revnum_t created_rev);
+
+int svnclient_youngest(svn_revnum_t *rev);
+
+int svnclient_dated(const char *date, svn_revnum_t *rev);
 
-int svnclient_read(struct dirbuf *dp, char *buf, size_t *size, off_t offset);
+int svnclient_catch_up(svn_revnum_t from, svn_revnum_t to);
 
 #endif /* ifndef _HAVE_SVNCLIENT_H */
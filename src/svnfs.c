@@ -16,16 +16,37 @@
 #define _XOPEN_SOURCE 500
 #endif
 
-#define FUSE_USE_VERSION 25
+#define FUSE_USE_VERSION 26
 
 #ifdef HAVE_SETXATTR
 #include <sys/xattr.h>
 #endif
 
 #include <sys/time.h>
+#include <utime.h>
 
 #include "svnfs.h"
 #include "svnclient.h"
+#include "contentcache.h"
+#include "diskcache.h"
+#include "blockcache.h"
+#include "idcache.h"
+#include "rasession.h"
+#include "prefetch.h"
+#include "snapshot.h"
+#include "negcache.h"
+#include "origin.h"
+#include "flight.h"
+#include "stats.h"
+#include "inode.h"
+#include "lowlevel.h"
+#include "writeback.h"
+#include <pthread.h>
+
+/* A pinned revision never changes, so the kernel may keep entries,
+ * attributes and misses for as long as it likes */
+#define SVNFS_PINNED_TIMEOUTS \
+    "-oentry_timeout=86400,attr_timeout=86400,negative_timeout=86400"
 
 /* Debug logging */
 void DEBUG(char *fmt, ...) {
@@ -42,86 +63,166 @@ void DEBUG(char *fmt, ...) {
 
 static struct fuse_opt svnfs_opts[] = { 
     SVNFS_OPT( "debug", debug, 1 ),
+    SVNFS_OPT( "rev=%ld", rev, 0 ),
+    SVNFS_OPT( "unknown_uid=%d", unknown_uid, 0 ),
+    SVNFS_OPT( "unknown_gid=%d", unknown_gid, 0 ),
+    SVNFS_OPT( "cache_size=%s", cache_size_opt, 0 ),
+    SVNFS_OPT( "cache_compress", cache_compress, 1 ),
+    SVNFS_OPT( "meta_size=%s", meta_size_opt, 0 ),
+    SVNFS_OPT( "cache_dir=%s", cache_dir, 0 ),
+    SVNFS_OPT( "cache_dir_size=%s", cache_dir_size_opt, 0 ),
+    SVNFS_OPT( "block_cache_size=%s", block_cache_size_opt, 0 ),
+    SVNFS_OPT( "prefetch_size=%s", prefetch_size_opt, 0 ),
+    SVNFS_OPT( "prefetch_threads=%d", prefetch_threads, 0 ),
+    SVNFS_OPT( "snapshot=%s", snapshot, 0 ),
+    SVNFS_OPT( "snapshot_interval=%d", snapshot_interval, 0 ),
+    SVNFS_OPT( "poll_interval=%d", poll_interval, 0 ),
+    SVNFS_OPT( "ra_local", ra_local, 1 ),
+    SVNFS_OPT( "lowlevel", lowlevel, 1 ),
+    SVNFS_OPT( "rw", rw, 1 ),
+    SVNFS_OPT( "commit_interval=%d", commit_interval, 0 ),
+    SVNFS_OPT( "commit_message=%s", commit_message, 0 ),
     FUSE_OPT_END
 };
 
 /* Filesystem functions */
 
-static int svnfs_getattr(const char *path, struct stat *buf) {
-    struct dirbuf *dp = first;
-    int err;
+/*
+ * Returns ENOENT (or ENOTDIR) if 'path', which isn't in the dircache, is
+ * known not to exist without asking the repository, otherwise 0. When the
+ * dircache is current a completely listed parent is proof enough. Needs
+ * the lock held shared.
+ */
+static int svnfs_missing(const char *path) {
+    struct dirbuf *parent = dircache_lookup_parent(path);
+
+    /* Made up when first looked at, rather than listed in the root */
+    if( !strcmp(path, SVNCLIENT_REV_DIR) )
+        return(0);
+
+    /* Past revisions can't change either */
+    if( svnfs.rev >= 0 || svnfs.poll_interval > 0 ||
+            svnclient_history(path, NULL, NULL) > 0 ) {
+        if( parent && !S_ISDIR(parent->mode) )
+            return(ENOTDIR);
+        if( parent && parent->listed ) {
+            negcache_count_parent_hit();
+            return(ENOENT);
+        }
+    }
+
+    return( negcache_lookup(path) ? ENOENT : 0 );
+}
+
+static int svnfs_repos_getattr(const char *path, struct stat *buf) {
+    struct dirbuf *dp;
+    int err = 0;
 
     DEBUG("svnfs_getattr(): path : '%s'", path);
 
+    if( svnfs.rw && writeback_getattr(path, buf, &err) )
+        return(-err);
+
     memset(buf, 0, sizeof(struct stat));
 
-    if( strcmp(path, "/") == 0 ) {
-        buf->st_mode = S_IFDIR | 0755; /* 34236 */
-        buf->st_nlink = 2;
-        return(0);
-    } else {
-        while( dp && dp->name ) {
-            if( !(strncmp(path, dp->name, strlen(path))) ) {
-	      goto svnfs_getattr_exit;
-	      return(0);
-            }
-            dp = dp->next;
-        }
-    }
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL )
+        dircache_stat(dp, buf);
+    else
+        err = svnfs_missing(path);
+    dircache_unlock();
+    if( err )
+        return(-err);
 
     /* Need to check the repository - not in the cache */
-    if( (err = svnclient_list(path, dp)) ) {
-        return(-err);
+    if( dp == NULL ) {
+        if( (err = svnclient_list(path, buf)) ) {
+            return(-err);
+        }
     }
 
-svnfs_getattr_exit:
-    buf->st_mode = dp->st.st_mode;
-    buf->st_size = dp->st.st_size;
-    buf->st_mtime = dp->st.st_mtime;
-    buf->st_uid = dp->st.st_uid;
-    buf->st_gid = dp->st.st_gid;
     return(0);
 }
 
-static int svnfs_open(const char *path, struct fuse_file_info *fi) {
-    struct dirbuf *dp = first;
+/* Opens the repository's copy of 'path', as the dircache has it */
+static int svnfs_repos_handle(const char *path,
+        struct svnclient_handle **hp) {
+    struct dirbuf *dp;
+    svn_revnum_t rev = SVN_INVALID_REVNUM;
+    svn_filesize_t size = 0;
+
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL ) {
+        rev = dp->rev;
+        size = dp->size;
+    }
+    dircache_unlock();
+    if( dp == NULL )
+        return(ENOENT);
+    return(svnclient_open(path, rev, size, hp));
+}
 
-    (void) fi;
+static int svnfs_repos_open(const char *path, struct fuse_file_info *fi) {
+    struct svnclient_handle *h;
+    int err;
 
     DEBUG("svnfs_open(): path : %s", path);
 
-    while( dp && dp->name ) {
-        if( !(strcmp(dp->name, path)) ) {
-            DEBUG("svnfs_open(): %s", dp->name);
-            return(0);
-        }
-        dp = dp->next;
+    /* Read and written through the pending changes, see svnfs_repos_read() */
+    if( (fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC) ) {
+        if( (err = writeback_open(path, (fi->flags & O_TRUNC) != 0)) )
+            return(-err);
+        fi->fh = 0;
+        return(0);
     }
+    if( svnfs.rw && writeback_has_contents(path) ) {
+        fi->fh = 0;
+        return(0);
+    }
+
+    if( (err = svnfs_repos_handle(path, &h)) )
+        return(-err);
+    fi->fh = (uintptr_t)h;
+
+    /* Contents at a pinned revision can't change under the page cache */
+    if( svnfs.rev >= 0 || svnclient_history(path, NULL, NULL) > 0 )
+        fi->keep_cache = 1;
 
-    return(-ENOENT);
+    return(0);
 }
 
-static int svnfs_read(const char *path, char *buf, size_t size, 
+static int svnfs_repos_read(const char *path, char *buf, size_t size,
        off_t offset, struct fuse_file_info *fi) {
-    struct dirbuf *dp = first;
+    struct svnclient_handle *h = (struct svnclient_handle *)(uintptr_t)fi->fh;
     int err;
-    (void) fi;
 
     DEBUG("svnfs_read(): %d from %s, offset %d", size, path, offset);
-    while( dp && dp->name ) {
-        if( !(strcmp(dp->name, path)) ) {
-            if( offset < dp->st.st_size ) {
-                if( offset + size > dp->st.st_size )
-                    size = dp->st.st_size - offset;
-            } else {
-                size = 0;
-            }
-            break;
-        }
-        dp = dp->next;
+
+    if( svnfs.rw && writeback_read(path, buf, &size, offset, &err) )
+        return( err ? -err : (int)size );
+    if( h == NULL ) {
+        /* Opened for writing and committed since, so read what was
+         * committed, without making it pending again */
+        if( (err = svnfs_repos_handle(path, &h)) )
+            return(-err);
+        if( offset >= h->size )
+            size = 0;
+        else if( size > h->size - offset )
+            size = h->size - offset;
+        if( size )
+            err = svnclient_read(h, buf, &size, offset);
+        svnclient_close(h);
+        return( err ? -err : (int)size );
     }
 
-    if( (err = svnclient_read(dp, buf, &size, offset)) ) {
+    if( offset < h->size ) {
+        if( offset + size > h->size )
+            size = h->size - offset;
+    } else {
+        size = 0;
+    }
+
+    if( size && (err = svnclient_read(h, buf, &size, offset)) ) {
         return(-err);
     }
 
@@ -129,79 +230,808 @@ static int svnfs_read(const char *path, char *buf, size_t size,
     return(size);
 }
 
-static int svnfs_readdir(const char *path, void *buf, 
+
+struct svnfs_readdir_baton {
+    const char *path;
+    void *buf;
+    fuse_fill_dir_t filler;
+};
+
+static int svnfs_readdir_func(void *baton, struct dirbuf *child) {
+    struct svnfs_readdir_baton *rb = baton;
+    struct stat st;
+    char *path;
+    int overlaid = 0;
+
+    if( child->hidden )
+        return(0);
+
+    if( (svnfs.rw || (svnfs.prefetch_threads && S_ISREG(child->mode) &&
+                    child->size <= svnfs.prefetch_size)) &&
+            (path = malloc(strlen(rb->path) + child->namelen + 2)) ) {
+        sprintf(path, "%s/%s", strcmp(rb->path, "/") ? rb->path : "",
+                child->name);
+        /* Listed from the pending changes instead */
+        overlaid = svnfs.rw && writeback_overlaid(path);
+
+        /* Small files in a listed directory are likely to be read next */
+        if( !overlaid && svnfs.prefetch_threads && S_ISREG(child->mode) &&
+                child->size <= svnfs.prefetch_size )
+            prefetch_queue(path, child->rev, child->size);
+        free(path);
+        if( overlaid )
+            return(0);
+    }
+
+    memset(&st, 0, sizeof(st));
+    dircache_stat(child, &st);
+    return(rb->filler(rb->buf, child->name, &st, 0));
+}
+
+static int svnfs_writeback_func(void *baton, const char *name,
+        const struct stat *st) {
+    struct svnfs_readdir_baton *rb = baton;
+
+    return(rb->filler(rb->buf, name, st, 0));
+}
+
+static int svnfs_repos_readdir(const char *path, void *buf,
        fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
-    struct dirbuf *dp = NULL;
+    struct dirbuf *dp;
+    struct svnfs_readdir_baton rb;
+    struct stat st;
+    int listed = 0;
     int err;
 
     (void)fi;
 
     DEBUG("svnfs_readdir(): path : '%s'", path);
 
-    if( (err = svnclient_list(path, dp)) ) {
+    rb.path = path;
+    rb.buf = buf;
+    rb.filler = filler;
+
+    /* A directory made here only has what's been made in it since */
+    if( svnfs.rw && writeback_getattr(path, &st, &err) ) {
+        if( err )
+            return(-err);
+        if( !S_ISDIR(st.st_mode) )
+            return(-ENOTDIR);
+        if( writeback_added(path) ) {
+            filler(buf, ".", NULL, 0);
+            filler(buf, "..", NULL, 0);
+            writeback_children(path, svnfs_writeback_func, &rb);
+            return(0);
+        }
+    }
+
+    /* The dircache only gets populated by svnclient_list(). A complete
+     * listing at a pinned revision is final, and one at HEAD stays current
+     * until the poller sees it change, so don't list it again */
+    if( svnfs.rev >= 0 || svnfs.poll_interval > 0 ||
+            svnclient_history(path, NULL, NULL) > 0 ) {
+        dircache_rdlock();
+        listed = ((dp = dircache_lookup(path)) != NULL && dp->listed);
+        dircache_unlock();
+    }
+    if( !listed ) {
+        if( (err = svnclient_list(path, NULL)) ) {
+            return(-err);
+        }
+    }
+
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) == NULL ) {
+        dircache_unlock();
+        return(-ENOENT);
+    }
+    if( !S_ISDIR(dp->mode) ) {
+        dircache_unlock();
+        return(-ENOTDIR);
+    }
+
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    dircache_foreach(dp, svnfs_readdir_func, &rb);
+    dircache_unlock();
+    if( svnfs.rw )
+        writeback_children(path, svnfs_writeback_func, &rb);
+
+    return(0);
+}
+
+/*
+ * The control directory, /.svnfs, lives beside the repository contents
+ * and isn't listed in the root. Its only file, stats, is rendered when
+ * it's opened, so each reader sees one consistent set of counters.
+ */
+
+struct svnfs_control_file {
+    char *data;
+    size_t len;
+};
+
+static int svnfs_is_control(const char *path) {
+    size_t len = strlen(STATS_DIR);
+
+    return( !strncmp(path, STATS_DIR, len) &&
+            (path[len] == '\0' || path[len] == '/') );
+}
+
+static int svnfs_control_getattr(const char *path, struct stat *buf) {
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_uid = getuid();
+    buf->st_gid = getgid();
+    buf->st_mtime = buf->st_ctime = buf->st_atime =
+        svnfs.mnttime.tv_sec;
+
+    if( !strcmp(path, STATS_DIR) ) {
+        buf->st_mode = S_IFDIR | 0555;
+        buf->st_nlink = 2;
+    } else if( !strcmp(path, STATS_FILE) ) {
+        /* The size isn't known until it's opened, hence direct_io */
+        buf->st_mode = S_IFREG | 0444;
+        buf->st_nlink = 1;
+    } else {
+        return(-ENOENT);
+    }
+    return(0);
+}
+
+static int svnfs_control_open(const char *path, struct fuse_file_info *fi) {
+    struct svnfs_control_file *cf;
+    int err;
+
+    if( strcmp(path, STATS_FILE) )
+        return( strcmp(path, STATS_DIR) ? -ENOENT : -EISDIR );
+    if( (fi->flags & O_ACCMODE) != O_RDONLY )
+        return(-EACCES);
+
+    if( (cf = malloc(sizeof(struct svnfs_control_file))) == NULL )
+        return(-ENOMEM);
+    if( (err = stats_render(&cf->data, &cf->len)) ) {
+        free(cf);
         return(-err);
     }
+    fi->fh = (uintptr_t)cf;
+    fi->direct_io = 1;
+    return(0);
+}
+
+static int svnfs_control_read(char *buf, size_t size, off_t offset,
+        struct fuse_file_info *fi) {
+    struct svnfs_control_file *cf =
+        (struct svnfs_control_file *)(uintptr_t)fi->fh;
 
-    /* The dirbuf linked list only gets populated by svnclient_list() */
-    dp = first; 
+    if( offset >= cf->len )
+        return(0);
+    if( size > cf->len - offset )
+        size = cf->len - offset;
+    memcpy(buf, cf->data + offset, size);
+    return(size);
+}
+
+static int svnfs_control_readdir(const char *path, void *buf,
+        fuse_fill_dir_t filler) {
+    if( strcmp(path, STATS_DIR) )
+        return( strcmp(path, STATS_FILE) ? -ENOENT : -ENOTDIR );
 
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    while( dp && dp->name ) {
-        if( strlen(path) > 1 ) { /* path is other than '/' */
-
-            /* If the start of the dirbuf path matches the requested path 
-             *
-             * And the length of the dirbuf path is greater than the 
-             * requested path 
-             *
-             * And the length of the requested path matches the length of 
-             * the dirbuf path up to the last '/' character (prevents 
-             * returning subdirectory contents) */
-            if( (strncmp(dp->name, path, strlen(path)) == 0) &&
-                    (strlen(dp->name) > strlen(path)) &&
-                    ((strlen(path)) == 
-                     (strlen(dp->name) - strlen(rindex(dp->name, '/')))) ) {
-                if( filler(buf, (rindex(dp->name, '/') + 1), &(dp->st), 0) )
-                    break;
-            }
-        } else { /* path is '/' */
-            if( strstr((dp->name + 1), "/") == NULL ) {
-                if( filler(buf, (dp->name + 1), &(dp->st), 0) )
-                    break;
-            }
+    filler(buf, STATS_FILE + strlen(STATS_DIR) + 1, NULL, 0);
+    return(0);
+}
+
+/*
+ * /@date/DATE is a symlink to the revision which was youngest at DATE,
+ * eg. /@date/2007-06-01 -> ../@rev/1234. /@date itself can't be listed,
+ * as any date will do.
+ */
+
+static int svnfs_is_dated(const char *path) {
+    size_t len = strlen(SVNCLIENT_DATE_DIR);
+
+    return( !strncmp(path, SVNCLIENT_DATE_DIR, len) &&
+            (path[len] == '\0' || path[len] == '/') );
+}
+
+/* Places the target of /@date/DATE in 'buf' */
+static int svnfs_dated_target(const char *path, char *buf, size_t size) {
+    const char *date = path + strlen(SVNCLIENT_DATE_DIR);
+    svn_revnum_t rev;
+    int err;
+
+    if( *date++ != '/' || *date == '\0' || strchr(date, '/') )
+        return(ENOENT);
+    if( (err = svnclient_dated(date, &rev)) )
+        return(err);
+    snprintf(buf, size, "..%s/%ld", SVNCLIENT_REV_DIR, (long)rev);
+    return(0);
+}
+
+static int svnfs_dated_getattr(const char *path, struct stat *buf) {
+    char target[64];
+    int err;
+
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_uid = getuid();
+    buf->st_gid = getgid();
+    buf->st_mtime = buf->st_ctime = buf->st_atime =
+        svnfs.mnttime.tv_sec;
+
+    if( !strcmp(path, SVNCLIENT_DATE_DIR) ) {
+        buf->st_mode = S_IFDIR | 0555;
+        buf->st_nlink = 2;
+        return(0);
+    }
+    if( (err = svnfs_dated_target(path, target, sizeof(target))) )
+        return(-err);
+    buf->st_mode = S_IFLNK | 0777;
+    buf->st_nlink = 1;
+    buf->st_size = strlen(target);
+    return(0);
+}
+
+static int svnfs_dated_readdir(const char *path, void *buf,
+        fuse_fill_dir_t filler) {
+    if( strcmp(path, SVNCLIENT_DATE_DIR) )
+        return(-ENOTDIR);
+
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    return(0);
+}
+
+/*
+ * Returns 0 if 'path' may be changed, else EROFS: everything does without
+ * -o rw, as do pinned mounts, past revisions, and /.svnfs and /@date.
+ */
+static int svnfs_writable(const char *path) {
+    if( !svnfs.rw || svnfs.rev >= 0 || svnfs_is_control(path) ||
+            svnfs_is_dated(path) || !strcmp(path, SVNCLIENT_REV_DIR) ||
+            svnclient_history(path, NULL, NULL) )
+        return(EROFS);
+    return(0);
+}
+
+/*
+ * The operations proper: each is timed for the stats unless it's for the
+ * control directory.
+ */
+
+static int svnfs_getattr(const char *path, struct stat *buf) {
+    struct timespec start;
+    int ret;
+
+    if( svnfs_is_control(path) )
+        return(svnfs_control_getattr(path, buf));
+    if( svnfs_is_dated(path) )
+        return(svnfs_dated_getattr(path, buf));
+
+    stats_start(&start);
+    ret = svnfs_repos_getattr(path, buf);
+    stats_op(STATS_GETATTR, &start, ret < 0);
+    return(ret);
+}
+
+static int svnfs_open(const char *path, struct fuse_file_info *fi) {
+    struct timespec start;
+    int ret;
+
+    if( svnfs_is_control(path) )
+        return(svnfs_control_open(path, fi));
+    if( svnfs_is_dated(path) )
+        return( strcmp(path, SVNCLIENT_DATE_DIR) ? -ELOOP : -EISDIR );
+    if( ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC)) &&
+            (ret = svnfs_writable(path)) )
+        return(-ret);
+
+    stats_start(&start);
+    ret = svnfs_repos_open(path, fi);
+    stats_op(STATS_OPEN, &start, ret < 0);
+    return(ret);
+}
+
+static int svnfs_read(const char *path, char *buf, size_t size,
+       off_t offset, struct fuse_file_info *fi) {
+    struct timespec start;
+    int ret;
+
+    if( svnfs_is_control(path) )
+        return(svnfs_control_read(buf, size, offset, fi));
+
+    stats_start(&start);
+    ret = svnfs_repos_read(path, buf, size, offset, fi);
+    stats_op(STATS_READ, &start, ret < 0);
+    return(ret);
+}
+
+#if FUSE_VERSION >= 29
+/*
+ * read() for libfuse 2.9 and up. A read which a cache file holds is handed
+ * back as that file, for libfuse to splice to the kernel instead of
+ * copying it through here; anything else is read as usual.
+ */
+static int svnfs_read_buf(const char *path, struct fuse_bufvec **bufp,
+        size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct fuse_bufvec init = FUSE_BUFVEC_INIT(size);
+    struct svnclient_handle *h;
+    struct fuse_bufvec *bv;
+    struct timespec start;
+    int fd, ret;
+
+    if( (bv = malloc(sizeof(struct fuse_bufvec))) == NULL )
+        return(-ENOMEM);
+    *bv = init;
+
+    h = (struct svnclient_handle *)(uintptr_t)fi->fh;
+    if( !svnfs_is_control(path) && h &&
+            !(svnfs.rw && writeback_has_contents(path)) ) {
+        stats_start(&start);
+        if( offset >= h->size )
+            size = 0;
+        else if( size > h->size - offset )
+            size = h->size - offset;
+        if( size && svnclient_read_fd(h, &size, offset, &fd) ) {
+            bv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+            bv->buf[0].fd = fd;
+            bv->buf[0].pos = offset;
+            bv->buf[0].size = size;
+            stats_op(STATS_READ, &start, 0);
+            *bufp = bv;
+            return(0);
         }
-        dp = dp->next;
     }
 
+    /* Freed by libfuse, as is bv */
+    if( (bv->buf[0].mem = malloc(size ? size : 1)) == NULL ) {
+        free(bv);
+        return(-ENOMEM);
+    }
+    if( (ret = svnfs_read(path, bv->buf[0].mem, size, offset, fi)) < 0 ) {
+        free(bv->buf[0].mem);
+        free(bv);
+        return(ret);
+    }
+    bv->buf[0].size = ret;
+    *bufp = bv;
+    return(0);
+}
+#endif
+
+static int svnfs_release(const char *path, struct fuse_file_info *fi) {
+    struct svnfs_control_file *cf;
+
+    DEBUG("svnfs_release(): path : %s", path);
+
+    if( svnfs_is_control(path) ) {
+        cf = (struct svnfs_control_file *)(uintptr_t)fi->fh;
+        free(cf->data);
+        free(cf);
+    } else if( fi->fh ) {
+        svnclient_close((struct svnclient_handle *)(uintptr_t)fi->fh);
+    }
+    return(0);
+}
+
+static int svnfs_readlink(const char *path, char *buf, size_t size) {
+    int err;
+
+    if( !svnfs_is_dated(path) )
+        return(-EINVAL);
+    if( (err = svnfs_dated_target(path, buf, size)) )
+        return(-err);
     return(0);
 }
 
+static int svnfs_readdir(const char *path, void *buf,
+       fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
+    struct timespec start;
+    int ret;
+
+    if( svnfs_is_control(path) )
+        return(svnfs_control_readdir(path, buf, filler));
+    if( svnfs_is_dated(path) )
+        return(svnfs_dated_readdir(path, buf, filler));
+
+    stats_start(&start);
+    ret = svnfs_repos_readdir(path, buf, filler, offset, fi);
+    stats_op(STATS_READDIR, &start, ret < 0);
+    return(ret);
+}
+
+/*
+ * Changes, with -o rw. They're kept by writeback.c until the next commit;
+ * only files and directories can be versioned, so there are no symlinks,
+ * hard links or device nodes.
+ */
+
+static int svnfs_create(const char *path, mode_t mode,
+        struct fuse_file_info *fi) {
+    int err;
+
+    DEBUG("svnfs_create(): path : %s, mode %o", path, mode);
+
+    if( (err = svnfs_writable(path)) ||
+            (err = writeback_create(path, S_IFREG | (mode & 07777))) )
+        return(-err);
+    fi->fh = 0;
+    return(0);
+}
+
+static int svnfs_mknod(const char *path, mode_t mode, dev_t rdev) {
+    int err;
+
+    (void)rdev;
+
+    if( !S_ISREG(mode) )
+        return(-EPERM);
+    if( (err = svnfs_writable(path)) ||
+            (err = writeback_create(path, S_IFREG | (mode & 07777))) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_mkdir(const char *path, mode_t mode) {
+    int err;
+
+    DEBUG("svnfs_mkdir(): path : %s, mode %o", path, mode);
+
+    if( (err = svnfs_writable(path)) ||
+            (err = writeback_create(path, S_IFDIR | (mode & 07777))) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_unlink(const char *path) {
+    int err;
+
+    DEBUG("svnfs_unlink(): path : %s", path);
+
+    if( (err = svnfs_writable(path)) || (err = writeback_unlink(path)) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_rmdir(const char *path) {
+    int err;
+
+    DEBUG("svnfs_rmdir(): path : %s", path);
+
+    if( (err = svnfs_writable(path)) || (err = writeback_rmdir(path)) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_rename(const char *from, const char *to) {
+    int err;
+
+    DEBUG("svnfs_rename(): %s to %s", from, to);
+
+    if( (err = svnfs_writable(from)) || (err = svnfs_writable(to)) ||
+            (err = writeback_rename(from, to)) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_truncate(const char *path, off_t size) {
+    int err;
+
+    DEBUG("svnfs_truncate(): path : %s, size %lld", path, (long long)size);
+
+    if( (err = svnfs_writable(path)) || (err = writeback_truncate(path, size)) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_chmod(const char *path, mode_t mode) {
+    int err;
+
+    DEBUG("svnfs_chmod(): path : %s, mode %o", path, mode);
+
+    if( (err = svnfs_writable(path)) || (err = writeback_chmod(path, mode)) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_chown(const char *path, uid_t uid, gid_t gid) {
+    int err;
+
+    DEBUG("svnfs_chown(): path : %s, %d:%d", path, (int)uid, (int)gid);
+
+    if( (err = svnfs_writable(path)) ||
+            (err = writeback_chown(path, uid, gid)) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_utime(const char *path, struct utimbuf *buf) {
+    int err;
+
+    if( (err = svnfs_writable(path)) ||
+            (err = writeback_utime(path, buf ? buf->modtime : time(NULL))) )
+        return(-err);
+    return(0);
+}
+
+static int svnfs_write(const char *path, const char *buf, size_t size,
+        off_t offset, struct fuse_file_info *fi) {
+    struct timespec start;
+    int err;
+
+    (void)fi;
+
+    DEBUG("svnfs_write(): %lu to %s, offset %lld", (unsigned long)size, path,
+            (long long)offset);
+
+    stats_start(&start);
+    err = writeback_write(path, buf, size, offset);
+    stats_op(STATS_WRITE, &start, err);
+    return( err ? -err : (int)size );
+}
+
+/* Commits everything pending, not just 'path' */
+static int svnfs_fsync(const char *path, int datasync,
+        struct fuse_file_info *fi) {
+    int err;
+
+    (void)datasync;
+    (void)fi;
+
+    DEBUG("svnfs_fsync(): path : %s", path);
+
+    if( svnfs.rw && (err = writeback_commit()) )
+        return(-err);
+    return(0);
+}
+
+/* Writes a snapshot every snapshot_interval seconds */
+static void *svnfs_snapshot_thread(void *arg) {
+    (void)arg;
+
+    while( 1 ) {
+        sleep(svnfs.snapshot_interval);
+        snapshot_write(svnfs.snapshot);
+    }
+    return(NULL);
+}
+
+/*
+ * Checks for new revisions every poll_interval seconds, and forgets
+ * whatever they changed. Nothing else in the dircache ever goes stale.
+ */
+static void *svnfs_poll_thread(void *arg) {
+    svn_revnum_t head, rev;
+
+    (void)arg;
+
+    while( 1 ) {
+        sleep(svnfs.poll_interval);
+        if( svnclient_youngest(&head) )
+            continue;
+
+        dircache_rdlock();
+        rev = dircache_get_rev();
+        dircache_unlock();
+
+        if( !SVN_IS_VALID_REVNUM(rev) ) {
+            /* The revision at mount is unknown, so trust nothing */
+            dircache_wrlock();
+            dircache_remove(dircache_root());
+            negcache_clear();
+            dircache_set_rev(head);
+            dircache_unlock();
+        } else if( head > rev ) {
+            svnclient_catch_up(rev, head);
+        }
+    }
+    return(NULL);
+}
+
+/* Commits pending changes every commit_interval seconds */
+static void *svnfs_commit_thread(void *arg) {
+    (void)arg;
+
+    while( 1 ) {
+        sleep(svnfs.commit_interval);
+        writeback_commit();
+    }
+    return(NULL);
+}
+
+static void svnfs_start_thread(void *(*func)(void *), const char *what) {
+    pthread_t thread;
+
+    if( pthread_create(&thread, NULL, func, NULL) )
+        syslog(LOG_ERR, "Can't start %s thread - %s", what, strerror(errno));
+    else
+        pthread_detach(thread);
+}
+
+/* Called once FUSE has forked, so threads started here survive */
+static void *svnfs_init(struct fuse_conn_info *conn) {
+#ifdef FUSE_CAP_SPLICE_WRITE
+    /* So that svnfs_read_buf()'s cache files reach the kernel uncopied */
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+#else
+    (void)conn;
+#endif
+
+    if( svnfs.snapshot && svnfs.snapshot_interval > 0 )
+        svnfs_start_thread(svnfs_snapshot_thread, "snapshot");
+    if( svnfs.rev < 0 && svnfs.poll_interval > 0 )
+        svnfs_start_thread(svnfs_poll_thread, "poll");
+    if( svnfs.rw && svnfs.commit_interval > 0 )
+        svnfs_start_thread(svnfs_commit_thread, "commit");
+    return(NULL);
+}
+
+static void svnfs_destroy(void *private_data) {
+    struct dircache_stats ms;
+    struct contentcache_stats cs;
+    struct diskcache_stats ds;
+    struct blockcache_stats bs;
+    struct rasession_stats rs;
+    struct prefetch_stats ps;
+    struct negcache_stats ns;
+    struct origin_stats os;
+    struct flight_stats fs;
+    struct writeback_stats ws;
+
+    (void)private_data;
+
+    /* The pending changes only live in unlinked files */
+    if( svnfs.rw && writeback_commit() )
+        syslog(LOG_ERR, "Can't commit pending changes at unmount, "
+                "they're lost");
+
+    if( svnfs.snapshot && snapshot_write(svnfs.snapshot) )
+        syslog(LOG_ERR, "Can't write snapshot %s", svnfs.snapshot);
+
+    dircache_get_stats(&ms);
+    syslog(LOG_INFO, "metadata: %lu nodes, %lu/%lu bytes (%lu in names, "
+            "%lu in node slabs), %llu subtrees (%llu nodes) evicted",
+            (unsigned long)ms.nodes, (unsigned long)ms.bytes,
+            (unsigned long)ms.limit, (unsigned long)ms.names,
+            (unsigned long)ms.slabs, (unsigned long long)ms.evictions,
+            (unsigned long long)ms.evicted);
+    contentcache_get_stats(&cs);
+    syslog(LOG_INFO, "content cache: %llu hits, %llu misses, "
+            "%llu evictions, %lu files, %lu/%lu bytes",
+            (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+            (unsigned long long)cs.evictions, (unsigned long)cs.entries,
+            (unsigned long)cs.bytes, (unsigned long)cs.limit);
+    if( svnfs.cache_compress )
+        syslog(LOG_INFO, "content cache: %llu files compressed, %llu "
+                "inflated back, %lu held in %lu/%lu bytes, %llu reads "
+                "inflated in %llu us",
+                (unsigned long long)cs.compressions,
+                (unsigned long long)cs.promotions,
+                (unsigned long)cs.compressed,
+                (unsigned long)cs.compressed_bytes,
+                (unsigned long)cs.compressed_len,
+                (unsigned long long)cs.inflates,
+                (unsigned long long)(cs.inflate_ns / 1000));
+    if( svnfs.cache_dir ) {
+        diskcache_get_stats(&ds);
+        syslog(LOG_INFO, "disk cache: %llu hits, %llu misses, "
+                "%llu evictions, %lu files, %llu/%llu bytes",
+                (unsigned long long)ds.hits, (unsigned long long)ds.misses,
+                (unsigned long long)ds.evictions, (unsigned long)ds.entries,
+                (unsigned long long)ds.bytes, (unsigned long long)ds.limit);
+    }
+    if( svnfs.block_cache_size ) {
+        blockcache_get_stats(&bs);
+        syslog(LOG_INFO, "block cache: %llu hits, %llu misses, "
+                "%llu evictions, %lu files, %llu/%llu bytes",
+                (unsigned long long)bs.hits, (unsigned long long)bs.misses,
+                (unsigned long long)bs.evictions, (unsigned long)bs.entries,
+                (unsigned long long)bs.bytes, (unsigned long long)bs.limit);
+    }
+    rasession_get_stats(&rs);
+    syslog(LOG_INFO, "ra sessions: %llu opened, %llu reused, %llu discarded",
+            (unsigned long long)rs.opened, (unsigned long long)rs.reused,
+            (unsigned long long)rs.discarded);
+    negcache_get_stats(&ns);
+    syslog(LOG_INFO, "negative cache: %llu hits, %llu from listed parents, "
+            "%lu paths", (unsigned long long)ns.hits,
+            (unsigned long long)ns.parent_hits, (unsigned long)ns.entries);
+    origin_get_stats(&os);
+    syslog(LOG_INFO, "copies: %llu origins looked up, %llu elsewhere, "
+            "%llu files (%llu bytes) and %llu listings shared",
+            (unsigned long long)os.lookups, (unsigned long long)os.copies,
+            (unsigned long long)os.files, (unsigned long long)os.bytes,
+            (unsigned long long)os.listings);
+    flight_get_stats(&fs);
+    syslog(LOG_INFO, "coalescing: %llu listings and %llu fetches waited "
+            "%llu/%llu us on another's",
+            (unsigned long long)fs.kinds[FLIGHT_LIST].waits,
+            (unsigned long long)fs.kinds[FLIGHT_READ].waits,
+            (unsigned long long)(fs.kinds[FLIGHT_LIST].wait_ns / 1000),
+            (unsigned long long)(fs.kinds[FLIGHT_READ].wait_ns / 1000));
+    if( svnfs.rw ) {
+        writeback_get_stats(&ws);
+        syslog(LOG_INFO, "writes: %llu commits (%llu paths), %llu failed, "
+                "%llu bytes written, %llu sent",
+                (unsigned long long)ws.commits, (unsigned long long)ws.paths,
+                (unsigned long long)ws.failed,
+                (unsigned long long)ws.written,
+                (unsigned long long)ws.sent);
+    }
+    if( svnfs.prefetch_threads ) {
+        prefetch_get_stats(&ps);
+        syslog(LOG_INFO, "prefetch: %llu queued, %llu fetched, %llu used, "
+                "%llu evicted unused, %llu dropped, %llu cancelled, "
+                "%llu failed",
+                (unsigned long long)ps.queued, (unsigned long long)ps.fetched,
+                (unsigned long long)cs.prefetch_used,
+                (unsigned long long)cs.prefetch_unused,
+                (unsigned long long)ps.dropped,
+                (unsigned long long)ps.cancelled,
+                (unsigned long long)ps.failed);
+    }
+}
+
 /* End filesystem functions */
 
 static struct fuse_operations svnfs_oper = {
     /*
+    .symlink = svnfs_symlink,
+    .link = svnfs_link,
+    .statfs = svnfs_statfs,
+    */
+    .create = svnfs_create,
     .mknod = svnfs_mknod,
     .mkdir = svnfs_mkdir,
     .unlink = svnfs_unlink,
     .rmdir = svnfs_rmdir,
-    .symlink = svnfs_symlink,
     .rename = svnfs_rename,
-    .link = svnfs_link,
     .chmod = svnfs_chmod,
     .truncate = svnfs_truncate,
     .write = svnfs_write,
-    .readlink = svnfs_readlink,
+    .fsync = svnfs_fsync,
     .chown = svnfs_chown,
     .utime = svnfs_utime,
-    .statfs = svnfs_statfs,
-    */
     .getattr = svnfs_getattr,
     .open = svnfs_open,
     .read = svnfs_read,
-    .readdir = svnfs_readdir
+#if FUSE_VERSION >= 29
+    .read_buf = svnfs_read_buf,
+#endif
+    .release = svnfs_release,
+    .readdir = svnfs_readdir,
+    .readlink = svnfs_readlink,
+    .init = svnfs_init,
+    .destroy = svnfs_destroy
 };
 
+/* Parses a byte count with an optional K, M or G suffix */
+static int svnfs_parse_size(const char *arg, size_t *size) {
+    char *end;
+    unsigned long long val;
+
+    val = strtoull(arg, &end, 10);
+    if( end == arg )
+        return(1);
+    switch( *end ) {
+        case 'g': case 'G':
+            val <<= 10;
+            /* fall through */
+        case 'm': case 'M':
+            val <<= 10;
+            /* fall through */
+        case 'k': case 'K':
+            val <<= 10;
+            end++;
+            break;
+    }
+    if( *end != '\0' )
+        return(1);
+
+    *size = val;
+    return(0);
+}
+
 int svnfs_parse_opts(void *data, const char *arg, int key, 
        struct fuse_args *outargs) {
 
@@ -226,11 +1056,54 @@ int svnfs_parse_opts(void *data, const char *arg, int key,
     return(1);
 }
 
+/*
+ * Records the revision the dircache starts out up to date with, for the
+ * poller and snapshots. The dircache is warmed from the snapshot file if
+ * there is one, then whatever has changed since it was written forgotten.
+ */
+static void svnfs_start_rev(void) {
+    svn_revnum_t head, rev = SVN_INVALID_REVNUM;
+
+    if( svnclient_youngest(&head) )
+        return;
+
+    if( svnfs.snapshot )
+        rev = snapshot_load(svnfs.snapshot, head);
+    if( SVN_IS_VALID_REVNUM(rev) && svnclient_catch_up(rev, head) ) {
+        /* Without the log there's no telling what's still current */
+        dircache_wrlock();
+        dircache_remove(dircache_root());
+        dircache_unlock();
+    }
+
+    dircache_wrlock();
+    dircache_set_rev(head);
+    dircache_unlock();
+}
+
+/* Where the block cache spills to: cache_dir, else the temporary directory */
+static const char *svnfs_spill_dir(void) {
+    const char *dir;
+
+    if( svnfs.cache_dir )
+        return(svnfs.cache_dir);
+    if( (dir = getenv("TMPDIR")) != NULL && *dir )
+        return(dir);
+    return("/tmp");
+}
+
 int main(int argc, char *argv[]) {
 
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char timeouts[64];
 
     svnfs.debug = 1;
+    svnfs.rev = -1;
+    svnfs.unknown_uid = -1;
+    svnfs.unknown_gid = -1;
+    svnfs.prefetch_threads = SVNFS_DEFAULT_PREFETCH_THREADS;
+    svnfs.poll_interval = SVNFS_DEFAULT_POLL_INTERVAL;
+    svnfs.commit_interval = SVNFS_DEFAULT_COMMIT_INTERVAL;
     openlog("svnfs", LOG_CONS, LOG_DAEMON);
 
     if( fuse_opt_parse(&args, &svnfs, svnfs_opts, svnfs_parse_opts) == -1 ) {
@@ -245,11 +1118,88 @@ int main(int argc, char *argv[]) {
     while( svnfs.svnpath[strlen(svnfs.svnpath)-1] == '/' )
         svnfs.svnpath[strlen(svnfs.svnpath)-1] = '\0';
 
+    if( svnfs.rw && svnfs.rev >= 0 ) {
+        fprintf(stderr, "A pinned revision can't be written to\n");
+        exit(1);
+    }
+    if( !svnfs.commit_message )
+        svnfs.commit_message = SVNFS_DEFAULT_COMMIT_MESSAGE;
+
+    if( svnfs.lowlevel ) {
+        /* Timeouts are given per node; see lowlevel.c */
+    } else if( svnfs.rev >= 0 ) {
+        /* Inserted ahead of the user's own options so they can override */
+        fuse_opt_insert_arg(&args, 1, SVNFS_PINNED_TIMEOUTS);
+    } else {
+        /* Misses are only cached until the next revision could show up */
+        snprintf(timeouts, sizeof(timeouts), "-onegative_timeout=%d",
+                svnfs.poll_interval > 0 ? svnfs.poll_interval : NEGCACHE_TTL);
+        fuse_opt_insert_arg(&args, 1, timeouts);
+    }
+
+    svnfs.cache_size = SVNFS_DEFAULT_CACHE_SIZE;
+    if( svnfs.cache_size_opt &&
+            svnfs_parse_size(svnfs.cache_size_opt, &svnfs.cache_size) ) {
+        fprintf(stderr, "Invalid cache_size '%s'\n", svnfs.cache_size_opt);
+        exit(1);
+    }
+    svnfs.meta_size = SVNFS_DEFAULT_META_SIZE;
+    if( svnfs.meta_size_opt &&
+            svnfs_parse_size(svnfs.meta_size_opt, &svnfs.meta_size) ) {
+        fprintf(stderr, "Invalid meta_size '%s'\n", svnfs.meta_size_opt);
+        exit(1);
+    }
+    svnfs.cache_dir_size = SVNFS_DEFAULT_CACHE_DIR_SIZE;
+    if( svnfs.cache_dir_size_opt &&
+            svnfs_parse_size(svnfs.cache_dir_size_opt,
+                &svnfs.cache_dir_size) ) {
+        fprintf(stderr, "Invalid cache_dir_size '%s'\n",
+                svnfs.cache_dir_size_opt);
+        exit(1);
+    }
+    svnfs.block_cache_size = SVNFS_DEFAULT_BLOCK_CACHE_SIZE;
+    if( svnfs.block_cache_size_opt &&
+            svnfs_parse_size(svnfs.block_cache_size_opt,
+                &svnfs.block_cache_size) ) {
+        fprintf(stderr, "Invalid block_cache_size '%s'\n",
+                svnfs.block_cache_size_opt);
+        exit(1);
+    }
+    svnfs.prefetch_size = SVNFS_DEFAULT_PREFETCH_SIZE;
+    if( svnfs.prefetch_size_opt &&
+            svnfs_parse_size(svnfs.prefetch_size_opt, &svnfs.prefetch_size) ) {
+        fprintf(stderr, "Invalid prefetch_size '%s'\n",
+                svnfs.prefetch_size_opt);
+        exit(1);
+    }
+    /* Prefetched files are kept in the content cache */
+    if( svnfs.cache_size == 0 )
+        svnfs.prefetch_threads = 0;
+
     gettimeofday(&svnfs.mnttime, NULL);
 
     DEBUG("struct svnfs = {");
     DEBUG("\tdebug = %d", svnfs.debug);
     DEBUG("\tsvnpath = %s", svnfs.svnpath);
+    DEBUG("\trev = %ld", svnfs.rev);
+    DEBUG("\tunknown_uid = %d", svnfs.unknown_uid);
+    DEBUG("\tunknown_gid = %d", svnfs.unknown_gid);
+    DEBUG("\tcache_size = %lu", (unsigned long)svnfs.cache_size);
+    DEBUG("\tcache_compress = %d", svnfs.cache_compress);
+    DEBUG("\tmeta_size = %lu", (unsigned long)svnfs.meta_size);
+    DEBUG("\tcache_dir = %s", svnfs.cache_dir ? svnfs.cache_dir : "(none)");
+    DEBUG("\tcache_dir_size = %lu", (unsigned long)svnfs.cache_dir_size);
+    DEBUG("\tblock_cache_size = %lu", (unsigned long)svnfs.block_cache_size);
+    DEBUG("\tprefetch_size = %lu", (unsigned long)svnfs.prefetch_size);
+    DEBUG("\tprefetch_threads = %d", svnfs.prefetch_threads);
+    DEBUG("\tsnapshot = %s", svnfs.snapshot ? svnfs.snapshot : "(none)");
+    DEBUG("\tsnapshot_interval = %d", svnfs.snapshot_interval);
+    DEBUG("\tpoll_interval = %d", svnfs.poll_interval);
+    DEBUG("\tra_local = %d", svnfs.ra_local);
+    DEBUG("\tlowlevel = %d", svnfs.lowlevel);
+    DEBUG("\trw = %d", svnfs.rw);
+    DEBUG("\tcommit_interval = %d", svnfs.commit_interval);
+    DEBUG("\tcommit_message = %s", svnfs.commit_message);
     DEBUG("\tmnttime.tv_sec = %d", svnfs.mnttime.tv_sec);
     DEBUG("}");
 
@@ -257,14 +1207,40 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    if( (first = malloc(sizeof(struct dirbuf))) == NULL ) {
+    if( dircache_init(pool, svnfs.meta_size) ||
+            contentcache_init(svnfs.cache_size, svnfs.cache_compress) ||
+            idcache_init() || inode_init() || origin_init() || flight_init() ||
+            negcache_init(svnfs.rev < 0 && svnfs.poll_interval <= 0) ||
+            prefetch_init(svnfs.prefetch_size, svnfs.prefetch_threads) ) {
         fprintf(stderr, "Error allocating memory - %s\n", strerror(errno));
         exit(1);
     }
-    first->name = NULL;
-    first->next = NULL;
 
-    int err = fuse_main(args.argc, args.argv, &svnfs_oper);
+    if( svnfs.cache_dir ) {
+        const char *uuid, *prefix;
+
+        if( svnclient_uuid(&uuid) || svnclient_repos_path(&prefix) ) {
+            exit(1);
+        }
+        if( diskcache_init(svnfs.cache_dir, uuid, prefix,
+                    svnfs.cache_dir_size) ) {
+            fprintf(stderr, "Error opening cache_dir %s - %s\n",
+                    svnfs.cache_dir, strerror(errno));
+            exit(1);
+        }
+    }
+
+    if( blockcache_init(svnfs_spill_dir(), svnfs.block_cache_size) ||
+            (svnfs.rw && writeback_init(svnfs_spill_dir())) ) {
+        fprintf(stderr, "Error allocating memory - %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if( svnfs.snapshot || (svnfs.rev < 0 && svnfs.poll_interval > 0) )
+        svnfs_start_rev();
+
+    int err = svnfs.lowlevel ? lowlevel_main(&args, &svnfs_oper) :
+        fuse_main(args.argc, args.argv, &svnfs_oper, NULL);
     closelog();
     return err;
 }
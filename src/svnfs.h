@@ -25,20 +25,49 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
+/* Option defaults */
+#define SVNFS_DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+#define SVNFS_DEFAULT_META_SIZE (256 * 1024 * 1024)
+#define SVNFS_DEFAULT_CACHE_DIR_SIZE (1024 * 1024 * 1024)
+#define SVNFS_DEFAULT_BLOCK_CACHE_SIZE (1024 * 1024 * 1024)
+#define SVNFS_DEFAULT_PREFETCH_SIZE (64 * 1024)
+#define SVNFS_DEFAULT_PREFETCH_THREADS 2
+#define SVNFS_DEFAULT_POLL_INTERVAL 10
+#define SVNFS_DEFAULT_COMMIT_INTERVAL 30
+#define SVNFS_DEFAULT_COMMIT_MESSAGE "Committed through svnfs"
+
 struct svnfs {
     int debug; /* Turn on debugging */
     char *svnpath; /* URL to Subversion repository */
     struct timeval mnttime; /* Mount time */
+    long rev; /* Revision pinned with -o rev=, or -1 to follow HEAD */
+    int unknown_uid; /* uid for owners unknown to this host, or -1 */
+    int unknown_gid; /* gid for groups unknown to this host, or -1 */
+    char *cache_size_opt; /* -o cache_size= as given */
+    size_t cache_size; /* Content cache budget in bytes */
+    int cache_compress; /* Compress cold files in the content cache */
+    char *meta_size_opt; /* -o meta_size= as given */
+    size_t meta_size; /* Metadata (dircache) ceiling in bytes, 0 for none */
+    char *cache_dir; /* Directory for the persistent content cache */
+    char *cache_dir_size_opt; /* -o cache_dir_size= as given */
+    size_t cache_dir_size; /* Persistent content cache cap in bytes */
+    char *block_cache_size_opt; /* -o block_cache_size= as given */
+    size_t block_cache_size; /* Spilled blocks of large files, 0 disables */
+    char *prefetch_size_opt; /* -o prefetch_size= as given */
+    size_t prefetch_size; /* Largest file prefetched after a readdir */
+    int prefetch_threads; /* Background prefetch threads, 0 disables */
+    char *snapshot; /* Metadata snapshot file */
+    int snapshot_interval; /* Seconds between snapshots, 0 for unmount only */
+    int poll_interval; /* Seconds between checks for new revisions */
+    int ra_local; /* Read file:// URLs through RA rather than directly */
+    int lowlevel; /* Use the inode based low-level FUSE interface */
+    int rw; /* Allow changes, committed by writeback.c */
+    int commit_interval; /* Seconds between commits, 0 for fsync/unmount */
+    char *commit_message; /* Log message of those commits */
 };
 struct svnfs svnfs;
 
-struct dirbuf {
-    char *name;
-    struct stat st;
-    struct dirbuf *next;
-};
-struct dirbuf *dirbuf;
-struct dirbuf *first;
+#include "dircache.h"
 
 #define SVNCLIENT_NO_ERROR 0
 
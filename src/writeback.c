@@ -0,0 +1,1410 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+
+#include "svnfs.h"
+#include "writeback.h"
+#include "svnclient.h"
+#include "idcache.h"
+#include "negcache.h"
+#include "stats.h"
+#include <syslog.h>
+#include <time.h>
+#include <apr_hash.h>
+#include <apr_md5.h>
+#include <apr_strings.h>
+#include <svn_delta.h>
+#include <svn_md5.h>
+#include <svn_path.h>
+#include <svn_ra.h>
+#include <pthread.h>
+
+/*
+ * Changes made through a -o rw mount. Nothing is sent to the repository
+ * as it's written: each changed path gets a node here holding what it
+ * now is, file contents in an unlinked file in the spill directory, and
+ * every read checks here before the repository, so changes show at once.
+ * A path with no node is as the repository has it, unless a directory
+ * above it has been deleted or made anew here.
+ *
+ * writeback_commit() sends the lot as one revision, through the commit
+ * editor: files as text deltas against the contents they started from,
+ * which are read back through the content caches, and chmod/chown as the
+ * svnfs:mode and svnfs:owner_* properties. The dircache then catches up
+ * with the new revision through the log, as the poller would, and the
+ * nodes are forgotten.
+ *
+ * Changes may run side by side, each taking the lock while it looks at
+ * or alters the index, and dropping it to go to the repository. A commit
+ * waits for those under way to finish and holds off new ones until it's
+ * done, so the nodes it's sending stay put; reads carry on regardless.
+ */
+
+#define WRITEBACK_TEMPLATE "svnfs-write.XXXXXX"
+
+struct writeback_node {
+    char *path;
+    apr_uint64_t gen;           /* Tells it from a later node at path */
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    time_t mtime;
+    int fd;                     /* Contents, or -1 while they're from's */
+    svn_revnum_t rev;           /* Last changed revision, if in_repo */
+    char *from;                 /* Contents started as this path ... */
+    svn_revnum_t from_rev;      /* ... at this last changed revision */
+    off_t from_size;
+    char *owner;                /* svnfs:owner_user to set, or NULL */
+    char *group;                /* svnfs:owner_group to set, or NULL */
+    unsigned int in_repo : 1;   /* The repository has a node at path */
+    unsigned int added : 1;     /* Made here, replacing any it has */
+    unsigned int copied : 1;    /* ... as a copy of from, with its history */
+    unsigned int deleted : 1;
+    unsigned int dirty : 1;     /* Contents differ from from's */
+    unsigned int mode_set : 1;  /* svnfs:mode to set */
+};
+
+/* A commit in progress */
+struct writeback_edit {
+    const svn_delta_editor_t *editor;
+    void *edit_baton;
+    apr_hash_t *nodes;          /* Path relative to the URL -> node */
+    svn_revnum_t rev;           /* Committed */
+    apr_size_t sent;            /* New bytes in the text deltas */
+};
+
+/* Counts the new data in each window of a text delta on its way */
+struct writeback_window_baton {
+    svn_txdelta_window_handler_t handler;
+    void *baton;
+    apr_size_t sent;
+};
+
+/* Reads a repository file through its handle, or a node's contents */
+struct writeback_stream {
+    struct svnclient_handle *h;
+    int fd;
+    off_t offset;
+    off_t size;
+};
+
+typedef svn_error_t *(*writeback_prop_func_t)(void *baton, const char *name,
+        const svn_string_t *value, apr_pool_t *pool);
+
+static pthread_mutex_t writeback_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writeback_cond = PTHREAD_COND_INITIALIZER;
+static int writeback_changing;          /* Changes under way */
+static int writeback_committing;        /* A commit waiting or under way */
+static char *writeback_dir;
+static apr_pool_t *writeback_pool;
+static apr_hash_t *writeback_index;     /* path -> struct writeback_node */
+static apr_uint64_t writeback_gen;
+static struct writeback_stats writeback_stats;
+
+int writeback_init(const char *dir) {
+    if( (writeback_dir = strdup(dir)) == NULL ||
+            apr_pool_create(&writeback_pool, NULL) != APR_SUCCESS )
+        return(1);
+    writeback_index = apr_hash_make(writeback_pool);
+    return(0);
+}
+
+/* Starts a change, once any commit is out of the way */
+static void writeback_begin(void) {
+    pthread_mutex_lock(&writeback_lock);
+    while( writeback_committing )
+        pthread_cond_wait(&writeback_cond, &writeback_lock);
+    writeback_changing++;
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+static void writeback_end(void) {
+    pthread_mutex_lock(&writeback_lock);
+    if( --writeback_changing == 0 )
+        pthread_cond_broadcast(&writeback_cond);
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+/* Returns an fd on a new, already unlinked file, or -1 */
+static int writeback_tmp(void) {
+    char *name;
+    int fd;
+
+    if( (name = malloc(strlen(writeback_dir) +
+                    sizeof(WRITEBACK_TEMPLATE) + 1)) == NULL )
+        return(-1);
+    sprintf(name, "%s/%s", writeback_dir, WRITEBACK_TEMPLATE);
+    if( (fd = mkstemp(name)) >= 0 )
+        unlink(name);
+    else
+        DEBUG("writeback_tmp(): %s: %s", name, strerror(errno));
+    free(name);
+    return(fd);
+}
+
+/* Writes all of 'buf' at 'offset'. Returns 0, or -1 with errno set */
+static int writeback_pwrite(int fd, const char *buf, size_t size,
+        off_t offset) {
+    ssize_t n;
+
+    while( size > 0 ) {
+        if( (n = pwrite(fd, buf, size, offset)) < 0 ) {
+            if( errno == EINTR )
+                continue;
+            return(-1);
+        }
+        buf += n;
+        size -= n;
+        offset += n;
+    }
+    return(0);
+}
+
+static struct writeback_node *writeback_get(const char *path) {
+    return(apr_hash_get(writeback_index, path, APR_HASH_KEY_STRING));
+}
+
+/* Adds a node for 'path', as yet unchanged. The lock must be held */
+static struct writeback_node *writeback_new(const char *path) {
+    struct writeback_node *wn;
+
+    if( (wn = calloc(1, sizeof(struct writeback_node))) == NULL ||
+            (wn->path = strdup(path)) == NULL ) {
+        free(wn);
+        return(NULL);
+    }
+    wn->gen = ++writeback_gen;
+    wn->fd = -1;
+    wn->rev = wn->from_rev = SVN_INVALID_REVNUM;
+    wn->mtime = time(NULL);
+    apr_hash_set(writeback_index, wn->path, APR_HASH_KEY_STRING, wn);
+    writeback_stats.pending++;
+    return(wn);
+}
+
+/* Undoes all changes to 'wn', which stays in the index */
+static void writeback_clear(struct writeback_node *wn) {
+    if( wn->fd >= 0 )
+        close(wn->fd);
+    free(wn->from);
+    free(wn->owner);
+    free(wn->group);
+    wn->fd = -1;
+    wn->from = wn->owner = wn->group = NULL;
+    wn->from_rev = SVN_INVALID_REVNUM;
+    wn->from_size = 0;
+    wn->added = wn->copied = wn->deleted = wn->dirty = wn->mode_set = 0;
+}
+
+/* Removes 'wn' from the index and frees it. The lock must be held */
+static void writeback_drop(struct writeback_node *wn) {
+    apr_hash_set(writeback_index, wn->path, APR_HASH_KEY_STRING, NULL);
+    writeback_stats.pending--;
+    writeback_clear(wn);
+    free(wn->path);
+    free(wn);
+}
+
+/* Deletes 'wn', which is simply forgotten if the repository lacks it */
+static void writeback_remove(struct writeback_node *wn) {
+    if( !wn->in_repo ) {
+        writeback_drop(wn);
+        return;
+    }
+    writeback_clear(wn);
+    wn->deleted = 1;
+}
+
+/* Returns 1 if 'path' is below 'dir' */
+static int writeback_below(const char *path, const char *dir) {
+    size_t len = strlen(dir);
+
+    if( !strcmp(dir, "/") )
+        return( strcmp(path, "/") != 0 );
+    return( !strncmp(path, dir, len) && path[len] == '/' );
+}
+
+/*
+ * Returns 1 if a directory above 'path' has been deleted or made here,
+ * so whatever the repository has at 'path' doesn't show. The lock must
+ * be held.
+ */
+static int writeback_hidden(const char *path) {
+    struct writeback_node *wn;
+    char *p, *slash;
+    int ret = 0;
+
+    if( apr_hash_count(writeback_index) == 0 ||
+            (p = strdup(path)) == NULL )
+        return(0);
+    while( !ret && (slash = strrchr(p, '/')) != NULL && slash != p ) {
+        *slash = '\0';
+        if( (wn = writeback_get(p)) != NULL && (wn->deleted || wn->added) )
+            ret = 1;
+    }
+    free(p);
+    return(ret);
+}
+
+/*
+ * Returns 1 if anything below 'dir' has a node, or only something not
+ * deleted if 'live' is given. The lock must be held.
+ */
+static int writeback_has_below(const char *dir, int live) {
+    struct writeback_node *wn;
+    apr_hash_index_t *hi;
+    void *val;
+
+    for( hi = apr_hash_first(NULL, writeback_index); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        wn = val;
+        if( writeback_below(wn->path, dir) && !(live && wn->deleted) )
+            return(1);
+    }
+    return(0);
+}
+
+static void writeback_stat(const struct writeback_node *wn, struct stat *st) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = wn->mode;
+    st->st_nlink = S_ISDIR(wn->mode) ? 2 : 1;
+    st->st_size = S_ISDIR(wn->mode) ? 0 : wn->size;
+    st->st_mtime = st->st_ctime = st->st_atime = wn->mtime;
+    st->st_uid = wn->uid;
+    st->st_gid = wn->gid;
+}
+
+/*
+ * Looks 'path' up among the pending changes. Returns 1 if they decide it,
+ * with its attributes in 'st' or ENOENT in 'err', or 0 if it's as the
+ * repository has it.
+ */
+int writeback_getattr(const char *path, struct stat *st, int *err) {
+    struct writeback_node *wn;
+    int ret = 1;
+
+    *err = 0;
+    pthread_mutex_lock(&writeback_lock);
+    if( (wn = writeback_get(path)) != NULL && !wn->deleted )
+        writeback_stat(wn, st);
+    else if( wn != NULL || writeback_hidden(path) )
+        *err = ENOENT;
+    else
+        ret = 0;
+    pthread_mutex_unlock(&writeback_lock);
+    return(ret);
+}
+
+/* Returns 1 if 'path' has pending changes, so isn't listed as it was */
+int writeback_overlaid(const char *path) {
+    int ret;
+
+    pthread_mutex_lock(&writeback_lock);
+    ret = (writeback_get(path) != NULL);
+    pthread_mutex_unlock(&writeback_lock);
+    return(ret);
+}
+
+/* Returns 1 if 'path' was made here, so only has pending children */
+int writeback_added(const char *path) {
+    struct writeback_node *wn;
+    int ret;
+
+    pthread_mutex_lock(&writeback_lock);
+    ret = ((wn = writeback_get(path)) != NULL && wn->added);
+    pthread_mutex_unlock(&writeback_lock);
+    return(ret);
+}
+
+/* Returns 1 if reads of 'path' are answered by writeback_read() */
+int writeback_has_contents(const char *path) {
+    struct writeback_node *wn;
+    int ret;
+
+    pthread_mutex_lock(&writeback_lock);
+    ret = ((wn = writeback_get(path)) != NULL && wn->fd >= 0);
+    pthread_mutex_unlock(&writeback_lock);
+    return(ret);
+}
+
+/* Calls 'func' with each child of 'path' which is pending, but not deleted */
+void writeback_children(const char *path, writeback_func_t func,
+        void *baton) {
+    struct writeback_node *wn;
+    apr_hash_index_t *hi;
+    struct stat st;
+    const char *name;
+    void *val;
+
+    pthread_mutex_lock(&writeback_lock);
+    for( hi = apr_hash_first(NULL, writeback_index); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        wn = val;
+        if( wn->deleted || !writeback_below(wn->path, path) )
+            continue;
+        name = wn->path + (strcmp(path, "/") ? strlen(path) + 1 : 1);
+        if( strchr(name, '/') == NULL ) {
+            writeback_stat(wn, &st);
+            if( func(baton, name, &st) )
+                break;
+        }
+    }
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+/*
+ * Reads the pending contents of 'path'. Returns 1 if it has some, having
+ * read up to 'size' bytes at 'offset' and put the length read in 'size',
+ * or an errno in 'err', or 0 if it's to be read from the repository.
+ */
+int writeback_read(const char *path, char *buf, size_t *size, off_t offset,
+        int *err) {
+    struct writeback_node *wn;
+    size_t got = 0;
+    ssize_t n;
+
+    pthread_mutex_lock(&writeback_lock);
+    if( (wn = writeback_get(path)) == NULL || wn->fd < 0 ) {
+        pthread_mutex_unlock(&writeback_lock);
+        return(0);
+    }
+
+    *err = 0;
+    if( offset >= wn->size )
+        *size = 0;
+    else if( *size > wn->size - offset )
+        *size = wn->size - offset;
+    while( got < *size ) {
+        if( (n = pread(wn->fd, buf + got, *size - got, offset + got)) < 0 ) {
+            if( errno == EINTR )
+                continue;
+            *err = errno;
+            break;
+        }
+        if( n == 0 )
+            break;
+        got += n;
+    }
+    *size = got;
+    pthread_mutex_unlock(&writeback_lock);
+    return(1);
+}
+
+/*
+ * Places the repository's attributes for 'path' in 'st', and its last
+ * changed revision in 'rev'. Takes the dircache lock, so mustn't be
+ * called with ours held.
+ */
+static int writeback_base(const char *path, struct stat *st,
+        svn_revnum_t *rev) {
+    struct dirbuf *dp;
+    int err;
+
+    memset(st, 0, sizeof(struct stat));
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL ) {
+        dircache_stat(dp, st);
+        *rev = dp->rev;
+    }
+    dircache_unlock();
+    if( dp != NULL )
+        return(0);
+
+    if( (err = svnclient_list(path, st)) )
+        return(err);
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL )
+        *rev = dp->rev;
+    dircache_unlock();
+    return( dp ? 0 : ENOENT );
+}
+
+/*
+ * Places the attributes of 'path', with the pending changes, in 'st'. 'rev'
+ * gets the last changed revision of what the repository has there, if it
+ * has anything (even if it's since been deleted), else SVN_INVALID_REVNUM.
+ */
+static int writeback_lookup(const char *path, struct stat *st,
+        svn_revnum_t *rev) {
+    struct writeback_node *wn;
+    int err = -1;
+
+    *rev = SVN_INVALID_REVNUM;
+    pthread_mutex_lock(&writeback_lock);
+    if( (wn = writeback_get(path)) != NULL ) {
+        if( wn->in_repo )
+            *rev = wn->rev;
+        if( (err = wn->deleted ? ENOENT : 0) == 0 )
+            writeback_stat(wn, st);
+    } else if( writeback_hidden(path) ) {
+        err = ENOENT;
+    }
+    pthread_mutex_unlock(&writeback_lock);
+
+    if( err >= 0 )
+        return(err);
+    return(writeback_base(path, st, rev));
+}
+
+/* Returns 0 if the parent of 'path' is a directory, with the changes */
+static int writeback_parent(const char *path) {
+    struct stat st;
+    svn_revnum_t rev;
+    char *parent, *slash;
+    int err = 0;
+
+    if( (parent = strdup(path)) == NULL )
+        return(ENOMEM);
+    if( (slash = strrchr(parent, '/')) != NULL && slash != parent ) {
+        *slash = '\0';
+        if( (err = writeback_lookup(parent, &st, &rev)) == 0 &&
+                !S_ISDIR(st.st_mode) )
+            err = ENOTDIR;
+    }
+    free(parent);
+    return(err);
+}
+
+/*
+ * Finds the node for 'path', making one from what the repository has if
+ * it hasn't been changed yet. Returns with the lock held if it succeeds.
+ */
+static int writeback_node(const char *path, struct writeback_node **wnp) {
+    struct writeback_node *wn;
+    struct stat st;
+    svn_revnum_t rev;
+    int err;
+
+    pthread_mutex_lock(&writeback_lock);
+    if( (wn = writeback_get(path)) == NULL && !writeback_hidden(path) ) {
+        pthread_mutex_unlock(&writeback_lock);
+        if( (err = writeback_base(path, &st, &rev)) )
+            return(err);
+        pthread_mutex_lock(&writeback_lock);
+
+        /* Unless another change got there first */
+        if( (wn = writeback_get(path)) == NULL && !writeback_hidden(path) ) {
+            if( (wn = writeback_new(path)) == NULL ) {
+                pthread_mutex_unlock(&writeback_lock);
+                return(ENOMEM);
+            }
+            wn->mode = st.st_mode;
+            wn->uid = st.st_uid;
+            wn->gid = st.st_gid;
+            wn->size = st.st_size;
+            wn->mtime = st.st_mtime;
+            wn->in_repo = 1;
+            wn->rev = rev;
+            if( S_ISREG(st.st_mode) ) {
+                if( (wn->from = strdup(path)) == NULL ) {
+                    writeback_drop(wn);
+                    pthread_mutex_unlock(&writeback_lock);
+                    return(ENOMEM);
+                }
+                wn->from_rev = rev;
+                wn->from_size = st.st_size;
+            }
+        }
+    }
+
+    if( wn == NULL || wn->deleted ) {
+        pthread_mutex_unlock(&writeback_lock);
+        return(ENOENT);
+    }
+    *wnp = wn;
+    return(0);
+}
+
+/*
+ * Opens 'path' as it was at its last changed revision 'rev', rather than
+ * at the mount's, where it may have changed since.
+ */
+static int writeback_open_from(const char *path, svn_revnum_t rev,
+        off_t size, struct svnclient_handle **hp) {
+    char *pegged;
+    int err;
+
+    if( (pegged = malloc(strlen(SVNCLIENT_REV_DIR) + strlen(path) + 32)) ==
+            NULL )
+        return(ENOMEM);
+    sprintf(pegged, "%s/%ld%s", SVNCLIENT_REV_DIR, (long)rev, path);
+    err = svnclient_open(pegged, rev, size, hp);
+    free(pegged);
+    return(err);
+}
+
+/* Copies 'size' bytes of 'path' at last changed revision 'rev' to 'fd' */
+static int writeback_fetch(const char *path, svn_revnum_t rev, off_t size,
+        int fd) {
+    struct svnclient_handle *h;
+    off_t offset;
+    size_t len;
+    char *buf;
+    int err;
+
+    if( (err = writeback_open_from(path, rev, size, &h)) )
+        return(err);
+    if( (buf = malloc(WRITEBACK_CHUNK)) == NULL ) {
+        svnclient_close(h);
+        return(ENOMEM);
+    }
+    for( offset = 0; offset < size; offset += len ) {
+        len = (size - offset > WRITEBACK_CHUNK) ? WRITEBACK_CHUNK :
+            size - offset;
+        if( (err = svnclient_read(h, buf, &len, offset)) )
+            break;
+        if( len == 0 ) {
+            /* Shorter than it was listed as */
+            err = EIO;
+            break;
+        }
+        if( writeback_pwrite(fd, buf, len, offset) ) {
+            err = errno;
+            break;
+        }
+    }
+    free(buf);
+    svnclient_close(h);
+    return(err);
+}
+
+/*
+ * As writeback_node(), for a file whose contents are about to change. A
+ * copy of them is fetched first, unless 'trunc' is given, in which case
+ * it's emptied instead.
+ */
+static int writeback_file(const char *path, int trunc,
+        struct writeback_node **wnp) {
+    struct writeback_node *wn;
+    svn_revnum_t from_rev;
+    apr_uint64_t gen;
+    off_t from_size;
+    char *from;
+    int fd, err;
+
+    while( 1 ) {
+        if( (err = writeback_node(path, &wn)) )
+            return(err);
+        if( S_ISDIR(wn->mode) ) {
+            pthread_mutex_unlock(&writeback_lock);
+            return(EISDIR);
+        }
+        if( wn->fd >= 0 )
+            break;
+        if( trunc ) {
+            if( (wn->fd = writeback_tmp()) < 0 ) {
+                err = errno;
+                pthread_mutex_unlock(&writeback_lock);
+                return(err);
+            }
+            break;
+        }
+
+        /* Fetched without the lock, so nothing else waits for it */
+        gen = wn->gen;
+        from = strdup(wn->from);
+        from_rev = wn->from_rev;
+        from_size = wn->from_size;
+        pthread_mutex_unlock(&writeback_lock);
+        if( from == NULL )
+            return(ENOMEM);
+        if( (fd = writeback_tmp()) < 0 ) {
+            err = errno;
+            free(from);
+            return(err);
+        }
+        err = writeback_fetch(from, from_rev, from_size, fd);
+        free(from);
+        if( err ) {
+            close(fd);
+            return(err);
+        }
+
+        pthread_mutex_lock(&writeback_lock);
+        if( (wn = writeback_get(path)) != NULL && wn->gen == gen &&
+                wn->fd < 0 ) {
+            wn->fd = fd;
+            break;
+        }
+        /* Changed meanwhile, so start again */
+        pthread_mutex_unlock(&writeback_lock);
+        close(fd);
+    }
+
+    if( trunc && wn->size ) {
+        if( ftruncate(wn->fd, 0) ) {
+            err = errno;
+            pthread_mutex_unlock(&writeback_lock);
+            return(err);
+        }
+        wn->size = 0;
+        wn->dirty = 1;
+        wn->mtime = time(NULL);
+    }
+    *wnp = wn;
+    return(0);
+}
+
+/*
+ * Opens 'path' for writing: its contents are fetched now (or emptied,
+ * for O_TRUNC), so the writes to come don't have to.
+ */
+int writeback_open(const char *path, int trunc) {
+    struct writeback_node *wn;
+    int err;
+
+    writeback_begin();
+    if( (err = writeback_file(path, trunc, &wn)) == 0 )
+        pthread_mutex_unlock(&writeback_lock);
+    writeback_end();
+    return(err);
+}
+
+int writeback_write(const char *path, const char *buf, size_t size,
+        off_t offset) {
+    struct writeback_node *wn;
+    int err;
+
+    writeback_begin();
+    if( (err = writeback_file(path, 0, &wn)) == 0 ) {
+        if( writeback_pwrite(wn->fd, buf, size, offset) ) {
+            err = errno;
+        } else {
+            if( offset + size > wn->size )
+                wn->size = offset + size;
+            wn->dirty = 1;
+            wn->mtime = time(NULL);
+            writeback_stats.written += size;
+        }
+        pthread_mutex_unlock(&writeback_lock);
+    }
+    writeback_end();
+    return(err);
+}
+
+int writeback_truncate(const char *path, off_t size) {
+    struct writeback_node *wn;
+    int err;
+
+    writeback_begin();
+    if( (err = writeback_file(path, size == 0, &wn)) == 0 ) {
+        if( ftruncate(wn->fd, size) ) {
+            err = errno;
+        } else {
+            wn->size = size;
+            wn->dirty = 1;
+            wn->mtime = time(NULL);
+        }
+        pthread_mutex_unlock(&writeback_lock);
+    }
+    writeback_end();
+    return(err);
+}
+
+/*
+ * Makes an empty file or directory, as the type in 'mode' says, at 'path'.
+ * Permissions other than the default become svnfs:mode. The owner is
+ * shown as it will be once committed, ie. as root unless chowned.
+ */
+int writeback_create(const char *path, mode_t mode) {
+    struct writeback_node *wn;
+    struct stat st;
+    svn_revnum_t rev;
+    int err;
+
+    writeback_begin();
+    if( (err = writeback_parent(path)) == 0 &&
+            (err = writeback_lookup(path, &st, &rev)) == 0 )
+        err = EEXIST;
+    if( err != ENOENT ) {
+        writeback_end();
+        return(err);
+    }
+
+    err = 0;
+    pthread_mutex_lock(&writeback_lock);
+    if( (wn = writeback_get(path)) != NULL && !wn->deleted ) {
+        err = EEXIST;
+    } else if( wn == NULL && (wn = writeback_new(path)) == NULL ) {
+        err = ENOMEM;
+    } else {
+        /* Replaces what the repository has, if it was deleted here */
+        wn->deleted = 0;
+        wn->added = 1;
+        wn->mode = mode;
+        wn->mode_set = ((mode & 07777) != WRITEBACK_DEFAULT_PERMS);
+        wn->uid = 0;
+        wn->gid = 0;
+        wn->size = 0;
+        wn->mtime = time(NULL);
+        if( S_ISREG(mode) ) {
+            wn->dirty = 1;
+            if( (wn->fd = writeback_tmp()) < 0 ) {
+                err = errno;
+                writeback_remove(wn);
+            }
+        }
+    }
+    pthread_mutex_unlock(&writeback_lock);
+    writeback_end();
+    return(err);
+}
+
+int writeback_unlink(const char *path) {
+    struct writeback_node *wn;
+    int err;
+
+    writeback_begin();
+    if( (err = writeback_node(path, &wn)) == 0 ) {
+        if( S_ISDIR(wn->mode) )
+            err = EISDIR;
+        else
+            writeback_remove(wn);
+        pthread_mutex_unlock(&writeback_lock);
+    }
+    writeback_end();
+    return(err);
+}
+
+static int writeback_name_func(void *baton, struct dirbuf *child) {
+    apr_array_header_t *names = baton;
+
+    if( !child->hidden )
+        APR_ARRAY_PUSH(names, const char *) =
+            apr_pstrdup(names->pool, child->name);
+    return(0);
+}
+
+/* Places the names the repository lists in directory 'path' in 'names' */
+static int writeback_list(const char *path, apr_array_header_t *names) {
+    struct dirbuf *dp;
+    int err;
+
+    if( (err = svnclient_list(path, NULL)) )
+        return(err);
+    dircache_rdlock();
+    if( (dp = dircache_lookup(path)) != NULL )
+        dircache_foreach(dp, writeback_name_func, names);
+    dircache_unlock();
+    return( dp ? 0 : ENOENT );
+}
+
+/*
+ * Removes directory 'path', which must be empty with the changes: all
+ * that the repository has in it deleted, and nothing made since.
+ */
+int writeback_rmdir(const char *path) {
+    struct writeback_node *wn, *cn;
+    apr_array_header_t *names = NULL;
+    apr_hash_index_t *hi;
+    apr_pool_t *subpool;
+    apr_uint64_t gen;
+    char *child;
+    void *val;
+    int err, i;
+
+    if( !strcmp(path, "/") )
+        return(EBUSY);
+
+    if( apr_pool_create(&subpool, writeback_pool) != APR_SUCCESS )
+        return(ENOMEM);
+    writeback_begin();
+    if( (err = writeback_node(path, &wn)) ) {
+        writeback_end();
+        apr_pool_destroy(subpool);
+        return(err);
+    }
+
+    if( !S_ISDIR(wn->mode) ) {
+        err = ENOTDIR;
+    } else if( wn->in_repo && !wn->added ) {
+        gen = wn->gen;
+        pthread_mutex_unlock(&writeback_lock);
+        names = apr_array_make(subpool, 16, sizeof(const char *));
+        err = writeback_list(path, names);
+        pthread_mutex_lock(&writeback_lock);
+        if( !err && ((wn = writeback_get(path)) == NULL ||
+                    wn->gen != gen || wn->deleted) )
+            err = ENOENT;
+    }
+
+    for( i = 0; !err && names && i < names->nelts; i++ ) {
+        child = apr_psprintf(subpool, "%s/%s", path,
+                APR_ARRAY_IDX(names, i, const char *));
+        if( (cn = writeback_get(child)) == NULL || !cn->deleted )
+            err = ENOTEMPTY;
+    }
+    if( !err && writeback_has_below(path, 1) )
+        err = ENOTEMPTY;
+
+    if( !err ) {
+        /* What's left below are deletions, which this one covers */
+        for( hi = apr_hash_first(NULL, writeback_index); hi;
+                hi = apr_hash_next(hi) ) {
+            apr_hash_this(hi, NULL, NULL, &val);
+            cn = val;
+            if( writeback_below(cn->path, path) )
+                writeback_drop(cn);
+        }
+        writeback_remove(wn);
+    }
+    pthread_mutex_unlock(&writeback_lock);
+    writeback_end();
+    apr_pool_destroy(subpool);
+    return(err);
+}
+
+/*
+ * Moves file 'from' to 'to', which the caller has checked can take it.
+ * A file with history keeps it, as a copy which later commits send as a
+ * delta. Called within a change.
+ */
+static int writeback_rename_file(const char *from, const char *to) {
+    struct writeback_node *wn, *tn;
+    struct stat st;
+    svn_revnum_t rev;
+    int exists, err;
+
+    if( (err = writeback_parent(to)) )
+        return(err);
+    if( (err = writeback_lookup(to, &st, &rev)) && err != ENOENT )
+        return(err);
+    if( (exists = (err == 0)) && S_ISDIR(st.st_mode) )
+        return(EISDIR);
+
+    if( (err = writeback_file(from, 0, &wn)) )
+        return(err);
+    if( (tn = writeback_get(to)) != NULL ) {
+        writeback_clear(tn);
+    } else if( (tn = writeback_new(to)) == NULL ) {
+        pthread_mutex_unlock(&writeback_lock);
+        return(ENOMEM);
+    } else if( exists ) {
+        tn->in_repo = 1;
+        tn->rev = rev;
+    }
+
+    tn->added = 1;
+    tn->mode = wn->mode;
+    tn->uid = wn->uid;
+    tn->gid = wn->gid;
+    tn->size = wn->size;
+    tn->mtime = wn->mtime;
+    tn->fd = wn->fd;
+    wn->fd = -1;
+    tn->dirty = wn->dirty;
+    tn->mode_set = wn->mode_set;
+    tn->owner = wn->owner;
+    tn->group = wn->group;
+    wn->owner = wn->group = NULL;
+    if( wn->copied || (wn->in_repo && !wn->added) ) {
+        tn->copied = 1;
+        tn->from = wn->from;
+        tn->from_rev = wn->from_rev;
+        tn->from_size = wn->from_size;
+        wn->from = NULL;
+    } else {
+        /* New here, so it all goes */
+        tn->dirty = 1;
+    }
+    writeback_remove(wn);
+    pthread_mutex_unlock(&writeback_lock);
+    return(0);
+}
+
+/*
+ * Directories are moved as a copy plus a delete committed there and then,
+ * after whatever else is pending, so the copy can come from the
+ * repository rather than everything in it being fetched and sent back.
+ */
+static int writeback_rename_dir(const char *from, const char *to) {
+    struct writeback_node *fn = NULL, *tn = NULL;
+    apr_uint64_t fgen = 0, tgen = 0;
+    struct stat st;
+    svn_revnum_t rev;
+    int err;
+
+    if( (err = writeback_commit()) )
+        return(err);
+
+    writeback_begin();
+    if( (err = writeback_parent(to)) == 0 &&
+            (err = writeback_lookup(to, &st, &rev)) == 0 )
+        err = EEXIST;
+    if( err == ENOENT && (err = writeback_node(from, &fn)) == 0 ) {
+        if( !fn->in_repo || fn->added || writeback_has_below(from, 0) ) {
+            /* Changed since the commit above */
+            err = EBUSY;
+        } else if( (tn = writeback_get(to)) == NULL &&
+                (tn = writeback_new(to)) == NULL ) {
+            err = ENOMEM;
+        } else if( (tn->from = strdup(from)) == NULL ) {
+            err = ENOMEM;
+            writeback_remove(tn);
+        } else {
+            tn->deleted = 0;
+            tn->added = 1;
+            tn->copied = 1;
+            tn->from_rev = fn->rev;
+            tn->mode = fn->mode;
+            tn->uid = fn->uid;
+            tn->gid = fn->gid;
+            tn->mtime = fn->mtime;
+            tgen = tn->gen;
+            fgen = fn->gen;
+            writeback_remove(fn);
+        }
+        pthread_mutex_unlock(&writeback_lock);
+    }
+    writeback_end();
+    if( err )
+        return(err);
+
+    if( (err = writeback_commit()) ) {
+        /* Put things back as they were */
+        writeback_begin();
+        pthread_mutex_lock(&writeback_lock);
+        if( (tn = writeback_get(to)) != NULL && tn->gen == tgen )
+            writeback_remove(tn);
+        if( (fn = writeback_get(from)) != NULL && fn->gen == fgen )
+            writeback_drop(fn);
+        pthread_mutex_unlock(&writeback_lock);
+        writeback_end();
+    }
+    return(err);
+}
+
+int writeback_rename(const char *from, const char *to) {
+    struct stat st;
+    svn_revnum_t rev;
+    int err;
+
+    if( !strcmp(from, "/") || !strcmp(to, "/") )
+        return(EBUSY);
+    if( writeback_below(to, from) )
+        return(EINVAL);
+    if( !strcmp(from, to) )
+        return(0);
+
+    if( (err = writeback_lookup(from, &st, &rev)) )
+        return(err);
+    if( S_ISDIR(st.st_mode) )
+        return(writeback_rename_dir(from, to));
+
+    writeback_begin();
+    err = writeback_rename_file(from, to);
+    writeback_end();
+    return(err);
+}
+
+int writeback_chmod(const char *path, mode_t mode) {
+    struct writeback_node *wn;
+    int err;
+
+    if( !strcmp(path, "/") )
+        return(EPERM);
+
+    writeback_begin();
+    if( (err = writeback_node(path, &wn)) == 0 ) {
+        wn->mode = (wn->mode & S_IFMT) | (mode & 07777);
+        wn->mode_set = 1;
+        pthread_mutex_unlock(&writeback_lock);
+    }
+    writeback_end();
+    return(err);
+}
+
+/*
+ * Sets svnfs:owner_user and/or svnfs:owner_group, by name, so the owner
+ * must be known to this host. (uid_t)-1 or (gid_t)-1 leaves one alone.
+ */
+int writeback_chown(const char *path, uid_t uid, gid_t gid) {
+    struct writeback_node *wn;
+    char *owner = NULL, *group = NULL;
+    int err;
+
+    if( !strcmp(path, "/") )
+        return(EPERM);
+    if( uid != (uid_t)-1 && idcache_username(uid, &owner) )
+        return(EINVAL);
+    if( gid != (gid_t)-1 && idcache_groupname(gid, &group) ) {
+        free(owner);
+        return(EINVAL);
+    }
+
+    writeback_begin();
+    if( (err = writeback_node(path, &wn)) == 0 ) {
+        if( owner ) {
+            free(wn->owner);
+            wn->owner = owner;
+            wn->uid = uid;
+            owner = NULL;
+        }
+        if( group ) {
+            free(wn->group);
+            wn->group = group;
+            wn->gid = gid;
+            group = NULL;
+        }
+        pthread_mutex_unlock(&writeback_lock);
+    }
+    writeback_end();
+    free(owner);
+    free(group);
+    return(err);
+}
+
+/*
+ * mtimes aren't versioned, so this only shows on pending nodes, until
+ * they're committed; for the rest it's quietly ignored.
+ */
+int writeback_utime(const char *path, time_t mtime) {
+    struct writeback_node *wn;
+
+    pthread_mutex_lock(&writeback_lock);
+    if( (wn = writeback_get(path)) != NULL && !wn->deleted )
+        wn->mtime = mtime;
+    pthread_mutex_unlock(&writeback_lock);
+    return(0);
+}
+
+/* Reads like svn_stream_read(): short only at the end */
+static svn_error_t *writeback_stream_read(void *baton, char *buf,
+        apr_size_t *len) {
+    struct writeback_stream *ws = baton;
+    size_t got = 0, n;
+    ssize_t r;
+    int err;
+
+    while( got < *len && ws->offset < ws->size ) {
+        n = *len - got;
+        if( n > ws->size - ws->offset )
+            n = ws->size - ws->offset;
+        if( ws->h ) {
+            if( (err = svnclient_read(ws->h, buf + got, &n, ws->offset)) )
+                return(svn_error_create(SVN_ERR_FS_GENERAL, NULL,
+                            strerror(err)));
+        } else if( (r = pread(ws->fd, buf + got, n, ws->offset)) < 0 ) {
+            if( errno == EINTR )
+                continue;
+            return(svn_error_create(SVN_ERR_FS_GENERAL, NULL,
+                        strerror(errno)));
+        } else {
+            n = r;
+        }
+        if( n == 0 )
+            break;
+        got += n;
+        ws->offset += n;
+    }
+    *len = got;
+    return(SVN_NO_ERROR);
+}
+
+static svn_stream_t *writeback_stream(struct svnclient_handle *h, int fd,
+        off_t size, apr_pool_t *pool) {
+    struct writeback_stream *ws = apr_pcalloc(pool, sizeof(*ws));
+    svn_stream_t *stream;
+
+    ws->h = h;
+    ws->fd = fd;
+    ws->size = size;
+    stream = svn_stream_create(ws, pool);
+    svn_stream_set_read(stream, writeback_stream_read);
+    return(stream);
+}
+
+static svn_error_t *writeback_window(svn_txdelta_window_t *window,
+        void *baton) {
+    struct writeback_window_baton *wb = baton;
+
+    if( window && window->new_data )
+        wb->sent += window->new_data->len;
+    return(wb->handler(window, wb->baton));
+}
+
+/* Puts the MD5 of what's left to read of 'stream' in 'digest' */
+static svn_error_t *writeback_md5(svn_stream_t *stream,
+        unsigned char *digest, apr_pool_t *pool) {
+    apr_md5_ctx_t ctx;
+    apr_size_t len;
+    char *buf;
+
+    buf = apr_palloc(pool, WRITEBACK_CHUNK);
+    apr_md5_init(&ctx);
+    do {
+        len = WRITEBACK_CHUNK;
+        SVN_ERR(svn_stream_read(stream, buf, &len));
+        apr_md5_update(&ctx, buf, len);
+    } while( len == WRITEBACK_CHUNK );
+    apr_md5_final(digest, &ctx);
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Sends the contents of 'wn' as a delta against those it started from,
+ * read through the content caches, which will usually have them, and
+ * puts their MD5 in *checksum. The base's MD5 is sent along, so the
+ * commit fails rather than the delta being applied to other contents.
+ */
+static svn_error_t *writeback_text(struct writeback_edit *eb,
+        struct writeback_node *wn, void *file_baton, const char **checksum,
+        apr_pool_t *pool) {
+    struct writeback_window_baton wb;
+    struct svnclient_handle *h = NULL;
+    svn_txdelta_stream_t *delta;
+    svn_stream_t *base;
+    unsigned char digest[APR_MD5_DIGESTSIZE];
+    const char *base_checksum = NULL;
+    svn_error_t *err;
+    int ret;
+
+    if( wn->from ) {
+        if( (ret = writeback_open_from(wn->from, wn->from_rev,
+                        wn->from_size, &h)) )
+            return(svn_error_create(SVN_ERR_FS_GENERAL, NULL,
+                        strerror(ret)));
+        if( (err = writeback_md5(writeback_stream(h, -1, wn->from_size,
+                            pool), digest, pool)) ) {
+            svnclient_close(h);
+            return(err);
+        }
+        base_checksum = svn_md5_digest_to_cstring(digest, pool);
+        base = writeback_stream(h, -1, wn->from_size, pool);
+    } else {
+        base = svn_stream_empty(pool);
+    }
+
+    if( (err = eb->editor->apply_textdelta(file_baton, base_checksum, pool,
+                    &wb.handler, &wb.baton)) == SVN_NO_ERROR ) {
+        wb.sent = 0;
+        svn_txdelta(&delta, base, writeback_stream(NULL, wn->fd, wn->size,
+                    pool), pool);
+        err = svn_txdelta_send_txstream(delta, writeback_window, &wb, pool);
+        eb->sent += wb.sent;
+        if( err == SVN_NO_ERROR )
+            *checksum = svn_md5_digest_to_cstring(
+                    svn_txdelta_md5_digest(delta), pool);
+    }
+    if( h )
+        svnclient_close(h);
+    return(err);
+}
+
+static svn_error_t *writeback_props(struct writeback_node *wn,
+        writeback_prop_func_t change, void *baton, apr_pool_t *pool) {
+    if( wn->mode_set )
+        SVN_ERR(change(baton, "svnfs:mode", svn_string_createf(pool, "%o",
+                        (unsigned int)(wn->mode & 07777)), pool));
+    if( wn->owner )
+        SVN_ERR(change(baton, "svnfs:owner_user",
+                    svn_string_create(wn->owner, pool), pool));
+    if( wn->group )
+        SVN_ERR(change(baton, "svnfs:owner_group",
+                    svn_string_create(wn->group, pool), pool));
+    return(SVN_NO_ERROR);
+}
+
+/* Called by svn_delta_path_driver() for each changed path */
+static svn_error_t *writeback_path(void **dir_baton, void *parent_baton,
+        void *callback_baton, const char *path, apr_pool_t *pool) {
+    struct writeback_edit *eb = callback_baton;
+    const svn_delta_editor_t *editor = eb->editor;
+    struct writeback_node *wn;
+    const char *copyfrom = NULL;
+    svn_revnum_t copyfrom_rev = SVN_INVALID_REVNUM;
+    const char *checksum = NULL;
+    void *file_baton;
+
+    *dir_baton = NULL;
+    wn = apr_hash_get(eb->nodes, path, APR_HASH_KEY_STRING);
+
+    if( wn->in_repo && (wn->deleted || wn->added) )
+        SVN_ERR(editor->delete_entry(path, wn->rev, parent_baton, pool));
+    if( wn->deleted )
+        return(SVN_NO_ERROR);
+
+    if( wn->copied ) {
+        copyfrom = apr_pstrcat(pool, svnfs.svnpath,
+                svn_path_uri_encode(wn->from, pool), NULL);
+        copyfrom_rev = wn->from_rev;
+    }
+
+    if( S_ISDIR(wn->mode) ) {
+        if( wn->added )
+            SVN_ERR(editor->add_directory(path, parent_baton, copyfrom,
+                        copyfrom_rev, pool, dir_baton));
+        else
+            SVN_ERR(editor->open_directory(path, parent_baton, wn->rev,
+                        pool, dir_baton));
+        return(writeback_props(wn, editor->change_dir_prop, *dir_baton,
+                    pool));
+    }
+
+    if( wn->added )
+        SVN_ERR(editor->add_file(path, parent_baton, copyfrom, copyfrom_rev,
+                    pool, &file_baton));
+    else
+        SVN_ERR(editor->open_file(path, parent_baton, wn->rev, pool,
+                    &file_baton));
+    SVN_ERR(writeback_props(wn, editor->change_file_prop, file_baton, pool));
+    if( wn->dirty )
+        SVN_ERR(writeback_text(eb, wn, file_baton, &checksum, pool));
+    return(editor->close_file(file_baton, checksum, pool));
+}
+
+static svn_error_t *writeback_committed(const svn_commit_info_t *info,
+        void *baton, apr_pool_t *pool) {
+    struct writeback_edit *eb = baton;
+
+    (void)pool;
+
+    eb->rev = info->revision;
+    return(SVN_NO_ERROR);
+}
+
+/*
+ * Sends every changed node as one revision, putting its number in 'eb',
+ * or leaves it SVN_INVALID_REVNUM if nothing has really changed. The
+ * index mustn't change meanwhile.
+ */
+static svn_error_t *writeback_send(struct writeback_edit *eb,
+        apr_pool_t *pool) {
+    struct writeback_node *wn;
+    svn_client_ctx_t *ctx;
+    svn_ra_session_t *session;
+    apr_array_header_t *paths;
+    apr_hash_index_t *hi;
+    svn_error_t *err;
+    void *val;
+
+    eb->nodes = apr_hash_make(pool);
+    paths = apr_array_make(pool, 16, sizeof(const char *));
+    for( hi = apr_hash_first(pool, writeback_index); hi;
+            hi = apr_hash_next(hi) ) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        wn = val;
+        if( wn->deleted || wn->added || wn->dirty || wn->mode_set ||
+                wn->owner || wn->group ) {
+            apr_hash_set(eb->nodes, wn->path + 1, APR_HASH_KEY_STRING, wn);
+            APR_ARRAY_PUSH(paths, const char *) = wn->path + 1;
+        }
+    }
+    if( paths->nelts == 0 )
+        return(SVN_NO_ERROR);
+
+    /* A session of its own, as direct file:// sessions can't commit */
+    SVN_ERR(svnclient_create_ctx(&ctx, pool));
+    stats_ra(STATS_RA_OPEN);
+    SVN_ERR(svn_client_open_ra_session(&session, svnfs.svnpath, ctx, pool));
+    stats_ra(STATS_RA_COMMIT);
+    SVN_ERR(svn_ra_get_commit_editor2(session, &eb->editor, &eb->edit_baton,
+                svnfs.commit_message, writeback_committed, eb, NULL, FALSE,
+                pool));
+    if( (err = svn_delta_path_driver(eb->editor, eb->edit_baton,
+                    SVN_INVALID_REVNUM, paths, writeback_path, eb, pool)) ) {
+        svn_error_clear(eb->editor->abort_edit(eb->edit_baton, pool));
+        return(err);
+    }
+    SVN_ERR(eb->editor->close_edit(eb->edit_baton, pool));
+
+    DEBUG("writeback_send(): r%ld, %d paths, %lu new bytes", eb->rev,
+            paths->nelts, (unsigned long)eb->sent);
+    pthread_mutex_lock(&writeback_lock);
+    writeback_stats.paths += paths->nelts;
+    writeback_stats.sent += eb->sent;
+    pthread_mutex_unlock(&writeback_lock);
+    return(SVN_NO_ERROR);
+}
+
+/* Brings the dircache up to 'rev', just committed */
+static void writeback_catch_up(svn_revnum_t rev) {
+    svn_revnum_t from;
+
+    dircache_rdlock();
+    from = dircache_get_rev();
+    dircache_unlock();
+
+    /* Without the poller only what was just committed needs forgetting */
+    if( !SVN_IS_VALID_REVNUM(from) )
+        from = rev - 1;
+    if( svnclient_catch_up(from, rev) ) {
+        /* Without the log there's no telling what's still current */
+        dircache_wrlock();
+        dircache_remove(dircache_root());
+        negcache_clear();
+        dircache_unlock();
+    }
+}
+
+/*
+ * Commits everything pending as one revision, then forgets it, once the
+ * dircache shows the new revision instead. On failure it's all kept, to
+ * be tried again.
+ */
+int writeback_commit(void) {
+    struct writeback_edit eb;
+    apr_hash_index_t *hi;
+    apr_pool_t *subpool;
+    svn_error_t *err;
+    void *val;
+    int pending, ret = 0;
+
+    pthread_mutex_lock(&writeback_lock);
+    while( writeback_committing )
+        pthread_cond_wait(&writeback_cond, &writeback_lock);
+    writeback_committing = 1;
+    while( writeback_changing )
+        pthread_cond_wait(&writeback_cond, &writeback_lock);
+    pending = apr_hash_count(writeback_index);
+    pthread_mutex_unlock(&writeback_lock);
+
+    if( pending ) {
+        memset(&eb, 0, sizeof(eb));
+        eb.rev = SVN_INVALID_REVNUM;
+        subpool = svn_pool_create(NULL);
+        if( (err = writeback_send(&eb, subpool)) ) {
+            syslog(LOG_ERR, "Can't commit %d pending changes - %s", pending,
+                    err->message ? err->message : "unknown error");
+            svn_error_clear(err);
+            ret = EIO;
+        }
+        svn_pool_destroy(subpool);
+        if( ret == 0 && SVN_IS_VALID_REVNUM(eb.rev) )
+            writeback_catch_up(eb.rev);
+    }
+
+    pthread_mutex_lock(&writeback_lock);
+    if( pending && ret == 0 ) {
+        if( SVN_IS_VALID_REVNUM(eb.rev) )
+            writeback_stats.commits++;
+        for( hi = apr_hash_first(NULL, writeback_index); hi;
+                hi = apr_hash_next(hi) ) {
+            apr_hash_this(hi, NULL, NULL, &val);
+            writeback_drop(val);
+        }
+    } else if( ret ) {
+        writeback_stats.failed++;
+    }
+    writeback_committing = 0;
+    pthread_cond_broadcast(&writeback_cond);
+    pthread_mutex_unlock(&writeback_lock);
+    return(ret);
+}
+
+void writeback_get_stats(struct writeback_stats *stats) {
+    pthread_mutex_lock(&writeback_lock);
+    *stats = writeback_stats;
+    pthread_mutex_unlock(&writeback_lock);
+}
@@ -0,0 +1,80 @@
+/*
+ * $Id$
+ *
+ *     SVN Filesystem
+ *     Copyright (C) 2006 John Madden <maddenj@skynet.ie>
+ *
+ *     This program can be distributed under the terms of the GNU GPL.
+ *     See the file COPYING for details.
+*/
+
+/* vim "+set tabstop=4 shiftwidth=4 expandtab" */
+#ifndef _HAVE_WRITEBACK_H
+#define _HAVE_WRITEBACK_H 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <apr.h>
+
+/* Contents are copied to and from the repository this much at a time */
+#define WRITEBACK_CHUNK (64 * 1024)
+
+/* What svnfs:mode is taken to be when it isn't set */
+#define WRITEBACK_DEFAULT_PERMS 0775
+
+struct writeback_stats {
+    apr_uint64_t commits;       /* Revisions committed */
+    apr_uint64_t failed;        /* Commits which didn't go through */
+    apr_uint64_t paths;         /* Changed paths committed */
+    apr_uint64_t written;       /* Bytes written by applications */
+    apr_uint64_t sent;          /* New bytes in the text deltas sent */
+    apr_size_t pending;         /* Paths with changes not yet committed */
+};
+
+/* Called with each pending child by writeback_children() */
+typedef int (*writeback_func_t)(void *baton, const char *name,
+        const struct stat *st);
+
+int writeback_init(const char *dir);
+
+int writeback_getattr(const char *path, struct stat *st, int *err);
+
+int writeback_overlaid(const char *path);
+
+int writeback_added(const char *path);
+
+int writeback_has_contents(const char *path);
+
+void writeback_children(const char *path, writeback_func_t func, void *baton);
+
+int writeback_read(const char *path, char *buf, size_t *size, off_t offset,
+        int *err);
+
+int writeback_open(const char *path, int trunc);
+
+int writeback_write(const char *path, const char *buf, size_t size,
+        off_t offset);
+
+int writeback_truncate(const char *path, off_t size);
+
+int writeback_create(const char *path, mode_t mode);
+
+int writeback_unlink(const char *path);
+
+int writeback_rmdir(const char *path);
+
+int writeback_rename(const char *from, const char *to);
+
+int writeback_chmod(const char *path, mode_t mode);
+
+int writeback_chown(const char *path, uid_t uid, gid_t gid);
+
+int writeback_utime(const char *path, time_t mtime);
+
+int writeback_commit(void);
+
+void writeback_get_stats(struct writeback_stats *stats);
+
+#endif /* ifndef _HAVE_WRITEBACK_H */
@@ -28,7 +28,7 @@ if( $libs ) {
    while( <IN> ) {
       chomp();
       if( /svn/ && 
-         (/client/ || /wc/ || /repos/) ) {
+         (/client/ || /wc/ || /repos/ || /svn_fs-/) ) {
 
          if( !$out_ld_path ) {
             $out_ld_path = $_;